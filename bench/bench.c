@@ -0,0 +1,242 @@
+// bench.c
+// Runs benchmark workloads through the interpreter, several times each, and
+// reports the median wall time, allocations and peak memory of each, as a
+// table and as JSON.
+// part of the Racket Interpreter Project
+//
+// Usage: bench [-n runs] [-i interpreter] [-o results.json] workload...
+//
+// Each run is a fresh process reading the workload on stdin, with its output
+// thrown away. Allocations come from the interpreter's --alloc-stats report;
+// peak memory is the largest resident set size of any run.
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// What one workload measured
+struct Result {
+    char *name;
+    bool ok;
+    double medianMs;
+    double minMs;
+    long allocations;
+    long bytes;
+    long peakRssKb;
+};
+typedef struct Result Result;
+
+bool runOnce(char *, char *, double *, long *, long *, long *);
+void measure(char *, char *, int, Result *);
+char *workloadName(char *);
+int compareDoubles(const void *, const void *);
+void printTable(Result *, int);
+void writeJson(FILE *, Result *, int, int);
+
+int main(int argc, char *argv[]) {
+    int runs = 5;
+    char *interpreter = "./interpreter";
+    char *jsonPath = NULL;
+
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+            interpreter = argv[++i];
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else {
+            break;
+        }
+    }
+    if (i == argc || runs < 1) {
+        printf("Usage: %s [-n runs] [-i interpreter] [-o results.json] workload...\n", argv[0]);
+        return 1;
+    }
+
+    int count = argc - i;
+    Result *results = malloc(sizeof(Result) * count);
+    bool allOk = true;
+    for (int w = 0; w < count; w++) {
+        measure(interpreter, argv[i + w], runs, &results[w]);
+        allOk = allOk && results[w].ok;
+    }
+
+    printTable(results, count);
+    if (jsonPath != NULL) {
+        FILE *out = fopen(jsonPath, "w");
+        if (out == NULL) {
+            printf("Error: can't write %s\n", jsonPath);
+            return 1;
+        }
+        writeJson(out, results, count, runs);
+        fclose(out);
+        printf("\nWrote %s\n", jsonPath);
+    }
+    free(results);
+    return allOk ? 0 : 1;
+}
+
+/*
+ * Run a workload the given number of times and fill in its result.
+ */
+void measure(char *interpreter, char *workload, int runs, Result *result) {
+    double *times = malloc(sizeof(double) * runs);
+    result->name = workloadName(workload);
+    result->ok = true;
+    result->allocations = 0;
+    result->bytes = 0;
+    result->peakRssKb = 0;
+    for (int i = 0; i < runs; i++) {
+        long rssKb;
+        if (!runOnce(interpreter, workload, &times[i], &result->allocations,
+                     &result->bytes, &rssKb)) {
+            result->ok = false;
+            break;
+        }
+        if (rssKb > result->peakRssKb) {
+            result->peakRssKb = rssKb;
+        }
+    }
+    if (result->ok) {
+        qsort(times, runs, sizeof(double), compareDoubles);
+        result->minMs = times[0];
+        // For an even number of runs, the mean of the middle two
+        result->medianMs = (times[(runs - 1) / 2] + times[runs / 2]) / 2;
+    }
+    free(times);
+}
+
+/*
+ * Run the interpreter on a workload once. Returns false if it could not be
+ * run or did not exit cleanly.
+ */
+bool runOnce(char *interpreter, char *workload, double *ms, long *allocations,
+             long *bytes, long *rssKb) {
+    int input = open(workload, O_RDONLY);
+    if (input < 0) {
+        printf("Error: can't open %s\n", workload);
+        return false;
+    }
+    // The allocation report comes back on stderr
+    int report[2];
+    if (pipe(report) < 0) {
+        close(input);
+        return false;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(input, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        dup2(report[1], STDERR_FILENO);
+        close(report[0]);
+        execl(interpreter, interpreter, "--alloc-stats", (char *)NULL);
+        _exit(127);
+    }
+    close(input);
+    close(report[1]);
+    if (pid < 0) {
+        close(report[0]);
+        return false;
+    }
+
+    char text[4096];
+    size_t size = 0;
+    ssize_t got;
+    while ((got = read(report[0], text + size, sizeof(text) - 1 - size)) > 0) {
+        size += got;
+        if (size == sizeof(text) - 1) {
+            // Keep only the end, where the report is
+            memmove(text, text + size / 2, size - size / 2);
+            size -= size / 2;
+        }
+    }
+    text[size] = '\0';
+    close(report[0]);
+
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    // On Linux ru_maxrss is in kilobytes
+    *rssKb = usage.ru_maxrss;
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("Error: %s failed on %s\n", interpreter, workload);
+        return false;
+    }
+    char *line = strstr(text, "allocations: ");
+    if (line == NULL || sscanf(line, "allocations: %ld bytes: %ld", allocations, bytes) != 2) {
+        printf("Error: %s gave no allocation report for %s\n", interpreter, workload);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * The name of a workload: its file name without directories or ".txt".
+ */
+char *workloadName(char *path) {
+    char *slash = strrchr(path, '/');
+    char *name = strdup(slash != NULL ? slash + 1 : path);
+    char *dot = strrchr(name, '.');
+    if (dot != NULL && !strcmp(dot, ".txt")) {
+        *dot = '\0';
+    }
+    return name;
+}
+
+/*
+ * Order doubles from smallest to largest, for qsort.
+ */
+int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Print the results as a table.
+ */
+void printTable(Result *results, int count) {
+    printf("%-12s %11s %11s %13s %11s %11s\n", "workload", "median ms", "min ms",
+           "allocations", "alloc MB", "peak RSS MB");
+    for (int i = 0; i < count; i++) {
+        Result *r = &results[i];
+        if (!r->ok) {
+            printf("%-12s %11s\n", r->name, "failed");
+            continue;
+        }
+        printf("%-12s %11.1f %11.1f %13ld %11.1f %11.1f\n", r->name, r->medianMs,
+               r->minMs, r->allocations, r->bytes / 1048576.0, r->peakRssKb / 1024.0);
+    }
+}
+
+/*
+ * Write the results as JSON.
+ */
+void writeJson(FILE *out, Result *results, int count, int runs) {
+    fprintf(out, "{\n  \"runs\": %d,\n  \"workloads\": [\n", runs);
+    for (int i = 0; i < count; i++) {
+        Result *r = &results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"ok\": %s", r->name, r->ok ? "true" : "false");
+        if (r->ok) {
+            fprintf(out, ", \"median_ms\": %.3f, \"min_ms\": %.3f, \"allocations\": %ld, "
+                    "\"allocated_bytes\": %ld, \"peak_rss_kb\": %ld",
+                    r->medianMs, r->minMs, r->allocations, r->bytes, r->peakRssKb);
+        }
+        fprintf(out, "}%s\n", i + 1 < count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
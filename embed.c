@@ -0,0 +1,117 @@
+// embed.c
+// The C API for embedding the interpreter in another program.
+// part of the Racket Interpreter Project
+#include "embed.h"
+#include <stdio.h>
+#include <string.h>
+#include "error.h"
+#include "future.h"
+#include "linkedlist.h"
+#include "parser.h"
+#include "place.h"
+#include "talloc.h"
+#include "tokenizer.h"
+
+/*
+ * Create an interpreter instance, with the primitives bound, allocating from
+ * a new arena of its own.
+ */
+Interp *interp_new(void) {
+    Arena *heap = newArena();
+    Arena *previous = useArena(heap);
+    Interp *interp = newInterp();
+    useArena(previous);
+    return interp;
+}
+
+/*
+ * Evaluate each expression of a program at the top level of interp, returning
+ * the value of the last one, or NULL if there was an error.
+ */
+Value *interp_eval_string(Interp *interp, const char *source) {
+    Arena *previous = useArena(interp->heap);
+    Value *result = makeNull();
+    result->type = VOID_TYPE;
+
+    startRun(&interp->limits);
+    ErrorTrap trap;
+    pushErrorTrap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        // fmemopen can't open an empty buffer, but then there's nothing to do
+        size_t size = strlen(source);
+        if (size > 0) {
+            FILE *in = fmemopen((char *)source, size, "r");
+            if (in == NULL) {
+                raiseError("Error: could not read the program.");
+            }
+            char *error;
+            Value *tokens = tokenizeFile(in, 1, &error);
+            fclose(in);
+            if (tokens == NULL) {
+                raiseError("%s", error);
+            }
+            for (Value *cur = parse(tokens); cur->type != NULL_TYPE; cur = cdr(cur)) {
+                result = eval(car(cur), interp->topFrame);
+            }
+        }
+        popErrorTrap(&trap);
+    } else {
+        interp->error = errorMessage(trap.raised);
+        result = NULL;
+    }
+    endRun();
+    useArena(previous);
+    return result;
+}
+
+/*
+ * Limit what each later interp_eval_string call on interp may use.
+ */
+void interp_set_limits(Interp *interp, long fuel, long memory, int depth) {
+    interp->limits.fuel = fuel;
+    interp->limits.memory = memory;
+    interp->limits.depth = depth;
+}
+
+/*
+ * The message of the last error interp_eval_string returned NULL for.
+ */
+const char *interp_error(Interp *interp) {
+    return interp->error;
+}
+
+/*
+ * Bind name at the top level of interp to a primitive implemented by function.
+ */
+void interp_define_primitive(Interp *interp, const char *name,
+                             Value *(*function)(Value *args)) {
+    Arena *previous = useArena(interp->heap);
+    char *nameCopy = talloc(strlen(name) + 1);
+    strcpy(nameCopy, name);
+    Value *primitive = talloc(sizeof(Value));
+    primitive->type = PRIMITIVE_TYPE;
+    primitive->pf = function;
+    bindValue(nameCopy, primitive, interp->topFrame);
+    useArena(previous);
+}
+
+/*
+ * The text display would print for a value from interp.
+ */
+const char *interp_to_string(Interp *interp, Value *value) {
+    Arena *previous = useArena(interp->heap);
+    char *text = valueToString(value);
+    useArena(previous);
+    return text;
+}
+
+/*
+ * Free an instance and everything in its heap.
+ */
+void interp_free(Interp *interp) {
+    // interp itself is in the heap, so don't touch it after freeing that
+    Arena *heap = interp->heap;
+    releasePlaces(heap);
+    releaseTasks(heap);
+    freeArena(heap);
+}
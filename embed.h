@@ -0,0 +1,53 @@
+#include "value.h"
+#include "interpreter.h"
+
+#ifndef _EMBED
+#define _EMBED
+
+// The C API for embedding the interpreter in another program.
+//
+// Each instance has its own heap and its own top-level frame, so definitions
+// made in one are not seen by another, and separate instances can be used at
+// the same time from different threads (each instance by one thread at a
+// time). Errors in Racket code, including syntax errors, are returned to the
+// host instead of exiting; primitives defined by the host can report errors
+// the same way with raiseError from error.h. An error inside a future or one
+// of the parallel primitives is raised again where the future is touched or
+// the primitive waits for its tasks, so it comes back to the host too. An
+// error inside a place is printed and ends only that place.
+//
+// Values returned by an instance, and whatever its futures and parallel
+// primitives allocate, live in its heap, which is freed all at once
+// by interp_free; nothing is freed before that. Hosts running many unrelated
+// scripts should use a fresh instance for each.
+
+// Create an interpreter instance, with the primitives bound.
+Interp *interp_new(void);
+
+// Evaluate each expression of a program at the top level of interp. Returns
+// the value of the last expression (a void value if there were none), or NULL
+// if there was an error, in which case interp_error gives the message.
+Value *interp_eval_string(Interp *interp, const char *source);
+
+// Limit each later interp_eval_string call on interp to fuel evaluation steps,
+// memory bytes allocated and depth levels of recursion, each 0 for no limit
+// (see sandbox.h). Going over one is returned as an error like any other.
+void interp_set_limits(Interp *interp, long fuel, long memory, int depth);
+
+// The message of the last error interp_eval_string returned NULL for.
+const char *interp_error(Interp *interp);
+
+// Bind name at the top level of interp to a primitive implemented by
+// function, which is passed its evaluated arguments as a Racket list.
+void interp_define_primitive(Interp *interp, const char *name,
+                             Value *(*function)(Value *args));
+
+// The text display would print for a value from interp.
+const char *interp_to_string(Interp *interp, Value *value);
+
+// Free an instance and everything in its heap, including every value it
+// returned. Futures of the instance that are still running are waited for;
+// those never touched may never run.
+void interp_free(Interp *interp);
+
+#endif
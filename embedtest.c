@@ -0,0 +1,330 @@
+// embedtest.c
+// Tests the C API for embedding the interpreter (see embed.h), as a host
+// program linked with libinterpreter.a would use it: that instances don't see
+// each other's definitions, even from different threads at the same time,
+// that errors come back to the host instead of exiting, and that interp_free
+// gives back what an instance used.
+// part of the Racket Interpreter Project
+//
+// Usage: embedtest
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "embed.h"
+#include "error.h"
+#include "talloc.h"
+
+// Instances made and freed by the interp_free check, and how many items the
+// vector each one makes has
+#define FREE_ROUNDS 200
+#define ROUND_ITEMS "200000"
+// How far the resident size may grow over those rounds, in bytes. Keeping
+// every round's heap would take several hundred megabytes.
+#define FREE_GROWTH (64L * 1024 * 1024)
+// Loop length for the instances run at the same time
+#define THREAD_STEPS "2000"
+// Instances freed while their futures may still be queued or running
+#define FUTURE_ROUNDS 100
+
+bool checkIsolation();
+bool checkThreads();
+bool checkErrors();
+bool checkPrimitive();
+bool checkLimits();
+bool checkFree();
+bool checkFreeFutures();
+bool evalsTo(Interp *, char *, char *);
+bool failsWith(Interp *, char *, char *);
+long residentSize();
+
+// A check, and what it is reported as
+struct Check {
+    bool (*run)();
+    char *name;
+};
+typedef struct Check Check;
+
+static Check checks[] = {
+    {checkIsolation, "isolation"},
+    {checkThreads, "threads"},
+    {checkErrors, "errors"},
+    {checkPrimitive, "primitive"},
+    {checkLimits, "limits"},
+    {checkFree, "free"},
+    {checkFreeFutures, "free with futures"},
+};
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        printf("Usage: %s\n", argv[0]);
+        return 1;
+    }
+    int count = sizeof(checks) / sizeof(checks[0]);
+    int passed = 0;
+    for (int i = 0; i < count; i++) {
+        if (checks[i].run()) {
+            printf("PASS    embed %s\n", checks[i].name);
+            passed++;
+        } else {
+            printf("FAIL    embed %s\n", checks[i].name);
+        }
+    }
+    printf("%d of %d embed checks passed\n", passed, count);
+    return passed == count ? 0 : 1;
+}
+
+/*
+ * Definitions, set! and mutation in one instance aren't seen by another.
+ */
+bool checkIsolation() {
+    Interp *a = interp_new();
+    Interp *b = interp_new();
+    bool ok = evalsTo(a, "(define x 1) (define v (vector 1 2)) x", "1 ") &&
+        evalsTo(b, "(define x 2) x", "2 ") &&
+        evalsTo(a, "(set! x 10) (vector-set! v 0 5) x", "10 ") &&
+        evalsTo(b, "x", "2 ") &&
+        failsWith(b, "v", "Error 404: variable not found: 'v ") &&
+        evalsTo(a, "(vector-ref v 0)", "5 ");
+    interp_free(a);
+    // a's heap is gone; b must not have been using any of it
+    ok = ok && evalsTo(b, "(+ x 1)", "3.000000 ");
+    interp_free(b);
+    return ok;
+}
+
+// What one of checkThreads' threads works with
+struct Worker {
+    Interp *interp;
+    char *name;
+    bool ok;
+};
+typedef struct Worker Worker;
+
+/*
+ * Define a count in a worker's instance and run it up, checking that the
+ * definitions are still the worker's own at the end.
+ */
+void *runWorker(void *argument) {
+    Worker *worker = argument;
+    char program[256];
+    snprintf(program, sizeof(program),
+             "(define who \"%s\") (define n 0) "
+             "(define up (lambda (k total) (if (= k 0) total (up (- k 1) (+ total 1))))) "
+             "(set! n (up " THREAD_STEPS " 0)) n", worker->name);
+    char expected[64];
+    snprintf(expected, sizeof(expected), "\"%s\" ", worker->name);
+    worker->ok = evalsTo(worker->interp, program, THREAD_STEPS ".000000 ") &&
+        evalsTo(worker->interp, "who", expected);
+    return NULL;
+}
+
+/*
+ * Separate instances can run at the same time from different threads.
+ */
+bool checkThreads() {
+    Worker workers[] = {{interp_new(), "first", false}, {interp_new(), "second", false}};
+    pthread_t threads[2];
+    for (int i = 0; i < 2; i++) {
+        pthread_create(&threads[i], NULL, runWorker, &workers[i]);
+    }
+    bool ok = true;
+    for (int i = 0; i < 2; i++) {
+        pthread_join(threads[i], NULL);
+        ok = ok && workers[i].ok;
+        interp_free(workers[i].interp);
+    }
+    return ok;
+}
+
+/*
+ * Errors, including syntax errors and errors inside futures, come back to the
+ * host, and the instance can carry on afterwards.
+ */
+bool checkErrors() {
+    Interp *interp = interp_new();
+    bool ok = failsWith(interp, "(car 5)", "Error: Can't get car.") &&
+        failsWith(interp, "(undefined-thing)", "Error 404: variable not found: 'undefined-thing ") &&
+        failsWith(interp, "(touch (future (lambda () (car 5))))", "Error: Can't get car.") &&
+        interp_eval_string(interp, "(+ 1") == NULL &&
+        interp_eval_string(interp, "(define y 3) (car y) (define z 4)") == NULL &&
+        evalsTo(interp, "y", "3 ") &&
+        failsWith(interp, "z", "Error 404: variable not found: 'z ") &&
+        evalsTo(interp, "(+ y 1)", "4.000000 ");
+    interp_free(interp);
+    return ok;
+}
+
+/*
+ * A primitive for checkPrimitive: ten times its argument, which must be a
+ * number.
+ */
+Value *primitiveTimesTen(Value *args) {
+    Value *number = args->type == CONS_TYPE ? args->c.car : args;
+    if (number->type != INT_TYPE && number->type != DOUBLE_TYPE) {
+        raiseError("Error: times-ten wants a number.");
+    }
+    Value *result = talloc(sizeof(Value));
+    result->type = DOUBLE_TYPE;
+    result->d = (number->type == INT_TYPE ? number->i : number->d) * 10;
+    return result;
+}
+
+/*
+ * Primitives defined by the host can be called, and their errors come back
+ * like any other. They are only bound in the instance they were defined in.
+ */
+bool checkPrimitive() {
+    Interp *interp = interp_new();
+    Interp *other = interp_new();
+    interp_define_primitive(interp, "times-ten", primitiveTimesTen);
+    bool ok = evalsTo(interp, "(times-ten (+ 1 2))", "30.000000 ") &&
+        evalsTo(interp, "(map times-ten (list 1 2))", "'( 10.000000 20.000000 ) ") &&
+        failsWith(interp, "(times-ten \"a\")", "Error: times-ten wants a number.") &&
+        failsWith(other, "(times-ten 1)", "Error 404: variable not found: 'times-ten ");
+    interp_free(interp);
+    interp_free(other);
+    return ok;
+}
+
+/*
+ * Going over a limit is an error like any other, and lifting the limits lets
+ * the same instance run the program.
+ */
+bool checkLimits() {
+    Interp *interp = interp_new();
+    char *loop = "(define spin (lambda (k) (if (= k 0) 0 (spin (- k 1))))) (spin 5000)";
+    interp_set_limits(interp, 10000, 0, 0);
+    bool ok = failsWith(interp, loop, "Error: out of fuel");
+    interp_set_limits(interp, 0, 1000000, 0);
+    ok = ok && failsWith(interp, "(make-vector 1000000 0)", "Error: memory limit exceeded");
+    interp_set_limits(interp, 0, 0, 0);
+    ok = ok && evalsTo(interp, loop, "0 ");
+    interp_free(interp);
+    return ok;
+}
+
+/*
+ * Making, using and freeing many instances one after another doesn't keep
+ * their heaps.
+ */
+bool checkFree() {
+    char *program = "(define v (make-vector " ROUND_ITEMS " (list 1 2))) (vector-length v)";
+    // The first rounds grow the allocator's own pools, which it keeps
+    long start = 0;
+    for (int i = 0; i < FREE_ROUNDS; i++) {
+        if (i == 10) {
+            start = residentSize();
+        }
+        Interp *interp = interp_new();
+        bool ok = evalsTo(interp, program, ROUND_ITEMS " ");
+        interp_free(interp);
+        if (!ok) {
+            return false;
+        }
+    }
+    long growth = residentSize() - start;
+    if (growth > FREE_GROWTH) {
+        printf("        resident size grew by %ld bytes\n", growth);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Freeing an instance whose futures were never touched, or failed, or are
+ * still running, leaves nothing on the thread pool using its heap, and what
+ * its futures allocated is freed with it.
+ */
+bool checkFreeFutures() {
+    // Everything is defined before the first future starts, as futures read
+    // the top-level frame
+    char *program =
+        "(define spin (lambda (k) (if (= k 0) 0 (spin (- k 1))))) "
+        "(define futures (vector 0 0 0)) "
+        "(vector-set! futures 0 (future (lambda () (spin 2000)))) "
+        "(vector-set! futures 1 (future (lambda () (touch (future (lambda () (spin 500))))))) "
+        "(vector-set! futures 2 (future (lambda () (car 5)))) "
+        "(touch (future (lambda () 1)))";
+    char *allocating = "(vector-length (touch (future (lambda () (make-vector "
+        ROUND_ITEMS " (list 1 2))))))";
+    long start = 0;
+    for (int i = 0; i < FUTURE_ROUNDS; i++) {
+        if (i == 10) {
+            start = residentSize();
+        }
+        Interp *interp = interp_new();
+        bool ok = evalsTo(interp, program, "1 ") &&
+            failsWith(interp, "(touch (vector-ref futures 2))", "Error: Can't get car.") &&
+            evalsTo(interp, allocating, ROUND_ITEMS " ");
+        interp_free(interp);
+        if (!ok) {
+            return false;
+        }
+    }
+    long growth = residentSize() - start;
+    if (growth > FREE_GROWTH) {
+        printf("        resident size grew by %ld bytes\n", growth);
+        return false;
+    }
+    // The pool still works for the instances after them
+    Interp *interp = interp_new();
+    bool ok = evalsTo(interp, "(touch (future (lambda () (+ 1 2))))", "3.000000 ");
+    interp_free(interp);
+    return ok;
+}
+
+/*
+ * Evaluate program in interp, reporting it unless it gives a value that
+ * prints as expected.
+ */
+bool evalsTo(Interp *interp, char *program, char *expected) {
+    Value *value = interp_eval_string(interp, program);
+    if (value == NULL) {
+        printf("        %s\n        expected: %s\n        got error: %s\n",
+               program, expected, interp_error(interp));
+        return false;
+    }
+    const char *got = interp_to_string(interp, value);
+    if (strcmp(got, expected)) {
+        printf("        %s\n        expected: %s\n        got:      %s\n",
+               program, expected, got);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Evaluate program in interp, reporting it unless it fails with the expected
+ * error message.
+ */
+bool failsWith(Interp *interp, char *program, char *expected) {
+    Value *value = interp_eval_string(interp, program);
+    if (value != NULL) {
+        printf("        %s\n        expected error: %s\n        got:            %s\n",
+               program, expected, interp_to_string(interp, value));
+        return false;
+    }
+    if (strcmp(interp_error(interp), expected)) {
+        printf("        %s\n        expected error: %s\n        got error:      %s\n",
+               program, expected, interp_error(interp));
+        return false;
+    }
+    return true;
+}
+
+/*
+ * How much of this process is in memory, in bytes.
+ */
+long residentSize() {
+    long pages = 0;
+    FILE *in = fopen("/proc/self/statm", "r");
+    if (in != NULL) {
+        if (fscanf(in, "%*ld %ld", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(in);
+    }
+    return pages * sysconf(_SC_PAGESIZE);
+}
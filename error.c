@@ -0,0 +1,112 @@
+// error.c
+// Raising errors, and catching them with error traps.
+// part of the Racket Interpreter Project
+#include "error.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "linkedlist.h"
+#include "talloc.h"
+#include "sandbox.h"
+#include "profile.h"
+#include "output.h"
+
+// The trap errors on this thread jump to, or NULL to exit instead
+static __thread ErrorTrap *currentTrap = NULL;
+
+/*
+ * Make trap the one errors on this thread jump to.
+ */
+void pushErrorTrap(ErrorTrap *trap) {
+    trap->raised = NULL;
+    trap->depth = evalDepth;
+    trap->calls = callDepth;
+    trap->previous = currentTrap;
+    currentTrap = trap;
+}
+
+/*
+ * Stop using trap, going back to the one before it.
+ */
+void popErrorTrap(ErrorTrap *trap) {
+    currentTrap = trap->previous;
+}
+
+/*
+ * Raise an error whose message is made from format and the rest of the
+ * arguments, as printf would.
+ */
+void raiseError(char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int size = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    char *message = talloc(size + 1);
+    va_start(args, format);
+    vsnprintf(message, size + 1, format, args);
+    va_end(args);
+    raiseValue(makeError(message));
+}
+
+/*
+ * Raise value: jump to the current error trap with it, or print its message
+ * and exit if there is none.
+ */
+void raiseValue(Value *value) {
+    if (currentTrap == NULL) {
+        // Anything displayed so far goes first
+        flushOutput(standardOutput());
+        printf("%s\n", errorMessage(value));
+        texit(EXIT_FAILURE);
+    }
+    // Pop the trap first, so an error while handling this one goes further out
+    ErrorTrap *trap = currentTrap;
+    currentTrap = trap->previous;
+    trap->raised = value;
+    evalDepth = trap->depth;
+    if (callDepth > trap->calls) {
+        unwindProcedures(trap->calls);
+    }
+    longjmp(trap->jump, 1);
+}
+
+/*
+ * Create an error value with the given message.
+ */
+Value *makeError(char *message) {
+    Value *error = talloc(sizeof(Value));
+    error->type = ERROR_TYPE;
+    error->s = message;
+    return error;
+}
+
+/*
+ * The message to report for a raised value that nothing handled: an error's
+ * own message, or for anything else, the value itself.
+ */
+char *errorMessage(Value *raised) {
+    if (raised->type == ERROR_TYPE) {
+        return raised->s;
+    }
+    char *shown = valueToString(raised);
+    char *message = talloc(strlen(shown) + 32);
+    sprintf(message, "uncaught exception: %s", shown);
+    return message;
+}
+
+/*
+ * The text display would print for value, for use in error messages.
+ */
+char *valueToString(Value *value) {
+    char *text;
+    size_t size;
+    FILE *out = open_memstream(&text, &size);
+    displayTo(value, out);
+    fclose(out);
+    // Move it into talloc'd memory so it is freed along with everything else
+    char *result = talloc(size + 1);
+    memcpy(result, text, size + 1);
+    free(text);
+    return result;
+}
@@ -0,0 +1,61 @@
+#include <setjmp.h>
+#include "value.h"
+
+#ifndef _ERROR
+#define _ERROR
+
+// Errors are raised with raiseError, which raises an error value (an
+// ERROR_TYPE value holding the message in s), or with raiseValue, which
+// raises any value, as Racket's raise does. If the thread has set an error
+// trap, the raised value jumps back to the most recent one, abandoning
+// whatever was being evaluated; otherwise its message is printed and the
+// program exits.
+//
+// To catch errors:
+//
+//     ErrorTrap trap;
+//     pushErrorTrap(&trap);
+//     if (setjmp(trap.jump) == 0) {
+//         ... code that may raise errors ...
+//         popErrorTrap(&trap);
+//     } else {
+//         ... trap.raised is what was raised; the trap is already popped ...
+//     }
+//
+// Local variables changed after setjmp must be volatile to be read after
+// an error.
+struct ErrorTrap {
+    jmp_buf jump;
+    Value *raised;
+    // How deep eval was when the trap was set, to go back to after an error
+    int depth;
+    // How many calls the profiler's shadow stack held then
+    int calls;
+    struct ErrorTrap *previous;
+};
+typedef struct ErrorTrap ErrorTrap;
+
+// Make trap the one errors on this thread jump to.
+void pushErrorTrap(ErrorTrap *trap);
+
+// Stop using trap, which must be the most recent one, going back to the one
+// before it.
+void popErrorTrap(ErrorTrap *trap);
+
+// Raise an error whose message is made from format and the rest of the
+// arguments, as printf would. Does not return.
+void raiseError(char *format, ...);
+
+// Raise value: jump to the current error trap with it. Does not return.
+void raiseValue(Value *value);
+
+// Create an error value with the given message.
+Value *makeError(char *message);
+
+// The message to report for a raised value that nothing handled.
+char *errorMessage(Value *raised);
+
+// The text display would print for value, for use in error messages.
+char *valueToString(Value *value);
+
+#endif
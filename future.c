@@ -0,0 +1,507 @@
+// future.c
+// Futures on a work-stealing thread pool.
+// part of the Racket Interpreter Project
+#include "future.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "interpreter.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "error.h"
+
+// Worker threads recurse through eval just like the main thread does
+#define WORKER_STACK_SIZE (256 * 1024 * 1024)
+
+enum {PENDING, RUNNING, DONE};
+
+// A piece of work for the pool: the function to run, its data, what it
+// raised if it failed, and who is waiting for it
+struct Task {
+    void (*work)(void *);
+    void *data;
+    Value *error;
+    // A share of the run of the thread that spawned it
+    Budget budget;
+    // The heap of the instance (or place) it works for
+    Arena *owner;
+    // The next task in a list of those taken out of the deques unrun
+    struct Task *next;
+    int state;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+};
+
+// What a Racket future runs: a thunk, and the result once it has run
+struct ThunkCall {
+    Value *thunk;
+    Value *result;
+};
+typedef struct ThunkCall ThunkCall;
+
+// A worker's double-ended queue of tasks. The owner pushes and pops at the
+// bottom, thieves take from the top, so stolen work is the oldest (and usually
+// the largest) piece.
+struct Deque {
+    Task **tasks;
+    int top;
+    int bottom;
+    int capacity;
+    pthread_mutex_t lock;
+};
+typedef struct Deque Deque;
+
+void startPool();
+void forgetPool();
+void *workerLoop(void *);
+void push(Deque *, Task *);
+Task *popBottom(Deque *, int);
+Task *stealTop(Deque *, int);
+int dropTasks(Arena *, Task **);
+bool working(Arena *);
+Task *findWork(int);
+void waitForTask(Task *);
+void runTask(Task *);
+void callThunk(void *);
+
+int workerCount = 0;
+Deque *deques = NULL;
+pthread_t *threads = NULL;
+pthread_once_t poolOnce = PTHREAD_ONCE_INIT;
+
+// Sleeping workers wait on workAvailable until queued becomes nonzero
+pthread_mutex_t sleepLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t workAvailable = PTHREAD_COND_INITIALIZER;
+int queued = 0;
+int stopping = 0;
+
+// The owner of the task each worker has taken from a deque, until it is done
+// with it. Set under the deque's lock, so a task is always either in a deque
+// or counted here. Cleared under sleepLock, signalling taskDone.
+Arena **workingFor = NULL;
+pthread_cond_t taskDone = PTHREAD_COND_INITIALIZER;
+
+// Where submissions from threads that are not workers go next
+int nextDeque = 0;
+
+// Index of the current thread's deque, or -1 if it is not a worker
+static __thread int workerIndex = -1;
+// The owner of the task this thread is running, if any
+static __thread Arena *runningFor = NULL;
+
+// In deterministic mode tasks are not queued; each one runs on the thread
+// that joins it, at the moment it is joined
+bool deterministic = false;
+
+// Start running thunk on the thread pool and return a future for its result.
+Value *makeFuture(Value *thunk){
+    if (thunk->type != CLOSURE_TYPE && thunk->type != PRIMITIVE_TYPE) {
+        raiseError("Error: future expects a procedure.");
+    }
+    ThunkCall *call = talloc(sizeof(ThunkCall));
+    call->thunk = thunk;
+    call->result = NULL;
+    Value *value = talloc(sizeof(Value));
+    value->type = FUTURE_TYPE;
+    value->p = spawnTask(callThunk, call);
+    return value;
+}
+
+// Wait for a future to finish and return its result. If no worker has started
+// the future yet, the calling thread runs it itself instead of waiting.
+Value *touchFuture(Value *value){
+    if (value->type != FUTURE_TYPE) {
+        // Like Racket, touching something that is not a future gives it back
+        return value;
+    }
+    Task *task = value->p;
+    joinTask(task);
+    return ((ThunkCall *)task->data)->result;
+}
+
+// Start running work(data) on the thread pool, returning a task to join.
+Task *spawnTask(void (*work)(void *), void *data){
+    Task *task = talloc(sizeof(Task));
+    task->work = work;
+    task->data = data;
+    task->error = NULL;
+    task->budget = shareBudget();
+    // Work a task starts is for whoever the task is for
+    task->owner = runningFor != NULL ? runningFor : currentArena();
+    task->state = PENDING;
+    pthread_mutex_init(&task->lock, NULL);
+    pthread_cond_init(&task->done, NULL);
+    if (deterministic) {
+        return task;
+    }
+    pthread_once(&poolOnce, startPool);
+
+    // Workers push onto their own deque; anyone else spreads work around
+    int target = workerIndex;
+    if (target < 0) {
+        target = __atomic_fetch_add(&nextDeque, 1, __ATOMIC_RELAXED) % workerCount;
+    }
+    push(&deques[target], task);
+
+    pthread_mutex_lock(&sleepLock);
+    queued++;
+    pthread_cond_signal(&workAvailable);
+    pthread_mutex_unlock(&sleepLock);
+    return task;
+}
+
+// Wait for a task to finish, raising its error again if it had one. If no
+// worker has started it yet, the calling thread runs it itself instead of
+// waiting.
+void joinTask(Task *task){
+    waitForTask(task);
+    if (task->error != NULL) {
+        raiseValue(task->error);
+    }
+}
+
+// Wait for all of the tasks to finish, then raise the first error any of
+// them had.
+void joinTasks(Task **tasks, int count){
+    for (int i = 0; i < count; i++) {
+        waitForTask(tasks[i]);
+    }
+    for (int i = 0; i < count; i++) {
+        if (tasks[i]->error != NULL) {
+            raiseValue(tasks[i]->error);
+        }
+    }
+}
+
+// Turn deterministic mode on or off. It should be set before any task starts.
+void setDeterministic(bool on){
+    deterministic = on;
+}
+
+// Whether deterministic mode is on.
+bool isDeterministic(){
+    return deterministic;
+}
+
+// Number of worker threads the pool uses (or would use, if not yet started).
+int futureWorkers(){
+    if (deterministic) {
+        return 1;
+    }
+    if (workerCount > 0) {
+        return workerCount;
+    }
+    char *setting = getenv("FUTURE_THREADS");
+    if (setting != NULL && atoi(setting) > 0) {
+        return atoi(setting);
+    }
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    // The thread that touches futures does work too, so leave it a core
+    return cores > 2 ? (int)cores - 1 : 1;
+}
+
+// Stop and join the worker threads, if they were ever started.
+void shutdownFutures(){
+    if (threads == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&sleepLock);
+    stopping = 1;
+    pthread_cond_broadcast(&workAvailable);
+    pthread_mutex_unlock(&sleepLock);
+    for (int i = 0; i < workerCount; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (int i = 0; i < workerCount; i++) {
+        pthread_mutex_destroy(&deques[i].lock);
+        free(deques[i].tasks);
+    }
+    free(deques);
+    free(threads);
+    free(workingFor);
+    deques = NULL;
+    threads = NULL;
+    workingFor = NULL;
+}
+
+// Stop any task working for owner from starting, and wait for those already
+// running to finish, as owner is about to be freed.
+void releaseTasks(Arena *owner){
+    if (threads == NULL) {
+        return;
+    }
+    // Holding sleepLock keeps workers from finishing tasks, so if none of
+    // them is working for owner after the deques are cleared, nothing is
+    // left that could queue more work for it. Tasks are only taken out once
+    // nothing working for owner is running, as that might still touch them.
+    Task *dropped = NULL;
+    pthread_mutex_lock(&sleepLock);
+    do {
+        while (working(owner)) {
+            pthread_cond_wait(&taskDone, &sleepLock);
+        }
+        queued -= dropTasks(owner, &dropped);
+    } while (working(owner));
+    pthread_mutex_unlock(&sleepLock);
+    // Nothing is left that could run these
+    for (; dropped != NULL; dropped = dropped->next) {
+        if (__atomic_load_n(&dropped->state, __ATOMIC_ACQUIRE) == PENDING) {
+            releaseBudget(dropped->budget);
+        }
+    }
+}
+
+/*
+ * Create the deques and start one worker thread per deque.
+ */
+void startPool(){
+    workerCount = futureWorkers();
+    deques = malloc(sizeof(Deque) * workerCount);
+    threads = malloc(sizeof(pthread_t) * workerCount);
+    workingFor = calloc(workerCount, sizeof(Arena *));
+    for (int i = 0; i < workerCount; i++) {
+        deques[i].capacity = 64;
+        deques[i].tasks = malloc(sizeof(Task *) * deques[i].capacity);
+        deques[i].top = 0;
+        deques[i].bottom = 0;
+        pthread_mutex_init(&deques[i].lock, NULL);
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, WORKER_STACK_SIZE);
+    for (int i = 0; i < workerCount; i++) {
+        pthread_create(&threads[i], &attr, workerLoop, (void *)(long)i);
+    }
+    pthread_attr_destroy(&attr);
+    pthread_atfork(NULL, NULL, forgetPool);
+}
+
+/*
+ * In the child of a fork, which has none of the workers, start again with no
+ * pool, so the next future starts a new one. Tasks queued before the fork
+ * are lost, and what the parent's pool had is left alone rather than freed.
+ */
+void forgetPool(){
+    workerCount = 0;
+    deques = NULL;
+    threads = NULL;
+    workingFor = NULL;
+    pthread_once_t once = PTHREAD_ONCE_INIT;
+    poolOnce = once;
+    pthread_mutex_init(&sleepLock, NULL);
+    pthread_cond_init(&workAvailable, NULL);
+    pthread_cond_init(&taskDone, NULL);
+    queued = 0;
+    stopping = 0;
+    nextDeque = 0;
+}
+
+/*
+ * Body of each worker thread: run tasks from its own deque, steal when
+ * that is empty, and sleep when there is nothing to steal either.
+ */
+void *workerLoop(void *arg){
+    workerIndex = (int)(long)arg;
+    while (1) {
+        Task *task = findWork(workerIndex);
+        if (task != NULL) {
+            pthread_mutex_lock(&sleepLock);
+            queued--;
+            pthread_mutex_unlock(&sleepLock);
+            // Skip tasks that a join already claimed
+            int expected = PENDING;
+            if (__atomic_compare_exchange_n(&task->state, &expected, RUNNING, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                runTask(task);
+            }
+            pthread_mutex_lock(&sleepLock);
+            __atomic_store_n(&workingFor[workerIndex], NULL, __ATOMIC_RELEASE);
+            pthread_cond_broadcast(&taskDone);
+            pthread_mutex_unlock(&sleepLock);
+            continue;
+        }
+        pthread_mutex_lock(&sleepLock);
+        while (queued == 0 && !stopping) {
+            pthread_cond_wait(&workAvailable, &sleepLock);
+        }
+        int stop = stopping;
+        pthread_mutex_unlock(&sleepLock);
+        if (stop) {
+            return NULL;
+        }
+    }
+}
+
+/*
+ * Take a task from the bottom of worker self's deque, or else steal one
+ * from the top of another deque.
+ */
+Task *findWork(int self){
+    Task *task = popBottom(&deques[self], self);
+    for (int i = 1; task == NULL && i < workerCount; i++) {
+        task = stealTop(&deques[(self + i) % workerCount], self);
+    }
+    return task;
+}
+
+/*
+ * Take every task working for owner out of the deques, adding them to the
+ * dropped list, and return how many there were.
+ */
+int dropTasks(Arena *owner, Task **dropped){
+    int count = 0;
+    for (int i = 0; i < workerCount; i++) {
+        Deque *deque = &deques[i];
+        pthread_mutex_lock(&deque->lock);
+        int kept = deque->top;
+        for (int j = deque->top; j < deque->bottom; j++) {
+            Task *task = deque->tasks[j];
+            if (task->owner != owner) {
+                deque->tasks[kept++] = task;
+                continue;
+            }
+            task->next = *dropped;
+            *dropped = task;
+            count++;
+        }
+        deque->bottom = kept;
+        pthread_mutex_unlock(&deque->lock);
+    }
+    return count;
+}
+
+/*
+ * Whether any worker has taken a task working for owner and isn't done with
+ * it. The caller holds sleepLock.
+ */
+bool working(Arena *owner){
+    for (int i = 0; i < workerCount; i++) {
+        if (__atomic_load_n(&workingFor[i], __ATOMIC_ACQUIRE) == owner) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Wait for a task to finish, running it here if nobody has started it.
+ */
+void waitForTask(Task *task){
+    if (__atomic_load_n(&task->state, __ATOMIC_ACQUIRE) == DONE) {
+        return;
+    }
+    // Claim the task if nobody has started it; it stays in its deque and
+    // whoever pops it later will see that it is taken
+    int expected = PENDING;
+    if (__atomic_compare_exchange_n(&task->state, &expected, RUNNING, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        runTask(task);
+        return;
+    }
+    pthread_mutex_lock(&task->lock);
+    while (__atomic_load_n(&task->state, __ATOMIC_ACQUIRE) != DONE) {
+        pthread_cond_wait(&task->done, &task->lock);
+    }
+    pthread_mutex_unlock(&task->lock);
+}
+
+/*
+ * Run a claimed task and wake up anyone waiting for it. An error in the task
+ * is kept for whoever joins it. The task allocates from an arena of its own,
+ * which its owner adopts once it is done, so what it made lives and dies with
+ * the owner's heap rather than the heap of the thread that ran it.
+ */
+void runTask(Task *task){
+    Budget previous = useBudget(task->budget);
+    Arena *previousOwner = runningFor;
+    runningFor = task->owner;
+    Arena *heap = newArena();
+    Arena *previousArena = useArena(heap);
+    ErrorTrap trap;
+    pushErrorTrap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        task->work(task->data);
+        popErrorTrap(&trap);
+    } else {
+        task->error = trap.raised;
+    }
+    useArena(previousArena);
+    // Before the task is done, so its owner can't be freed first
+    adoptArena(task->owner, heap);
+    runningFor = previousOwner;
+    useBudget(previous);
+    releaseBudget(task->budget);
+    pthread_mutex_lock(&task->lock);
+    __atomic_store_n(&task->state, DONE, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&task->done);
+    pthread_mutex_unlock(&task->lock);
+}
+
+/*
+ * Work function of a Racket future: call its thunk with no arguments.
+ */
+void callThunk(void *data){
+    ThunkCall *call = data;
+    call->result = applyProcedure(call->thunk, makeNull());
+}
+
+/*
+ * Push a task onto the bottom of a deque, growing it if needed.
+ */
+void push(Deque *deque, Task *task){
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom == deque->capacity) {
+        // Slide the live part down before growing
+        int live = deque->bottom - deque->top;
+        if (live * 2 > deque->capacity) {
+            deque->capacity *= 2;
+        }
+        Task **tasks = malloc(sizeof(Task *) * deque->capacity);
+        for (int i = 0; i < live; i++) {
+            tasks[i] = deque->tasks[deque->top + i];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->top = 0;
+        deque->bottom = live;
+    }
+    deque->tasks[deque->bottom] = task;
+    deque->bottom++;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+/*
+ * Pop the newest task from the bottom of a deque for worker self, or return
+ * NULL.
+ */
+Task *popBottom(Deque *deque, int self){
+    Task *task = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top) {
+        deque->bottom--;
+        task = deque->tasks[deque->bottom];
+        __atomic_store_n(&workingFor[self], task->owner, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+/*
+ * Steal the oldest task from the top of a deque for worker self, or return
+ * NULL.
+ */
+Task *stealTop(Deque *deque, int self){
+    Task *task = NULL;
+    // Don't wait on a busy deque; there may be others to steal from
+    if (pthread_mutex_trylock(&deque->lock) != 0) {
+        return NULL;
+    }
+    if (deque->bottom > deque->top) {
+        task = deque->tasks[deque->top];
+        deque->top++;
+        __atomic_store_n(&workingFor[self], task->owner, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
@@ -0,0 +1,70 @@
+#include <stdbool.h>
+#include "talloc.h"
+#include "value.h"
+
+#ifndef _FUTURE
+#define _FUTURE
+
+// Futures run a thunk (a closure or primitive taking no arguments) on a pool
+// of worker threads, one per core beyond the first. Each worker keeps its own
+// deque of futures: it works from the bottom of its own deque, and when that
+// is empty it steals from the top of another worker's deque.
+//
+// Rules for shared state: every thread allocates into its own talloc arena,
+// and the parse tree, the top-level frame and closures' frames are shared by
+// all threads. Shared frames are only safe to read. A future must not define
+// or set! top-level variables, or mutate vectors and hash tables that other
+// threads use, while other threads may be running; doing so races with them.
+// Bindings a future makes in its own closure's frames are private to it.
+//
+// A process forked after the pool has started gets a fresh pool of its own
+// the first time it needs one; futures queued before the fork never run in
+// it.
+
+// A piece of work for the thread pool; see spawnTask.
+typedef struct Task Task;
+
+// Start running thunk on the thread pool and return a future for its result.
+Value *makeFuture(Value *thunk);
+
+// Wait for a future to finish and return its result. If no worker has started
+// the future yet, the calling thread runs it itself instead of waiting. If the
+// future's thunk raised an error, touching it raises the error again.
+Value *touchFuture(Value *future);
+
+// Start running work(data) on the thread pool, returning a task to join.
+// This is what futures are built on, for C code that wants parallelism.
+Task *spawnTask(void (*work)(void *), void *data);
+
+// Wait for a task to finish. If no worker has started it yet, the calling
+// thread runs it itself instead of waiting. An error raised by the task is
+// caught on its thread and raised again here.
+void joinTask(Task *task);
+
+// Wait for all of the tasks to finish, then raise the first error (in the
+// order given) that any of them raised.
+void joinTasks(Task **tasks, int count);
+
+// Turn deterministic mode on or off. In deterministic mode nothing runs on
+// worker threads: every task (and future) runs on the thread that joins (or
+// touches) it, at that moment, so runs are repeatable for testing. It should
+// be set before any task starts.
+void setDeterministic(bool on);
+
+// Whether deterministic mode is on.
+bool isDeterministic();
+
+// Number of worker threads the pool uses (or would use, if not yet started).
+// The FUTURE_THREADS environment variable overrides the default.
+int futureWorkers();
+
+// Stop and join the worker threads, if they were ever started.
+void shutdownFutures();
+
+// Stop any future or task started while allocating from arena (or by one of
+// those) from starting, and wait for those already running to finish. Must be
+// done before an arena made by newArena is freed. A future that was never
+// touched may never run.
+void releaseTasks(Arena *arena);
+
+#endif
@@ -0,0 +1,256 @@
+// hamt.c
+// Persistent hash array mapped tries backing immutable hash maps.
+// part of the Racket Interpreter Project
+#include "hamt.h"
+#include <string.h>
+#include "hashtable.h"
+#include "linkedlist.h"
+#include "talloc.h"
+
+#define BITS 5
+#define MASK 31
+
+HamtNode *newNode(unsigned int, int, bool);
+HamtNode *setIn(HamtNode *, int, unsigned int, Value *, Value *, bool *);
+HamtNode *removeIn(HamtNode *, int, unsigned int, Value *, bool *);
+HamtNode *mergeLeaves(int, HamtEntry *, HamtEntry *);
+int slotIndex(HamtNode *, unsigned int);
+
+// Look up key in the trie rooted at root (which may be NULL for an empty
+// map). Returns NULL if the key is not present.
+Value *hamtGet(HamtNode *root, Value *key){
+    unsigned int hash = hashEqual(key);
+    HamtNode *node = root;
+    int shift = 0;
+    while (node != NULL) {
+        if (node->collision) {
+            for (int i = 0; i < node->size; i++) {
+                if (isEqual(node->entries[i].key, key)) {
+                    return node->entries[i].value;
+                }
+            }
+            return NULL;
+        }
+        unsigned int bit = 1u << ((hash >> shift) & MASK);
+        if (!(node->bitmap & bit)) {
+            return NULL;
+        }
+        HamtEntry *entry = &node->entries[slotIndex(node, bit)];
+        if (entry->child == NULL) {
+            if (entry->hash == hash && isEqual(entry->key, key)) {
+                return entry->value;
+            }
+            return NULL;
+        }
+        node = entry->child;
+        shift += BITS;
+    }
+    return NULL;
+}
+
+// Return a new trie that also binds key to value, sharing all unchanged nodes
+// with the old one. Sets *added if the key was not already present.
+HamtNode *hamtSet(HamtNode *root, Value *key, Value *value, bool *added){
+    *added = false;
+    if (root == NULL) {
+        root = newNode(0, 0, false);
+    }
+    return setIn(root, 0, hashEqual(key), key, value, added);
+}
+
+// Return a new trie without key, sharing all unchanged nodes with the old
+// one. Sets *removed if the key was present. Returns NULL for an empty map.
+HamtNode *hamtRemove(HamtNode *root, Value *key, bool *removed){
+    *removed = false;
+    if (root == NULL) {
+        return NULL;
+    }
+    HamtNode *result = removeIn(root, 0, hashEqual(key), key, removed);
+    if (result != NULL && result->size == 0) {
+        return NULL;
+    }
+    return result;
+}
+
+// Call fn on every binding in the trie, passing data along.
+void hamtForEach(HamtNode *root, void (*fn)(Value *, Value *, void *), void *data){
+    if (root == NULL) {
+        return;
+    }
+    for (int i = 0; i < root->size; i++) {
+        HamtEntry *entry = &root->entries[i];
+        if (entry->child != NULL) {
+            hamtForEach(entry->child, fn, data);
+        } else {
+            fn(entry->key, entry->value, data);
+        }
+    }
+}
+
+/*
+ * Create a node with room for size entries.
+ */
+HamtNode *newNode(unsigned int bitmap, int size, bool collision){
+    HamtNode *node = talloc(sizeof(HamtNode));
+    node->bitmap = bitmap;
+    node->size = size;
+    node->collision = collision;
+    node->entries = talloc(sizeof(HamtEntry) * (size > 0 ? size : 1));
+    return node;
+}
+
+/*
+ * Find where the entry for a bitmap bit lives in a node's entries: the number
+ * of present slots below it.
+ */
+int slotIndex(HamtNode *node, unsigned int bit){
+    return __builtin_popcount(node->bitmap & (bit - 1));
+}
+
+/*
+ * Copy the path down to where key belongs at this level, binding it to value.
+ */
+HamtNode *setIn(HamtNode *node, int shift, unsigned int hash,
+                Value *key, Value *value, bool *added){
+    if (node->collision) {
+        HamtNode *copy;
+        for (int i = 0; i < node->size; i++) {
+            if (isEqual(node->entries[i].key, key)) {
+                copy = newNode(0, node->size, true);
+                memcpy(copy->entries, node->entries, sizeof(HamtEntry) * node->size);
+                copy->entries[i].value = value;
+                return copy;
+            }
+        }
+        copy = newNode(0, node->size + 1, true);
+        memcpy(copy->entries, node->entries, sizeof(HamtEntry) * node->size);
+        copy->entries[node->size] = (HamtEntry){key, value, hash, NULL};
+        *added = true;
+        return copy;
+    }
+
+    unsigned int bit = 1u << ((hash >> shift) & MASK);
+    int index = slotIndex(node, bit);
+
+    // Empty slot: copy the node with a new leaf inserted
+    if (!(node->bitmap & bit)) {
+        HamtNode *copy = newNode(node->bitmap | bit, node->size + 1, false);
+        memcpy(copy->entries, node->entries, sizeof(HamtEntry) * index);
+        copy->entries[index] = (HamtEntry){key, value, hash, NULL};
+        memcpy(&copy->entries[index + 1], &node->entries[index],
+               sizeof(HamtEntry) * (node->size - index));
+        *added = true;
+        return copy;
+    }
+
+    HamtNode *copy = newNode(node->bitmap, node->size, false);
+    memcpy(copy->entries, node->entries, sizeof(HamtEntry) * node->size);
+    HamtEntry *entry = &copy->entries[index];
+    if (entry->child != NULL) {
+        // Subtrie: recurse one level down
+        entry->child = setIn(entry->child, shift + BITS, hash, key, value, added);
+    } else if (entry->hash == hash && isEqual(entry->key, key)) {
+        // Same key: replace the value
+        entry->value = value;
+    } else {
+        // Different key in this slot: push both leaves down a level
+        HamtEntry leaf = {key, value, hash, NULL};
+        entry->child = mergeLeaves(shift + BITS, entry, &leaf);
+        entry->key = NULL;
+        entry->value = NULL;
+        *added = true;
+    }
+    return copy;
+}
+
+/*
+ * Build the subtrie holding two leaves that collided at the level above.
+ */
+HamtNode *mergeLeaves(int shift, HamtEntry *first, HamtEntry *second){
+    // Out of hash bits: the keys share a full hash
+    if (shift >= 32) {
+        HamtNode *node = newNode(0, 2, true);
+        node->entries[0] = *first;
+        node->entries[1] = *second;
+        return node;
+    }
+    unsigned int firstBit = 1u << ((first->hash >> shift) & MASK);
+    unsigned int secondBit = 1u << ((second->hash >> shift) & MASK);
+    if (firstBit == secondBit) {
+        HamtNode *node = newNode(firstBit, 1, false);
+        node->entries[0] = (HamtEntry){NULL, NULL, 0,
+                                       mergeLeaves(shift + BITS, first, second)};
+        return node;
+    }
+    HamtNode *node = newNode(firstBit | secondBit, 2, false);
+    if (firstBit < secondBit) {
+        node->entries[0] = *first;
+        node->entries[1] = *second;
+    } else {
+        node->entries[0] = *second;
+        node->entries[1] = *first;
+    }
+    return node;
+}
+
+/*
+ * Copy the path down to key without it. Returns node itself if the key is
+ * not there, so that nothing is copied.
+ */
+HamtNode *removeIn(HamtNode *node, int shift, unsigned int hash,
+                   Value *key, bool *removed){
+    if (node->collision) {
+        for (int i = 0; i < node->size; i++) {
+            if (isEqual(node->entries[i].key, key)) {
+                HamtNode *copy = newNode(0, node->size - 1, true);
+                memcpy(copy->entries, node->entries, sizeof(HamtEntry) * i);
+                memcpy(&copy->entries[i], &node->entries[i + 1],
+                       sizeof(HamtEntry) * (node->size - i - 1));
+                *removed = true;
+                return copy;
+            }
+        }
+        return node;
+    }
+
+    unsigned int bit = 1u << ((hash >> shift) & MASK);
+    if (!(node->bitmap & bit)) {
+        return node;
+    }
+    int index = slotIndex(node, bit);
+    HamtEntry *entry = &node->entries[index];
+    HamtEntry replacement = *entry;
+    if (entry->child != NULL) {
+        HamtNode *child = removeIn(entry->child, shift + BITS, hash, key, removed);
+        if (!*removed) {
+            return node;
+        }
+        if (child->size == 1 && child->entries[0].child == NULL) {
+            // Pull a lone leaf back up into this level
+            replacement = child->entries[0];
+        } else if (child->size > 0) {
+            replacement.child = child;
+        } else {
+            replacement.child = NULL;
+            replacement.key = NULL;
+        }
+    } else if (entry->hash == hash && isEqual(entry->key, key)) {
+        *removed = true;
+        replacement.key = NULL;
+    } else {
+        return node;
+    }
+
+    // The slot became empty: copy the node without it
+    if (replacement.key == NULL && replacement.child == NULL) {
+        HamtNode *copy = newNode(node->bitmap & ~bit, node->size - 1, false);
+        memcpy(copy->entries, node->entries, sizeof(HamtEntry) * index);
+        memcpy(&copy->entries[index], &node->entries[index + 1],
+               sizeof(HamtEntry) * (node->size - index - 1));
+        return copy;
+    }
+    HamtNode *copy = newNode(node->bitmap, node->size, false);
+    memcpy(copy->entries, node->entries, sizeof(HamtEntry) * node->size);
+    copy->entries[index] = replacement;
+    return copy;
+}
@@ -0,0 +1,45 @@
+#include <stdbool.h>
+#include "value.h"
+
+#ifndef _HAMT
+#define _HAMT
+
+// A node of a hash array mapped trie. Each level uses five bits of a key's
+// hash to pick one of 32 slots, and bitmap records which slots are present, so
+// that entries only holds the present ones (indexed by popcount). A collision
+// node instead holds every key that shares one full hash, in no order.
+struct HamtNode {
+    unsigned int bitmap;
+    int size;
+    bool collision;
+    struct HamtEntry *entries;
+};
+
+// One entry of a node: either a key/value binding, or (if child is not NULL)
+// a pointer to the next level of the trie.
+struct HamtEntry {
+    Value *key;
+    Value *value;
+    unsigned int hash;
+    struct HamtNode *child;
+};
+
+typedef struct HamtNode HamtNode;
+typedef struct HamtEntry HamtEntry;
+
+// Look up key in the trie rooted at root (which may be NULL for an empty
+// map). Returns NULL if the key is not present.
+Value *hamtGet(HamtNode *root, Value *key);
+
+// Return a new trie that also binds key to value, sharing all unchanged nodes
+// with the old one. Sets *added if the key was not already present.
+HamtNode *hamtSet(HamtNode *root, Value *key, Value *value, bool *added);
+
+// Return a new trie without key, sharing all unchanged nodes with the old
+// one. Sets *removed if the key was present. Returns NULL for an empty map.
+HamtNode *hamtRemove(HamtNode *root, Value *key, bool *removed);
+
+// Call fn on every binding in the trie, passing data along.
+void hamtForEach(HamtNode *root, void (*fn)(Value *, Value *, void *), void *data);
+
+#endif
@@ -0,0 +1,222 @@
+// hashtable.c
+// Open addressing hash tables backing make-hash and make-hasheq.
+// part of the Racket Interpreter Project
+#include "hashtable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "linkedlist.h"
+#include "talloc.h"
+
+#define INITIAL_CAPACITY 8
+
+unsigned int hashString(char *);
+unsigned int hashDouble(double);
+unsigned int mixHash(unsigned int, unsigned int);
+HashEntry *findSlot(HashTable *, Value *, unsigned int);
+void growTable(HashTable *);
+
+// Create a new, empty hash table.
+HashTable *newHashTable(bool eq){
+    HashTable *table = talloc(sizeof(HashTable));
+    table->capacity = INITIAL_CAPACITY;
+    table->count = 0;
+    table->used = 0;
+    table->eq = eq;
+    table->entries = talloc(sizeof(HashEntry) * INITIAL_CAPACITY);
+    memset(table->entries, 0, sizeof(HashEntry) * INITIAL_CAPACITY);
+    return table;
+}
+
+// Look up key in the table. Returns NULL if the key is not present.
+Value *hashGet(HashTable *table, Value *key){
+    unsigned int hash = table->eq ? hashEq(key) : hashEqual(key);
+    HashEntry *slot = findSlot(table, key, hash);
+    if (slot->key == NULL || slot->removed) {
+        return NULL;
+    }
+    return slot->value;
+}
+
+// Bind key to value in the table, replacing any old binding for the key.
+void hashPut(HashTable *table, Value *key, Value *value){
+    // Keep the table at most 3/4 full, counting tombstones
+    if ((table->used + 1) * 4 > table->capacity * 3) {
+        growTable(table);
+    }
+    unsigned int hash = table->eq ? hashEq(key) : hashEqual(key);
+    HashEntry *slot = findSlot(table, key, hash);
+    if (slot->key == NULL) {
+        table->used++;
+    }
+    if (slot->key == NULL || slot->removed) {
+        table->count++;
+    }
+    slot->key = key;
+    slot->value = value;
+    slot->hash = hash;
+    slot->removed = false;
+}
+
+// Remove the binding for key from the table. Returns whether there was one.
+bool hashRemove(HashTable *table, Value *key){
+    unsigned int hash = table->eq ? hashEq(key) : hashEqual(key);
+    HashEntry *slot = findSlot(table, key, hash);
+    if (slot->key == NULL || slot->removed) {
+        return false;
+    }
+    // Leave the key in place as a tombstone
+    slot->removed = true;
+    slot->value = NULL;
+    table->count--;
+    return true;
+}
+
+// Hash a value so that values that are isEqual hash the same.
+unsigned int hashEqual(Value *value){
+    unsigned int hash = value->type;
+    switch (value->type) {
+        case INT_TYPE:
+            // ints and doubles with the same value are equal keys
+            return hashDouble(value->i);
+        case DOUBLE_TYPE:
+            return hashDouble(value->d);
+        case STR_TYPE:
+        case SYMBOL_TYPE:
+        case BOOL_TYPE:
+            return mixHash(hash, hashString(value->s));
+        case NULL_TYPE:
+            return hash;
+        case CONS_TYPE:
+            // Walk the spine iteratively, only recursing into the items
+            while (value->type == CONS_TYPE) {
+                hash = mixHash(hash, hashEqual(car(value)));
+                value = cdr(value);
+            }
+            return mixHash(hash, hashEqual(value));
+        case VECTOR_TYPE:
+            for (int i = 0; i < value->v.size; i++) {
+                hash = mixHash(hash, hashEqual(value->v.items[i]));
+            }
+            return hash;
+        case FLVECTOR_TYPE:
+            for (int i = 0; i < value->fv.size; i++) {
+                hash = mixHash(hash, hashDouble(value->fv.items[i]));
+            }
+            return hash;
+        default:
+            return hashEq(value);
+    }
+}
+
+// Hash a value so that values that are isEq hash the same.
+unsigned int hashEq(Value *value){
+    switch (value->type) {
+        case INT_TYPE:
+            return hashDouble(value->i);
+        case SYMBOL_TYPE:
+        case BOOL_TYPE:
+            // symbols are not interned, so they are identified by name
+            return mixHash(value->type, hashString(value->s));
+        case NULL_TYPE:
+        case VOID_TYPE:
+            return value->type;
+        case PRIMITIVE_TYPE: {
+            uintptr_t address = (uintptr_t)value->pf;
+            return mixHash((unsigned int)address, (unsigned int)(address >> 16));
+        }
+        default: {
+            uintptr_t address = (uintptr_t)value;
+            return mixHash((unsigned int)address, (unsigned int)(address >> 16));
+        }
+    }
+}
+
+/*
+ * FNV-1a hash of a string.
+ */
+unsigned int hashString(char *s){
+    unsigned int hash = 2166136261u;
+    while (*s != '\0') {
+        hash ^= (unsigned char)*s;
+        hash *= 16777619u;
+        s++;
+    }
+    return hash;
+}
+
+/*
+ * Hash the bits of a double, treating 0.0 and -0.0 alike.
+ */
+unsigned int hashDouble(double d){
+    if (d == 0.0) {
+        d = 0.0;
+    }
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    return mixHash((unsigned int)bits, (unsigned int)(bits >> 32));
+}
+
+/*
+ * Combine a running hash with the hash of the next part of a value.
+ */
+unsigned int mixHash(unsigned int hash, unsigned int next){
+    hash ^= next + 0x9e3779b9u + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+/*
+ * Find the slot holding key, or the slot where key would be inserted:
+ * the first tombstone passed while probing, or else the empty slot that
+ * ended the probe.
+ */
+HashEntry *findSlot(HashTable *table, Value *key, unsigned int hash){
+    int mask = table->capacity - 1;
+    int index = hash & mask;
+    HashEntry *tombstone = NULL;
+    while (true) {
+        HashEntry *slot = &table->entries[index];
+        if (slot->key == NULL) {
+            return tombstone != NULL ? tombstone : slot;
+        }
+        if (slot->removed) {
+            if (tombstone == NULL) {
+                tombstone = slot;
+            }
+        } else if (slot->hash == hash &&
+                   (table->eq ? isEq(slot->key, key) : isEqual(slot->key, key))) {
+            return slot;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+/*
+ * Double the capacity of the table and reinsert every live binding,
+ * dropping tombstones along the way.
+ */
+void growTable(HashTable *table){
+    HashEntry *old = table->entries;
+    int oldCapacity = table->capacity;
+    // Only grow if live bindings fill the table; otherwise just clean it
+    if (table->count * 2 >= oldCapacity) {
+        table->capacity *= 2;
+    }
+    table->entries = talloc(sizeof(HashEntry) * table->capacity);
+    memset(table->entries, 0, sizeof(HashEntry) * table->capacity);
+    table->count = 0;
+    table->used = 0;
+    int mask = table->capacity - 1;
+    for (int i = 0; i < oldCapacity; i++) {
+        if (old[i].key != NULL && !old[i].removed) {
+            int index = old[i].hash & mask;
+            while (table->entries[index].key != NULL) {
+                index = (index + 1) & mask;
+            }
+            table->entries[index] = old[i];
+            table->count++;
+            table->used++;
+        }
+    }
+}
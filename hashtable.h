@@ -0,0 +1,47 @@
+#include <stdbool.h>
+#include "value.h"
+
+#ifndef _HASHTABLE
+#define _HASHTABLE
+
+// One slot of a hash table. A slot with a NULL key is empty; a slot whose key
+// has been removed keeps its place as a tombstone so that probing still works.
+struct HashEntry {
+    Value *key;
+    Value *value;
+    unsigned int hash;
+    bool removed;
+};
+
+// A mutable hash table using open addressing with linear probing. Tables made
+// with eq set compare keys with isEq, otherwise they compare with isEqual.
+struct HashTable {
+    int capacity;
+    int count;
+    int used;
+    bool eq;
+    struct HashEntry *entries;
+};
+
+typedef struct HashEntry HashEntry;
+typedef struct HashTable HashTable;
+
+// Create a new, empty hash table.
+HashTable *newHashTable(bool eq);
+
+// Look up key in the table. Returns NULL if the key is not present.
+Value *hashGet(HashTable *table, Value *key);
+
+// Bind key to value in the table, replacing any old binding for the key.
+void hashPut(HashTable *table, Value *key, Value *value);
+
+// Remove the binding for key from the table. Returns whether there was one.
+bool hashRemove(HashTable *table, Value *key);
+
+// Hash a value so that values that are isEqual hash the same.
+unsigned int hashEqual(Value *value);
+
+// Hash a value so that values that are isEq hash the same.
+unsigned int hashEq(Value *value);
+
+#endif
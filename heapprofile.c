@@ -0,0 +1,299 @@
+// heapprofile.c
+// Recording what talloc allocates, by kind and by allocation site, and how
+// much of it is live.
+// part of the Racket Interpreter Project
+#define _GNU_SOURCE
+#include "heapprofile.h"
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+
+#define INITIAL_TABLE_SIZE 256
+// Bytes allocated between samples of the Racket stack
+#define HEAP_SAMPLE_BYTES 65536
+// How many allocation sites the report lists
+#define TOP_SITES 20
+
+// Allocations of one kind from one site on one thread
+struct Site {
+    void *site;
+    void *caller;
+    allocKind kind;
+    long allocations;
+    long bytes;
+};
+typedef struct Site Site;
+
+// A site as reported: its name, and the allocations of every thread there
+struct Line {
+    char *name;
+    allocKind kind;
+    long allocations;
+    long bytes;
+};
+typedef struct Line Line;
+
+// What one thread has allocated: a hash table of its sites
+struct Sites {
+    Site *table;
+    int size;
+    int count;
+    struct Sites *next;
+};
+typedef struct Sites Sites;
+
+bool heapProfiling = false;
+
+// Whether to sample the Racket stack as well
+static bool sampleStacks = false;
+
+static __thread Sites *localSites = NULL;
+
+// Bytes this thread has allocated since it last sampled the Racket stack
+static __thread long sinceSample = 0;
+
+// Bytes allocated from arenas that haven't been freed, over all threads, and
+// the most there have been
+long liveBytes = 0;
+long peakLiveBytes = 0;
+
+// Every thread's sites, guarded by sitesLock
+Sites *allSites = NULL;
+pthread_mutex_t sitesLock = PTHREAD_MUTEX_INITIALIZER;
+
+Sites *newSites();
+Site *findSite(Sites *, void *, void *, allocKind);
+char *siteName(Site *);
+char *functionName(void *);
+int compareLines(const void *, const void *);
+int compareBytes(const void *, const void *);
+
+/*
+ * Turn the heap profiler on, from now on.
+ */
+void startHeapProfiling(bool stacks) {
+    heapProfiling = true;
+    if (stacks) {
+        // The shadow stack is only kept while a profiler is on
+        sampleStacks = true;
+        profiling = true;
+    }
+}
+
+/*
+ * Record an allocation of size bytes of a kind, made by site for caller.
+ */
+void recordAllocation(size_t size, allocKind kind, void *site, void *caller) {
+    Sites *sites = localSites;
+    if (sites == NULL) {
+        sites = newSites();
+    }
+    Site *entry = findSite(sites, site, caller, kind);
+    entry->allocations++;
+    entry->bytes += size;
+
+    long live = __atomic_add_fetch(&liveBytes, size, __ATOMIC_RELAXED);
+    long peak = __atomic_load_n(&peakLiveBytes, __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&peakLiveBytes, &peak, live, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+
+    if (sampleStacks) {
+        sinceSample += size;
+        if (sinceSample >= HEAP_SAMPLE_BYTES) {
+            sampleAllocation(sinceSample);
+            sinceSample = 0;
+        }
+    }
+}
+
+/*
+ * Note that an arena holding bytes has been freed.
+ */
+void releaseAllocations(long bytes) {
+    __atomic_sub_fetch(&liveBytes, bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * Make and register the current thread's table of sites.
+ */
+Sites *newSites() {
+    Sites *sites = malloc(sizeof(Sites));
+    sites->size = INITIAL_TABLE_SIZE;
+    sites->count = 0;
+    sites->table = calloc(sites->size, sizeof(Site));
+    pthread_mutex_lock(&sitesLock);
+    sites->next = allSites;
+    allSites = sites;
+    pthread_mutex_unlock(&sitesLock);
+    localSites = sites;
+    return sites;
+}
+
+/*
+ * The entry for allocations of a kind from a site, made if it is new.
+ */
+Site *findSite(Sites *sites, void *site, void *caller, allocKind kind) {
+    unsigned long hash = ((unsigned long)site * 31 + (unsigned long)caller) * 7 + kind;
+    int i = (hash >> 4) & (sites->size - 1);
+    while (sites->table[i].site != NULL) {
+        Site *entry = &sites->table[i];
+        if (entry->site == site && entry->caller == caller && entry->kind == kind) {
+            return entry;
+        }
+        i = (i + 1) & (sites->size - 1);
+    }
+
+    // Keep the table at most half full, so the search above stays short
+    if (sites->count * 2 >= sites->size) {
+        Site *old = sites->table;
+        int oldSize = sites->size;
+        sites->size *= 2;
+        sites->count = 0;
+        sites->table = calloc(sites->size, sizeof(Site));
+        for (int j = 0; j < oldSize; j++) {
+            if (old[j].site != NULL) {
+                Site *moved = findSite(sites, old[j].site, old[j].caller, old[j].kind);
+                moved->allocations = old[j].allocations;
+                moved->bytes = old[j].bytes;
+            }
+        }
+        free(old);
+        return findSite(sites, site, caller, kind);
+    }
+    Site *entry = &sites->table[i];
+    entry->site = site;
+    entry->caller = caller;
+    entry->kind = kind;
+    sites->count++;
+    return entry;
+}
+
+/*
+ * Print the heap profile of every thread.
+ */
+void printHeapProfile(FILE *out) {
+    long allocations, bytes;
+    tallocStats(&allocations, &bytes);
+    fprintf(out, "Heap profile: %ld allocations, %ld bytes, peak live %ld bytes\n",
+            allocations, bytes, __atomic_load_n(&peakLiveBytes, __ATOMIC_RELAXED));
+    fprintf(out, " allocations          bytes       %%  kind\n");
+    double total = bytes > 0 ? bytes : 1;
+    for (int i = 0; i < ALLOC_KINDS; i++) {
+        long kindAllocations, kindBytes;
+        tallocKindStats(i, &kindAllocations, &kindBytes);
+        if (kindAllocations > 0) {
+            fprintf(out, "%12ld %14ld %6.1f%%  %s\n", kindAllocations, kindBytes,
+                    100 * kindBytes / total, allocKindName(i));
+        }
+    }
+
+    // Threads have tables of their own, and a function can allocate from
+    // more than one place, so sort the sites by name to add those up
+    int count = 0;
+    int size = 64;
+    Line *lines = malloc(sizeof(Line) * size);
+    pthread_mutex_lock(&sitesLock);
+    for (Sites *sites = allSites; sites != NULL; sites = sites->next) {
+        for (int i = 0; i < sites->size; i++) {
+            Site *site = &sites->table[i];
+            if (site->site == NULL) {
+                continue;
+            }
+            if (count == size) {
+                size *= 2;
+                lines = realloc(lines, sizeof(Line) * size);
+            }
+            lines[count].name = siteName(site);
+            lines[count].kind = site->kind;
+            lines[count].allocations = site->allocations;
+            lines[count].bytes = site->bytes;
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&sitesLock);
+    qsort(lines, count, sizeof(Line), compareLines);
+    int merged = 0;
+    for (int i = 0; i < count; i++) {
+        if (merged > 0 && lines[merged - 1].kind == lines[i].kind &&
+            !strcmp(lines[merged - 1].name, lines[i].name)) {
+            lines[merged - 1].allocations += lines[i].allocations;
+            lines[merged - 1].bytes += lines[i].bytes;
+            free(lines[i].name);
+        } else {
+            lines[merged++] = lines[i];
+        }
+    }
+    qsort(lines, merged, sizeof(Line), compareBytes);
+
+    fprintf(out, "\n allocations          bytes       %%  kind     site <- caller\n");
+    for (int i = 0; i < merged; i++) {
+        if (i < TOP_SITES) {
+            fprintf(out, "%12ld %14ld %6.1f%%  %-7s  %s\n", lines[i].allocations,
+                    lines[i].bytes, 100 * lines[i].bytes / total,
+                    allocKindName(lines[i].kind), lines[i].name);
+        }
+        free(lines[i].name);
+    }
+    if (merged > TOP_SITES) {
+        fprintf(out, "(%d smaller sites not shown)\n", merged - TOP_SITES);
+    }
+    free(lines);
+}
+
+/*
+ * The name of a site, as "function <- caller".
+ */
+char *siteName(Site *site) {
+    char *function = functionName(site->site);
+    char *caller = functionName(site->caller);
+    char *name = malloc(strlen(function) + strlen(caller) + 5);
+    sprintf(name, "%s <- %s", function, caller);
+    free(function);
+    free(caller);
+    return name;
+}
+
+/*
+ * The name of the function holding a code address. Functions that aren't
+ * exported (static ones, or all of them without -rdynamic) are named by
+ * their offset into the file that holds them.
+ */
+char *functionName(void *address) {
+    char name[256];
+    Dl_info info;
+    if (address == NULL) {
+        strcpy(name, "?");
+    } else if (!dladdr(address, &info)) {
+        snprintf(name, sizeof(name), "%p", address);
+    } else if (info.dli_sname != NULL) {
+        snprintf(name, sizeof(name), "%s", info.dli_sname);
+    } else {
+        char *file = info.dli_fname != NULL ? strrchr(info.dli_fname, '/') : NULL;
+        snprintf(name, sizeof(name), "%s+%#lx", file != NULL ? file + 1 : "?",
+                 (unsigned long)((char *)address - (char *)info.dli_fbase));
+    }
+    return strdup(name);
+}
+
+/*
+ * Order lines by name and kind, for qsort.
+ */
+int compareLines(const void *a, const void *b) {
+    const Line *x = a;
+    const Line *y = b;
+    int order = strcmp(x->name, y->name);
+    return order != 0 ? order : (int)x->kind - (int)y->kind;
+}
+
+/*
+ * Order lines by bytes, most first, for qsort.
+ */
+int compareBytes(const void *a, const void *b) {
+    long x = ((const Line *)a)->bytes;
+    long y = ((const Line *)b)->bytes;
+    return (x < y) - (x > y);
+}
@@ -0,0 +1,42 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include "talloc.h"
+#include "interpreter.h"
+
+#ifndef _HEAPPROFILE
+#define _HEAPPROFILE
+
+// The heap profiler. While it is on, talloc records each allocation under its
+// kind and under its allocation site: the C function that called talloc and
+// the function that called that one (so that an allocation in cons made by
+// reverse called from evalEach is told apart from one made by apply). It also
+// keeps track of live bytes, those allocated from arenas that haven't been
+// freed yet, and the most that were ever live at once. Finding the sites
+// takes a backtrace per allocation, so programs run several times slower.
+//
+// It can also sample the Racket procedures running as memory is allocated:
+// about every HEAP_SAMPLE_BYTES bytes, the thread's shadow stack (see
+// profile.h) is recorded as having allocated the bytes since its last sample.
+// Large allocation sites are sampled often and small ones seldom, for little
+// cost.
+
+// Whether the heap profiler is on
+extern bool heapProfiling;
+
+// Turn the heap profiler on, from now on. If stacks is true, also sample the
+// Racket procedures that allocate.
+void startHeapProfiling(bool stacks);
+
+// Record an allocation of size bytes of a kind, made by site (the return
+// address into talloc's caller) for caller (the return address into its
+// caller).
+void recordAllocation(size_t size, allocKind kind, void *site, void *caller);
+
+// Note that an arena holding bytes has been freed.
+void releaseAllocations(long bytes);
+
+// Print the heap profile: totals by kind, the largest allocation sites, and
+// the peak live bytes.
+void printHeapProfile(FILE *out);
+
+#endif
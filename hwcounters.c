@@ -0,0 +1,260 @@
+// hwcounters.c
+// Reading hardware performance counters around each top-level form.
+// part of the Racket Interpreter Project
+#define _GNU_SOURCE
+#include "hwcounters.h"
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "error.h"
+
+#define COUNTERS 5
+// How much of a form is shown in the report
+#define LABEL_LENGTH 40
+
+enum {CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, L1D_MISSES};
+
+static char *counterNames[COUNTERS] = {"cycles", "instructions", "cache-misses",
+    "branch-misses", "L1d-misses"};
+
+// What one top-level form used
+struct Count {
+    char *label;
+    long values[COUNTERS];
+    struct Count *next;
+};
+typedef struct Count Count;
+
+// One read of the group: how long it has been enabled and how long it has
+// actually been counting, in nanoseconds, and the raw counts
+struct Reading {
+    long enabled;
+    long running;
+    long values[COUNTERS];
+};
+typedef struct Reading Reading;
+
+bool hwCounting = false;
+
+// The counters are opened as one group, so they are all running at the same
+// times. slots holds where each is in a read of the group, or -1 if it
+// couldn't be opened.
+static int leader = -1;
+static int slots[COUNTERS];
+static int opened = 0;
+
+// The read when the current form started
+static Reading before;
+
+// The forms counted so far, in order
+static Count *counts = NULL;
+static Count *lastCount = NULL;
+
+int openCounter(int, int);
+void readCounters(Reading *);
+char *formLabel(Value *);
+void printCount(FILE *, char *, long *);
+
+/*
+ * Open the counters, or say why they can't be.
+ */
+bool startHwCounters() {
+    int errors[COUNTERS];
+    for (int i = 0; i < COUNTERS; i++) {
+        int fd = openCounter(i, leader);
+        errors[i] = errno;
+        if (fd < 0) {
+            slots[i] = -1;
+            continue;
+        }
+        if (leader < 0) {
+            leader = fd;
+        }
+        slots[i] = opened++;
+    }
+    if (leader < 0) {
+        // Usually a container or virtual machine without perf events
+        fprintf(stderr, "Hardware counters unavailable: %s%s\n", strerror(errors[0]),
+                errors[0] == EACCES || errors[0] == EPERM ?
+                " (see /proc/sys/kernel/perf_event_paranoid)" : "");
+        return false;
+    }
+    // Some machines lack some of them; count the rest
+    for (int i = 0; i < COUNTERS; i++) {
+        if (slots[i] < 0) {
+            fprintf(stderr, "Hardware counter %s unavailable: %s\n", counterNames[i],
+                    strerror(errors[i]));
+        }
+    }
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    hwCounting = true;
+    return true;
+}
+
+/*
+ * Open one counter for the current thread, in user mode, in the group led by
+ * group (or leading a new group if it is -1). Returns -1 if it can't be.
+ */
+int openCounter(int counter, int group) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    switch (counter) {
+        case CYCLES:
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case INSTRUCTIONS:
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case CACHE_MISSES:
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        case BRANCH_MISSES:
+            attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        default:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+        PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.disabled = group < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+/*
+ * Start counting a top-level form.
+ */
+void beginHwCount() {
+    readCounters(&before);
+}
+
+/*
+ * Stop counting form, and record what it used. If the kernel had to share the
+ * hardware with other events while the form ran, its counts are scaled up to
+ * the whole time the form ran, by how much of that time they were counting.
+ * The scale is worked out from the form's own times, as the share can change
+ * from one form to the next.
+ */
+void endHwCount(Value *form) {
+    Reading after;
+    readCounters(&after);
+    long enabled = after.enabled - before.enabled;
+    long running = after.running - before.running;
+    double scale = running > 0 ? (double)enabled / running : 1;
+    Count *count = malloc(sizeof(Count));
+    count->label = formLabel(form);
+    for (int i = 0; i < COUNTERS; i++) {
+        count->values[i] = (long)((after.values[i] - before.values[i]) * scale);
+    }
+    count->next = NULL;
+    if (lastCount == NULL) {
+        counts = count;
+    } else {
+        lastCount->next = count;
+    }
+    lastCount = count;
+}
+
+/*
+ * Read the counters so far, unscaled, with the times they have been enabled
+ * and running.
+ */
+void readCounters(Reading *reading) {
+    // The number of counters, the times enabled and running, then the counts
+    long buffer[3 + COUNTERS];
+    memset(buffer, 0, sizeof(buffer));
+    if (read(leader, buffer, sizeof(buffer)) < 0) {
+        memset(buffer, 0, sizeof(buffer));
+    }
+    reading->enabled = buffer[1];
+    reading->running = buffer[2];
+    for (int i = 0; i < COUNTERS; i++) {
+        reading->values[i] = slots[i] >= 0 ? buffer[3 + slots[i]] : 0;
+    }
+}
+
+/*
+ * How a form is shown in the report: as display would print it, on one line
+ * and cut short if it is long.
+ */
+char *formLabel(Value *form) {
+    char *text = valueToString(form);
+    // display quotes lists, but the form was code
+    if (text[0] == '\'') {
+        text++;
+    }
+    char *label = malloc(LABEL_LENGTH + 1);
+    size_t length = strlen(text);
+    if (length > LABEL_LENGTH) {
+        memcpy(label, text, LABEL_LENGTH - 3);
+        strcpy(label + LABEL_LENGTH - 3, "...");
+    } else {
+        strcpy(label, text);
+    }
+    for (char *c = label; *c != '\0'; c++) {
+        if (*c == '\n' || *c == '\t') {
+            *c = ' ';
+        }
+    }
+    return label;
+}
+
+/*
+ * Print what each top-level form used, and the totals.
+ */
+void printHwCounters(FILE *out) {
+    if (!hwCounting) {
+        return;
+    }
+    fprintf(out, "Hardware counters, user mode (misses per thousand instructions):\n");
+    fprintf(out, "%-*s %14s %14s %5s %8s %8s %8s\n", LABEL_LENGTH, "form", "cycles",
+            "instructions", "IPC", "cache", "branch", "L1d");
+    long total[COUNTERS] = {0};
+    for (Count *count = counts; count != NULL; count = count->next) {
+        printCount(out, count->label, count->values);
+        for (int i = 0; i < COUNTERS; i++) {
+            total[i] += count->values[i];
+        }
+    }
+    printCount(out, "total", total);
+    fprintf(out, "%ld cache misses, %ld branch misses, %ld L1d misses\n",
+            total[CACHE_MISSES], total[BRANCH_MISSES], total[L1D_MISSES]);
+}
+
+/*
+ * Print one line of the report. Counters that couldn't be opened show as -.
+ */
+void printCount(FILE *out, char *label, long *values) {
+    char columns[COUNTERS + 1][32];
+    double instructions = values[INSTRUCTIONS] > 0 ? values[INSTRUCTIONS] : 1;
+    for (int i = 0; i < COUNTERS; i++) {
+        if (slots[i] < 0) {
+            strcpy(columns[i], "-");
+        } else if (i == CYCLES || i == INSTRUCTIONS) {
+            snprintf(columns[i], sizeof(columns[i]), "%ld", values[i]);
+        } else {
+            snprintf(columns[i], sizeof(columns[i]), "%.2f",
+                     values[i] * 1000 / instructions);
+        }
+    }
+    // Instructions per cycle goes in the last column
+    if (slots[CYCLES] < 0 || slots[INSTRUCTIONS] < 0 || values[CYCLES] == 0) {
+        strcpy(columns[COUNTERS], "-");
+    } else {
+        snprintf(columns[COUNTERS], sizeof(columns[COUNTERS]), "%.2f",
+                 (double)values[INSTRUCTIONS] / values[CYCLES]);
+    }
+    fprintf(out, "%-*s %14s %14s %5s %8s %8s %8s\n", LABEL_LENGTH, label,
+            columns[CYCLES], columns[INSTRUCTIONS], columns[COUNTERS],
+            columns[CACHE_MISSES], columns[BRANCH_MISSES], columns[L1D_MISSES]);
+}
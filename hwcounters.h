@@ -0,0 +1,34 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include "value.h"
+
+#ifndef _HWCOUNTERS
+#define _HWCOUNTERS
+
+// Hardware performance counters, read through perf_event_open around each
+// top-level form. Cycles, instructions, cache misses, branch misses and L1
+// data cache read misses are counted in user mode on the thread that runs
+// the top level, so work done by futures on other threads isn't included.
+//
+// If the kernel or the container doesn't allow perf events, or the machine
+// lacks some of them, the report says which couldn't be counted and the
+// program runs as it would without counters.
+
+// Whether counters are being read
+extern bool hwCounting;
+
+// Open the counters. Returns false, after saying why on stderr, if none of
+// them can be.
+bool startHwCounters();
+
+// Start counting a top-level form.
+void beginHwCount();
+
+// Stop counting form, and record what it used.
+void endHwCount(Value *form);
+
+// Print what each top-level form used, with its instructions per cycle and
+// misses per thousand instructions, and the totals.
+void printHwCounters(FILE *out);
+
+#endif
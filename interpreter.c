@@ -3,24 +3,36 @@
 // starter code provided by Dave Musicant
 // part of the Racket Interpreter Project
 // for CS 251: Programming Language Design and Implementation
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "interpreter.h"
 #include "linkedlist.h"
 #include "talloc.h"
 #include "tokenizer.h"
 #include "parser.h"
-
-Frame *newFrame(Frame *);
+#include "hashtable.h"
+#include "hamt.h"
+#include "future.h"
+#include "place.h"
+#include "error.h"
+#include "sandbox.h"
+#include "profile.h"
+#include "stats.h"
+#include "hwcounters.h"
+#include "output.h"
 
 /*** Main Functions ***/
 Value *evalEach(Value*, Frame*);
+Value *evalExpression(Value*, Frame*);
 //eval and interpret included in header file
 
 /*** Primitives ***/
 void bindPrimitives(Frame *);
-void bind(char *name, Value *(*function)(struct Value *), Frame *);
+void bindPrimitive(char *name, Value *(*function)(struct Value *), Frame *);
 Value *primitiveAdd(Value *);
 Value *primitiveSub(Value *);
 Value *primitiveMult(Value *);
@@ -34,6 +46,112 @@ Value *nullHelper(Value *);
 Value *primitiveCar(Value *);
 Value *primitiveCdr(Value *);
 Value *primitiveCons(Value *); 
+Value *primitiveMakeVector(Value *);
+Value *primitiveVector(Value *);
+Value *primitiveVectorRef(Value *);
+Value *primitiveVectorSet(Value *);
+Value *primitiveVectorLength(Value *);
+Value *primitiveVectorToList(Value *);
+Value *primitiveListToVector(Value *);
+Value *primitiveMakeFlVector(Value *);
+Value *primitiveFlVector(Value *);
+Value *primitiveFlVectorRef(Value *);
+Value *primitiveFlVectorSet(Value *);
+Value *primitiveFlVectorLength(Value *);
+Value *primitiveMakeHash(Value *);
+Value *primitiveMakeHashEq(Value *);
+Value *primitiveHashRef(Value *);
+Value *primitiveHashSet(Value *);
+Value *primitiveHashRemove(Value *);
+Value *primitiveHashCount(Value *);
+Value *primitiveHashHasKey(Value *);
+Value *primitiveHashKeys(Value *);
+Value *primitiveHashValues(Value *);
+Value *primitiveHashToList(Value *);
+Value *primitiveHash(Value *);
+Value *primitiveHashFunctionalSet(Value *);
+Value *primitiveHashFunctionalRemove(Value *);
+Value *primitiveLength(Value *);
+Value *primitiveAppend(Value *);
+Value *primitiveReverse(Value *);
+Value *primitiveList(Value *);
+Value *primitiveListRef(Value *);
+Value *primitiveListTail(Value *);
+Value *primitiveMember(Value *);
+Value *primitiveAssoc(Value *);
+Value *primitiveLastPair(Value *);
+Value *primitiveEqual(Value *);
+Value *primitiveEqv(Value *);
+Value *primitiveMap(Value *);
+Value *primitiveForEach(Value *);
+Value *primitiveFilter(Value *);
+Value *primitiveFoldl(Value *);
+Value *primitiveFoldr(Value *);
+Value *primitiveAndmap(Value *);
+Value *primitiveOrmap(Value *);
+Value *primitiveApply(Value *);
+Value *primitiveFuture(Value *);
+Value *primitiveTouch(Value *);
+Value *primitiveProcessorCount(Value *);
+Value *primitivePmap(Value *);
+Value *primitivePforEach(Value *);
+Value *primitivePreduce(Value *);
+Value *primitivePlaceWait(Value *);
+Value *primitivePlaceChannelPut(Value *);
+Value *primitivePlaceChannelGet(Value *);
+Value *primitiveRaise(Value *);
+Value *primitiveError(Value *);
+Value *primitiveIsExn(Value *);
+Value *primitiveExnMessage(Value *);
+
+/*** Primitive Helpers ***/
+// Progress through a list being filled in with the bindings of a hash
+typedef struct {
+    int part;
+    Value *cell;
+} Collector;
+
+// One piece of the work of pmap, pfor-each or preduce: the items from
+// start up to end, and where their results go
+typedef struct {
+    Value *function;
+    Value **items;
+    Value **results;
+    Value *reduced;
+    int start;
+    int end;
+} Chunk;
+
+// Below this many items, parallel primitives just run sequentially
+#define PARALLEL_THRESHOLD 64
+// Aim for this many chunks per worker, so that stealing can even out the load
+#define CHUNKS_PER_WORKER 4
+#define MIN_CHUNK_SIZE 16
+
+void checkArgs(Value *, int, char *);
+int indexArg(Value *, int, char *);
+double numberArg(Value *, char *);
+Value *makeVector(int);
+Value *makeFlVector(int);
+Value *makeVoid();
+Value *makeBool(bool);
+Value *makeHash(Value *, bool, char *);
+HashTable *hashArg(Value *, char *);
+Value *hamtArg(Value *, char *);
+Value *hashLookup(Value *, Value *, char *);
+Value *hashContents(Value *, int, char *);
+void collectBinding(Value *, Value *, void *);
+Value *listArg(Value *, char *);
+Value *dropItems(Value *, int, char *);
+Value *procedureArg(Value *, char *);
+int listsLength(Value *, char *);
+Value *nextArgs(Value **, int, Value *);
+bool isFalse(Value *);
+Value **sequenceItems(Value *, int *, char *);
+Chunk *splitChunks(Value *, Value **, int, Value *, int *);
+void runChunks(Chunk *, int, void (*)(void *));
+void mapChunk(void *);
+void reduceChunk(void *);
 
 /*** Special Forms ***/
 Value *evalLet(Value*, Frame*);
@@ -48,14 +166,18 @@ Value *evalSet(Value*, Frame*);
 Value *evalAnd(Value*, Frame*);
 Value *evalOr(Value*, Frame*);
 Value *evalCond(Value*, Frame*);
+Value *evalPlace(Value*, Frame*);
+Value *evalWithHandlers(Value*, Frame*);
+Value *evalTime(Value*, Frame*);
 
 /*** Functions and Symbols ***/
 Value *apply(Value*, Value*);
 Value *lookUpSymbol(Value*, Frame*);
+void nameClosure(Value*, char*);
 
 
 Frame *newFrame(Frame* parent) {
-    Frame *f = talloc(sizeof(Frame));
+    Frame *f = tallocKind(sizeof(Frame), ALLOC_FRAME);
     f->parent = parent;
     f->bindings = makeNull();
     
@@ -69,31 +191,97 @@ Frame *newFrame(Frame* parent) {
 
 
 /*
- * Creates top level frame, evaluates each expression of 
- * the input, and prints the result
+ * Creates an interpreter instance with its own top level frame,
+ * allocating from the current thread's arena.
  */
-void interpret(Value *list) {
+Interp *newInterp() {
+    Interp *interp = talloc(sizeof(Interp));
+    interp->heap = currentArena();
+    interp->error = NULL;
+    interp->limits.fuel = 0;
+    interp->limits.memory = 0;
+    interp->limits.depth = 0;
     // Create global/top level frame
-    Frame *topFrame = newFrame(NULL);
-    
-    bindPrimitives(topFrame);
+    interp->topFrame = newFrame(NULL);
+    bindPrimitives(interp->topFrame);
+    return interp;
+}
+
+/*
+ * Creates a new interpreter instance and interprets the input with it.
+ * Returns the number of expressions that raised errors.
+ */
+int interpret(Value *list) {
+    return interpretIn(newInterp(), list);
+}
+
+/*
+ * Evaluates each expression of the input in the top level frame
+ * of interp, and prints the result. An error in one expression is
+ * printed, and the rest of the expressions still run, unless it was
+ * for going over one of interp's limits.
+ * Returns the number of expressions that raised errors.
+ */
+int interpretIn(Interp *interp, Value *list) {
     // Iterate through each expression in program and
     // display result of that evaluation.
-    Value *cur = list;
+    // (volatile, since they are read again after an error)
+    Value * volatile cur = list;
+    volatile int errors = 0;
+    startRun(&interp->limits);
     while(cur->type != NULL_TYPE){
-        Value *result = eval(car(cur), topFrame);
-        if (result->type != VOID_TYPE) {
-            display(result);
-            printf("\n");
+        ErrorTrap trap;
+        pushErrorTrap(&trap);
+        if (hwCounting) {
+            beginHwCount();
+        }
+        if (setjmp(trap.jump) == 0) {
+            Value *result = eval(car(cur), interp->topFrame);
+            popErrorTrap(&trap);
+            if (hwCounting) {
+                endHwCount(car(cur));
+            }
+            if (result->type != VOID_TYPE) {
+                display(result);
+                writeChar(standardOutput(), '\n');
+                flushOutput(standardOutput());
+            }
+        } else {
+            if (hwCounting) {
+                endHwCount(car(cur));
+            }
+            printf("%s\n", errorMessage(trap.raised));
+            errors++;
+            // The run is out of fuel, memory or depth; stop here
+            if (isLimitError(trap.raised)) {
+                break;
+            }
         }
         cur = cdr(cur);
     }
+    return errors;
 }
 
 /*
- * Evaluates current tree with frame as environment.
+ * Evaluates current tree with frame as environment, using up fuel and
+ * checking the recursion depth (see sandbox.h).
  */
 Value *eval(Value *tree, Frame *frame) {
+    useFuel();
+    enterEval();
+    COUNT(evals[tree->type]);
+    if (evalDepth > stats.maxDepth) {
+        __atomic_store_n(&stats.maxDepth, evalDepth, __ATOMIC_RELAXED);
+    }
+    Value *result = evalExpression(tree, frame);
+    evalDepth--;
+    return result;
+}
+
+/*
+ * Evaluates current tree with frame as environment, without checking limits.
+ */
+Value *evalExpression(Value *tree, Frame *frame) {
     switch (tree->type)  {
         // Integer, boolean, string, and double all evaluate to themselves
         case INT_TYPE:
@@ -112,6 +300,7 @@ Value *eval(Value *tree, Frame *frame) {
         // and return the value associated with it
         case SYMBOL_TYPE: {
             Value *toReturn = talloc(sizeof(Value));
+            COUNT(lookups);
             toReturn = lookUpSymbol(tree, frame);
             return toReturn;
             break;
@@ -141,61 +330,80 @@ Value *eval(Value *tree, Frame *frame) {
             // If first thing in cons is a symbol or cons type, continue
             if (first->type == SYMBOL_TYPE || first->type == CONS_TYPE) {
                 if (!strcmp(first->s,"if")) {
+                    COUNT(forms[FORM_IF]);
                     result = evalIf(args, frame);
                 }
                 else if(!strcmp(first->s,"let")){
+                    COUNT(forms[FORM_LET]);
                     result = evalLet(args, frame);
                 }
                 else if(!strcmp(first->s, "let*")){
+                    COUNT(forms[FORM_LET_STAR]);
                     result = evalLetStar(args, frame);
                 }
                 else if(!strcmp(first->s, "letrec")){
+                    COUNT(forms[FORM_LETREC]);
                     result = evalLetRec(args, frame);
                 }
                 else if (!strcmp(first->s, "quote")) {
+                    COUNT(forms[FORM_QUOTE]);
                     result = evalQuote(tree);
                 }
                 else if (!strcmp(first->s, "define")) {
+                    COUNT(forms[FORM_DEFINE]);
                     result = evalDefine(args, frame);
                 }
                 else if (!strcmp(first->s, "lambda")) {
+                    COUNT(forms[FORM_LAMBDA]);
                     result = evalLambda(args, frame);
                 }
                 else if(!strcmp(first->s, "begin")){
+                    COUNT(forms[FORM_BEGIN]);
                     result = evalBegin(args, frame);
                 }
                 else if(!strcmp(first->s, "set!")){
+                    COUNT(forms[FORM_SET]);
                     result = evalSet(args, frame);
                 }
                 else if (!strcmp(first->s, "and")) {
+                    COUNT(forms[FORM_AND]);
                     result = evalAnd(args, frame);
                 }
                 else if (!strcmp(first->s, "or")) {
+                    COUNT(forms[FORM_OR]);
                     result = evalOr(args, frame);
                 }
                 else if (!strcmp(first->s, "cond")) {
+                    COUNT(forms[FORM_COND]);
                     result = evalCond(args, frame);
                 }
+                else if (!strcmp(first->s, "place")) {
+                    COUNT(forms[FORM_PLACE]);
+                    result = evalPlace(args, frame);
+                }
+                else if (!strcmp(first->s, "with-handlers")) {
+                    COUNT(forms[FORM_WITH_HANDLERS]);
+                    result = evalWithHandlers(args, frame);
+                }
+                else if (!strcmp(first->s, "time")) {
+                    COUNT(forms[FORM_TIME]);
+                    result = evalTime(args, frame);
+                }
                 // Anything else
                 else {
 
                     Value *evaledOperator = eval(first, frame);
 
-                    // If first is a Racket function
-                    if (evaledOperator->type == CLOSURE_TYPE) {
+                    // If first is a Racket function or a primitive function,
+                    // apply it to the evaled args
+                    if (evaledOperator->type == CLOSURE_TYPE ||
+                        evaledOperator->type == PRIMITIVE_TYPE) {
                         Value *evaledArgs = evalEach(args, frame);
-                        result = apply(evaledOperator, evaledArgs);
-                    } 
-                    // If first is a primitive function
-                    else if (evaledOperator->type == PRIMITIVE_TYPE) {
-                        Value *evaledArgs = evalEach(args, frame);
-                        // apply primitive function to previously evaled args
-                        result = evaledOperator->pf(evaledArgs);
+                        result = applyProcedure(evaledOperator, evaledArgs);
                     }
                     // If first is not recognized, and is a symbol type
                     else if (evaledOperator->type == SYMBOL_TYPE){
-                        printf("Evaluation error: This is not a recognized procedure.\n");
-                        texit(EXIT_FAILURE);
+                        raiseError("Evaluation error: This is not a recognized procedure.");
                     }
                     //The case where first contained a cons type that does not evaluate to a symbol, closure, or primitive type.
                     else{
@@ -245,33 +453,108 @@ Value *evalEach(Value *args, Frame *frame) {
  * function names to their functions.
  */
 void bindPrimitives(Frame *frame){
-    bind("+", primitiveAdd, frame);
-    bind("-", primitiveSub, frame);
-    bind("*", primitiveMult, frame);
-    bind("/", primitiveDiv, frame);
-    bind(">", primitiveGre, frame);
-    bind("<", primitiveLess, frame);
-    bind("=", primitiveEq, frame);
-    bind("modulo", primitiveMod, frame);
-    bind("null?", primitiveNull, frame);
-    bind("car", primitiveCar, frame);
-    bind("cdr", primitiveCdr, frame);
-    bind("cons", primitiveCons, frame);
+    bindPrimitive("+", primitiveAdd, frame);
+    bindPrimitive("-", primitiveSub, frame);
+    bindPrimitive("*", primitiveMult, frame);
+    bindPrimitive("/", primitiveDiv, frame);
+    bindPrimitive(">", primitiveGre, frame);
+    bindPrimitive("<", primitiveLess, frame);
+    bindPrimitive("=", primitiveEq, frame);
+    bindPrimitive("modulo", primitiveMod, frame);
+    bindPrimitive("null?", primitiveNull, frame);
+    bindPrimitive("car", primitiveCar, frame);
+    bindPrimitive("cdr", primitiveCdr, frame);
+    bindPrimitive("cons", primitiveCons, frame);
+    bindPrimitive("make-vector", primitiveMakeVector, frame);
+    bindPrimitive("vector", primitiveVector, frame);
+    bindPrimitive("vector-ref", primitiveVectorRef, frame);
+    bindPrimitive("vector-set!", primitiveVectorSet, frame);
+    bindPrimitive("vector-length", primitiveVectorLength, frame);
+    bindPrimitive("vector->list", primitiveVectorToList, frame);
+    bindPrimitive("list->vector", primitiveListToVector, frame);
+    bindPrimitive("make-flvector", primitiveMakeFlVector, frame);
+    bindPrimitive("flvector", primitiveFlVector, frame);
+    bindPrimitive("flvector-ref", primitiveFlVectorRef, frame);
+    bindPrimitive("flvector-set!", primitiveFlVectorSet, frame);
+    bindPrimitive("flvector-length", primitiveFlVectorLength, frame);
+    bindPrimitive("make-hash", primitiveMakeHash, frame);
+    bindPrimitive("make-hasheq", primitiveMakeHashEq, frame);
+    bindPrimitive("hash-ref", primitiveHashRef, frame);
+    bindPrimitive("hash-set!", primitiveHashSet, frame);
+    bindPrimitive("hash-remove!", primitiveHashRemove, frame);
+    bindPrimitive("hash-count", primitiveHashCount, frame);
+    bindPrimitive("hash-has-key?", primitiveHashHasKey, frame);
+    bindPrimitive("hash-keys", primitiveHashKeys, frame);
+    bindPrimitive("hash-values", primitiveHashValues, frame);
+    bindPrimitive("hash->list", primitiveHashToList, frame);
+    bindPrimitive("hash", primitiveHash, frame);
+    bindPrimitive("hash-set", primitiveHashFunctionalSet, frame);
+    bindPrimitive("hash-remove", primitiveHashFunctionalRemove, frame);
+    bindPrimitive("length", primitiveLength, frame);
+    bindPrimitive("append", primitiveAppend, frame);
+    bindPrimitive("reverse", primitiveReverse, frame);
+    bindPrimitive("list", primitiveList, frame);
+    bindPrimitive("list-ref", primitiveListRef, frame);
+    bindPrimitive("list-tail", primitiveListTail, frame);
+    bindPrimitive("member", primitiveMember, frame);
+    bindPrimitive("assoc", primitiveAssoc, frame);
+    bindPrimitive("last-pair", primitiveLastPair, frame);
+    bindPrimitive("equal?", primitiveEqual, frame);
+    bindPrimitive("eq?", primitiveEqv, frame);
+    bindPrimitive("map", primitiveMap, frame);
+    bindPrimitive("for-each", primitiveForEach, frame);
+    bindPrimitive("filter", primitiveFilter, frame);
+    bindPrimitive("foldl", primitiveFoldl, frame);
+    bindPrimitive("foldr", primitiveFoldr, frame);
+    bindPrimitive("andmap", primitiveAndmap, frame);
+    bindPrimitive("ormap", primitiveOrmap, frame);
+    bindPrimitive("apply", primitiveApply, frame);
+    bindPrimitive("future", primitiveFuture, frame);
+    bindPrimitive("touch", primitiveTouch, frame);
+    bindPrimitive("processor-count", primitiveProcessorCount, frame);
+    bindPrimitive("pmap", primitivePmap, frame);
+    bindPrimitive("pfor-each", primitivePforEach, frame);
+    bindPrimitive("preduce", primitivePreduce, frame);
+    bindPrimitive("place-wait", primitivePlaceWait, frame);
+    bindPrimitive("place-channel-put", primitivePlaceChannelPut, frame);
+    bindPrimitive("place-channel-get", primitivePlaceChannelGet, frame);
+    bindPrimitive("raise", primitiveRaise, frame);
+    bindPrimitive("error", primitiveError, frame);
+    bindPrimitive("exn?", primitiveIsExn, frame);
+    bindPrimitive("exn:fail?", primitiveIsExn, frame);
+    bindPrimitive("exn-message", primitiveExnMessage, frame);
 }
 
 /*
  * Binds a primitive function name to its function pointer.
  */
-void bind(char *name, Value *(*function)(struct Value *), Frame *frame) {
-    
-    Value *nameHolder = talloc(sizeof(Value));
-    nameHolder->type = SYMBOL_TYPE;
-    nameHolder->s = name;
-    
+void bindPrimitive(char *name, Value *(*function)(struct Value *), Frame *frame) {
     // Add primitive functions to top-level bindings list
     Value *value = talloc(sizeof(Value));
     value->type = PRIMITIVE_TYPE;
     value->pf = function;
+    bindValue(name, value, frame);
+}
+
+/*
+ * Give a closure being defined its name, for the profiler, unless it already
+ * has one from an earlier define.
+ */
+void nameClosure(Value *value, char *name) {
+    if (value->type == CLOSURE_TYPE && value->cl.name == NULL) {
+        value->cl.name = name;
+    }
+}
+
+/*
+ * Binds a name to a value in a frame.
+ */
+void bindValue(char *name, Value *value, Frame *frame) {
+    nameClosure(value, name);
+    Value *nameHolder = talloc(sizeof(Value));
+    nameHolder->type = SYMBOL_TYPE;
+    nameHolder->s = name;
+    
     Value *binding = makeNull();
     binding = cons(value, binding);
     binding = cons(nameHolder, binding);
@@ -291,8 +574,7 @@ Value *primitiveAdd(Value *addList){
         //check to make sure args are ints or doubles
         if (number->type != INT_TYPE &&
            number->type != DOUBLE_TYPE) {
-            printf("Error: I can't add this!\n");
-            texit(EXIT_FAILURE);
+            raiseError("Error: I can't add this!");
         }
         if(number->type == INT_TYPE){
             runningTotal += number->i;
@@ -302,7 +584,7 @@ Value *primitiveAdd(Value *addList){
         }
         addList = cdr(addList);
     }
-    Value *total = talloc(sizeof(Value));
+    Value *total = tallocKind(sizeof(Value), ALLOC_NUMBER);
     total->type = DOUBLE_TYPE;
     total->d = runningTotal;
     
@@ -317,15 +599,14 @@ Value *primitiveSub(Value *subList){
     if (subList->type != CONS_TYPE ||
         cdr(subList)->type != CONS_TYPE ||
         cdr(cdr(subList))->type != NULL_TYPE){
-            printf("Wrong number of arguments for subtract\n");         texit(EXIT_FAILURE);
+            raiseError("Wrong number of arguments for subtract");
     }
     double toReturn = 0.0;
     Value *firstNum = car(subList);
     Value *secondNum = car(cdr(subList));
     // Check that inputs are ints or doubles
     if((firstNum->type != INT_TYPE && firstNum->type != DOUBLE_TYPE) || (secondNum->type != INT_TYPE && secondNum->type != DOUBLE_TYPE)){
-            printf("Error: I can't subtract this!\n");
-            texit(EXIT_FAILURE);
+            raiseError("Error: I can't subtract this!");
         }
     //isolate first thing
     if(firstNum->type == INT_TYPE){
@@ -341,7 +622,7 @@ Value *primitiveSub(Value *subList){
         else{
             toReturn -= secondNum->d;
         }
-    Value *final = talloc(sizeof(Value));
+    Value *final = tallocKind(sizeof(Value), ALLOC_NUMBER);
     final->type = DOUBLE_TYPE;
     final->d = toReturn;
     
@@ -359,8 +640,7 @@ Value *primitiveMult(Value *multList){
         
         //check to make sure args are ints or doubles
         if(number->type != INT_TYPE && number->type != DOUBLE_TYPE){
-            printf("Error: I can't multiply this!\n");
-            texit(EXIT_FAILURE);
+            raiseError("Error: I can't multiply this!");
         }
         //multiply number with running total
         if(number->type == INT_TYPE){
@@ -371,7 +651,7 @@ Value *primitiveMult(Value *multList){
         }
         multList = cdr(multList);
     }
-    Value *total = talloc(sizeof(Value));
+    Value *total = tallocKind(sizeof(Value), ALLOC_NUMBER);
     total->type = DOUBLE_TYPE;
     total->d = runningTotal;
     
@@ -386,8 +666,7 @@ Value *primitiveDiv(Value *nums){
     if (nums->type != CONS_TYPE ||
         cdr(nums)->type != CONS_TYPE ||
         cdr(cdr(nums))->type != NULL_TYPE){
-            printf("Wrong number of arguments for comparison\n");
-        texit(EXIT_FAILURE);
+            raiseError("Wrong number of arguments for comparison");
     }
     
     double getFirst = 0.0;
@@ -397,8 +676,7 @@ Value *primitiveDiv(Value *nums){
     
     //check both args are ints or doubles
     if((firstNum->type != INT_TYPE && firstNum->type != DOUBLE_TYPE) || (secondNum->type != INT_TYPE && secondNum->type != DOUBLE_TYPE)){
-            printf("Error: I can't divide these!\n");
-            texit(EXIT_FAILURE);
+            raiseError("Error: I can't divide these!");
         }
     //make both args into doubles
     if(firstNum->type == INT_TYPE){
@@ -414,7 +692,7 @@ Value *primitiveDiv(Value *nums){
         getSecond += secondNum->d;   
         }
     //divide numbers
-    Value *final = talloc(sizeof(Value));
+    Value *final = tallocKind(sizeof(Value), ALLOC_NUMBER);
     final->type = DOUBLE_TYPE;
     final->d = getFirst/getSecond;
     return final;
@@ -428,8 +706,7 @@ Value *primitiveGre(Value *nums){
     if (nums->type != CONS_TYPE ||
         cdr(nums)->type != CONS_TYPE ||
         cdr(cdr(nums))->type != NULL_TYPE){
-            printf("Wrong number of arguments for comparison\n");  
-        texit(EXIT_FAILURE);
+            raiseError("Wrong number of arguments for comparison");
     }
     
     Value *final = talloc(sizeof(Value));
@@ -440,8 +717,7 @@ Value *primitiveGre(Value *nums){
     
     //check both args are ints or doubles
     if((firstNum->type != INT_TYPE && firstNum->type != DOUBLE_TYPE) || (secondNum->type != INT_TYPE && secondNum->type != DOUBLE_TYPE)){
-            printf("Error: I can't compare these!\n");
-            texit(EXIT_FAILURE);
+            raiseError("Error: I can't compare these!");
         }
     //isolate first arg
     if(firstNum->type == INT_TYPE){
@@ -479,8 +755,7 @@ Value *primitiveLess(Value *nums){
     if (nums->type != CONS_TYPE ||
         cdr(nums)->type != CONS_TYPE ||
         cdr(cdr(nums))->type != NULL_TYPE){
-            printf("Wrong number of arguments for comparison\n");  
-        texit(EXIT_FAILURE);
+            raiseError("Wrong number of arguments for comparison");
     }
     Value *final = talloc(sizeof(Value));
     final->type = BOOL_TYPE;
@@ -490,8 +765,7 @@ Value *primitiveLess(Value *nums){
     
     //check both args are ints or doubles
     if((firstNum->type != INT_TYPE && firstNum->type != DOUBLE_TYPE) || (secondNum->type != INT_TYPE && secondNum->type != DOUBLE_TYPE)){
-            printf("Error: I can't compare these!\n");
-            texit(EXIT_FAILURE);
+            raiseError("Error: I can't compare these!");
         }
     
     //isolate first thing
@@ -531,8 +805,7 @@ Value *primitiveEq(Value *nums){
     if (nums->type != CONS_TYPE ||
         cdr(nums)->type != CONS_TYPE ||
         cdr(cdr(nums))->type != NULL_TYPE){
-            printf("Wrong number of arguments for comparison\n");
-        texit(EXIT_FAILURE);
+            raiseError("Wrong number of arguments for comparison");
     }
     
     double getFirst = 0.0;
@@ -542,8 +815,7 @@ Value *primitiveEq(Value *nums){
     
     //check both args are ints or doubles
     if((firstNum->type != INT_TYPE && firstNum->type != DOUBLE_TYPE) || (secondNum->type != INT_TYPE && secondNum->type != DOUBLE_TYPE)){
-            printf("Error: I can't compare these!\n");
-            texit(EXIT_FAILURE);
+            raiseError("Error: I can't compare these!");
         }
     
     //make both args into doubles
@@ -580,18 +852,17 @@ Value *primitiveMod(Value *nums){
     if (nums->type != CONS_TYPE ||
         cdr(nums)->type != CONS_TYPE ||
         cdr(cdr(nums))->type != NULL_TYPE){
-            printf("Wrong number of arguments for mod\n");                 texit(EXIT_FAILURE);
+            raiseError("Wrong number of arguments for mod");
     }
     
-    Value *final = talloc(sizeof(Value));
+    Value *final = tallocKind(sizeof(Value), ALLOC_NUMBER);
     final->type = INT_TYPE;
     Value *firstNum = car(nums);
     Value *secondNum = car(cdr(nums));
     
     //check that both args are ints
     if(firstNum->type != INT_TYPE || secondNum->type != INT_TYPE){
-            printf("Error: I can't mod these!\n");
-            texit(EXIT_FAILURE);
+            raiseError("Error: I can't mod these!");
         }
     //mod args
     int getFirst = firstNum->i;
@@ -606,18 +877,15 @@ Value *primitiveMod(Value *nums){
  */
 Value *primitiveNull(Value *args) {
     if(args->type == NULL_TYPE){
-        printf("Error: Wrong number of args for null check.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: Wrong number of args for null check.");
     }
     //verify that there is only one arg
     if(args->type == CONS_TYPE){
         if(cdr(args)->type == CONS_TYPE && car(cdr(args))->type != NULL_TYPE){
-            printf("Error: Wrong number of args for null check.\n");
-            texit(EXIT_FAILURE);
+            raiseError("Error: Wrong number of args for null check.");
         }
         else if(cdr(args)->type != NULL_TYPE){
-            printf("Error: Wrong number of args for null check.\n");
-            texit(EXIT_FAILURE);
+            raiseError("Error: Wrong number of args for null check.");
         }
     }
     return nullHelper(args);
@@ -650,20 +918,16 @@ Value *nullHelper(Value *args){
 Value *primitiveCar(Value *args){
     //verify correct number and type of args
     if(args->type == NULL_TYPE){
-        printf("Error: Wrong number of args for getting car.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: Wrong number of args for getting car.");
     }
     if (args->type != CONS_TYPE) {
-        printf("Error: Can't call car on this type.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: Can't call car on this type.");
     }
     if (cdr(args)->type != NULL_TYPE) {
-        printf("Error: Wrong number of args for getting car.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: Wrong number of args for getting car.");
     }
     if (car(args)->type != CONS_TYPE) {
-        printf("Error: Can't get car.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: Can't get car.");
     }
 
     //return the car of the thing
@@ -677,20 +941,16 @@ Value *primitiveCar(Value *args){
 Value *primitiveCdr(Value *args){
     //verify correct number and type of args
     if(args->type == NULL_TYPE){
-        printf("Error: Wrong number of args for getting cdr.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: Wrong number of args for getting cdr.");
     }
     if (args->type != CONS_TYPE) {
-        printf("Error: Can't call cdr on this type.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: Can't call cdr on this type.");
     }
     if (cdr(args)->type != NULL_TYPE) {
-        printf("Error: Wrong number of args for getting cdr.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: Wrong number of args for getting cdr.");
     }
     if (car(args)->type != CONS_TYPE) {
-        printf("Error: Can't get cdr.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: Can't get cdr.");
     }
 
     //return the car of the thing
@@ -705,23 +965,20 @@ Value *primitiveCons(Value *args){
 
     //verify type and number of args
     if(args->type == NULL_TYPE){
-        printf("Error: Wrong number of args for creating cons cell.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: Wrong number of args for creating cons cell.");
     }
      
     if (args->type != CONS_TYPE) {
-        printf("Error: Can't call cdr on this type.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: Can't call cdr on this type.");
     }
 
     if (cdr(args)->type != CONS_TYPE ||
         cdr(cdr(args))->type != NULL_TYPE){
-        printf("Error: Can't cons this.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: Can't cons this.");
     }
     Value *result;
     //return the result of consing the first arg onto the second one
-    if (car(cdr(args))->type == CONS_TYPE){
+    if (car(cdr(args))->type == CONS_TYPE || car(cdr(args))->type == NULL_TYPE){
         result = cons(car(args), car(cdr(args)));
     }
     else {
@@ -731,194 +988,1443 @@ Value *primitiveCons(Value *args){
     
 }
 
+/*
+ * Primitive function to create a vector of a given size in Racket,
+ * optionally filled with a given value (0 otherwise).
+ */
+Value *primitiveMakeVector(Value *args){
+    //verify one or two args
+    if (args->type != CONS_TYPE ||
+        (cdr(args)->type != NULL_TYPE && cdr(cdr(args))->type != NULL_TYPE)) {
+        raiseError("Error: Wrong number of args for make-vector.");
+    }
+    int size = indexArg(car(args), -1, "make-vector");
+    Value *fill;
+    if (cdr(args)->type == CONS_TYPE) {
+        fill = car(cdr(args));
+    } else {
+        fill = tallocKind(sizeof(Value), ALLOC_NUMBER);
+        fill->type = INT_TYPE;
+        fill->i = 0;
+    }
+    Value *vector = makeVector(size);
+    for (int i = 0; i < size; i++) {
+        vector->v.items[i] = fill;
+    }
+    return vector;
+}
+
+/*
+ * Primitive function to create a vector holding its arguments in Racket.
+ */
+Value *primitiveVector(Value *args){
+    Value *vector = makeVector(length(args));
+    //copy each argument into the next slot
+    for (int i = 0; args->type != NULL_TYPE; i++) {
+        vector->v.items[i] = car(args);
+        args = cdr(args);
+    }
+    return vector;
+}
 
+/*
+ * Primitive function to get the item at an index of a vector in Racket.
+ */
+Value *primitiveVectorRef(Value *args){
+    checkArgs(args, 2, "vector-ref");
+    Value *vector = car(args);
+    if (vector->type != VECTOR_TYPE) {
+        raiseError("Error: Can't call vector-ref on this type.");
+    }
+    int index = indexArg(car(cdr(args)), vector->v.size, "vector-ref");
+    return vector->v.items[index];
+}
 
-/*********************/
-/*** Special Forms ***/
-/*********************/
+/*
+ * Primitive function to replace the item at an index of a vector in Racket.
+ */
+Value *primitiveVectorSet(Value *args){
+    checkArgs(args, 3, "vector-set!");
+    Value *vector = car(args);
+    if (vector->type != VECTOR_TYPE) {
+        raiseError("Error: Can't call vector-set! on this type.");
+    }
+    int index = indexArg(car(cdr(args)), vector->v.size, "vector-set!");
+    vector->v.items[index] = car(cdr(cdr(args)));
+    return makeVoid();
+}
 
+/*
+ * Primitive function to get the number of items in a vector in Racket.
+ */
+Value *primitiveVectorLength(Value *args){
+    checkArgs(args, 1, "vector-length");
+    if (car(args)->type != VECTOR_TYPE) {
+        raiseError("Error: Can't call vector-length on this type.");
+    }
+    Value *result = tallocKind(sizeof(Value), ALLOC_NUMBER);
+    result->type = INT_TYPE;
+    result->i = car(args)->v.size;
+    return result;
+}
 
 /*
- * Evaluates a let expression with arguments args in environment frame.
+ * Primitive function to turn a vector into a list in Racket.
  */
-Value *evalLet(Value *args, Frame *frame){
-    // Create a new Frame f whose parent Frame is frame.
-    Frame *f = newFrame(frame);
-    
-    // If the list of bindings is not a nested list, error.
-    if (args->type != CONS_TYPE || 
-        car(args)->type != CONS_TYPE || 
-        car(car(args))->type != CONS_TYPE) {
-        printf("Error: list of bindings for let does not contain a nested list\n");
-        texit(EXIT_FAILURE);
+Value *primitiveVectorToList(Value *args){
+    checkArgs(args, 1, "vector->list");
+    Value *vector = car(args);
+    if (vector->type != VECTOR_TYPE) {
+        raiseError("Error: Can't call vector->list on this type.");
     }
-    
-    // Isolate list of bindings to make
-    Value *toAssign = car(args);
-    
-    // For each binding, add binding to frame f
-    while (toAssign->type != NULL_TYPE) {
-        Value *cur = car(toAssign);
-        
-        //make sure binding has 1 variable name and 1 value
-        if(cdr(cur)->type == NULL_TYPE || cdr(cdr(cur))->type != NULL_TYPE){
-            printf("Error: \"let\" statement does not bind variables correctly.\n");
-            texit(EXIT_FAILURE);
-        }
-        
-        // Let vali be the result of evaluating cur value in 
-        // Frame frame (environment let statement is in--parent to new frame f).
-        Value *vali = eval(car(cdr(cur)), frame);
-        
-        // Create new binding (cons cell) that includes both the variable (in car) 
-        // and result of evaluation of value (in cdr)
-        Value *binding = makeNull();
-        binding = cons(vali, binding);
-        binding = cons(car(cur), binding);
-        
-        // Add this new binding to f->bindings
-        f->bindings = cons(binding, f->bindings);
-        
-        toAssign = cdr(toAssign);
+    Value *list = makeList(vector->v.size);
+    for (int i = 0; i < vector->v.size; i++) {
+        list[i].c.car = vector->v.items[i];
     }
-    
-    // Evaluate body in Frame f and return the result.
-    // There should only be one arg after the bindings
-    // but if there are more, go to the last one (like Racket does).
-    // If there is no body, error.
-    if(cdr(args)->type == NULL_TYPE){
-        printf("Error: \"let\" statement is not formatted properly.\n");
-        texit(EXIT_FAILURE);
+    return list;
+}
+
+/*
+ * Primitive function to turn a list into a vector in Racket.
+ */
+Value *primitiveListToVector(Value *args){
+    checkArgs(args, 1, "list->vector");
+    Value *list = car(args);
+    if (list->type != CONS_TYPE && list->type != NULL_TYPE) {
+        raiseError("Error: Can't call list->vector on this type.");
     }
-    
-    // Unwrap extra cons cells to get to actual let body and return.
-    Value *toReturn = NULL;
-    if (cdr(cdr(args))->type == CONS_TYPE) {
-        Value *curr = cdr(cdr(args));
-        while(cdr(curr)->type != NULL_TYPE){
-            curr = cdr(curr);
-        }
-        toReturn = eval(car(curr), f);
-    } else {
-        toReturn = eval(car(cdr(args)), f);
+    return primitiveVector(list);
+}
+
+/*
+ * Primitive function to create a flonum vector of a given size in Racket,
+ * optionally filled with a given number (0.0 otherwise).
+ */
+Value *primitiveMakeFlVector(Value *args){
+    //verify one or two args
+    if (args->type != CONS_TYPE ||
+        (cdr(args)->type != NULL_TYPE && cdr(cdr(args))->type != NULL_TYPE)) {
+        raiseError("Error: Wrong number of args for make-flvector.");
+    }
+    int size = indexArg(car(args), -1, "make-flvector");
+    double fill = 0.0;
+    if (cdr(args)->type == CONS_TYPE) {
+        fill = numberArg(car(cdr(args)), "make-flvector");
+    }
+    Value *vector = makeFlVector(size);
+    for (int i = 0; i < size; i++) {
+        vector->fv.items[i] = fill;
+    }
+    return vector;
+}
+
+/*
+ * Primitive function to create a flonum vector holding its arguments in Racket.
+ */
+Value *primitiveFlVector(Value *args){
+    Value *vector = makeFlVector(length(args));
+    for (int i = 0; args->type != NULL_TYPE; i++) {
+        vector->fv.items[i] = numberArg(car(args), "flvector");
+        args = cdr(args);
     }
-    return toReturn;
+    return vector;
 }
 
 /*
- * Evaluates a let* expression with arguments args in environment frame.
+ * Primitive function to get the number at an index of a flonum vector in Racket.
  */
-Value *evalLetStar(Value *args, Frame *frame){
-    //instead of adding each binding to a single frame,
-    //create a new frame for each new binding
-    
-    // Create a new Frame curFrame whose parent Frame is frame.
-    Frame *curFrame = newFrame(frame);
-    
-    //create a holder pointer for the parent frame
-    Frame *parentFrame = frame;
-    
-    // If the list of bindings is not a nested list, error.
-    if (args->type != CONS_TYPE || 
-        car(args)->type != CONS_TYPE || 
-        car(car(args))->type != CONS_TYPE) {
-        printf("Error: list of bindings for let does not contain a nested list\n");
-        texit(EXIT_FAILURE);
+Value *primitiveFlVectorRef(Value *args){
+    checkArgs(args, 2, "flvector-ref");
+    Value *vector = car(args);
+    if (vector->type != FLVECTOR_TYPE) {
+        raiseError("Error: Can't call flvector-ref on this type.");
+    }
+    int index = indexArg(car(cdr(args)), vector->fv.size, "flvector-ref");
+    //box the number on the way out, since flvectors store raw doubles
+    Value *result = tallocKind(sizeof(Value), ALLOC_NUMBER);
+    result->type = DOUBLE_TYPE;
+    result->d = vector->fv.items[index];
+    return result;
+}
+
+/*
+ * Primitive function to replace the number at an index of a flonum vector in Racket.
+ */
+Value *primitiveFlVectorSet(Value *args){
+    checkArgs(args, 3, "flvector-set!");
+    Value *vector = car(args);
+    if (vector->type != FLVECTOR_TYPE) {
+        raiseError("Error: Can't call flvector-set! on this type.");
+    }
+    int index = indexArg(car(cdr(args)), vector->fv.size, "flvector-set!");
+    vector->fv.items[index] = numberArg(car(cdr(cdr(args))), "flvector-set!");
+    return makeVoid();
+}
+
+/*
+ * Primitive function to get the number of items in a flonum vector in Racket.
+ */
+Value *primitiveFlVectorLength(Value *args){
+    checkArgs(args, 1, "flvector-length");
+    if (car(args)->type != FLVECTOR_TYPE) {
+        raiseError("Error: Can't call flvector-length on this type.");
+    }
+    Value *result = tallocKind(sizeof(Value), ALLOC_NUMBER);
+    result->type = INT_TYPE;
+    result->i = car(args)->fv.size;
+    return result;
+}
+
+/*
+ * Primitive function to create a mutable hash table comparing keys with
+ * equal? in Racket. It may be given a list of (key value) lists to start with.
+ */
+Value *primitiveMakeHash(Value *args){
+    return makeHash(args, false, "make-hash");
+}
+
+/*
+ * Primitive function to create a mutable hash table comparing keys with
+ * eq? in Racket. It may be given a list of (key value) lists to start with.
+ */
+Value *primitiveMakeHashEq(Value *args){
+    return makeHash(args, true, "make-hasheq");
+}
+
+/*
+ * Primitive function to look up a key in a hash table or immutable hash in Racket. If the key
+ * is missing, the optional third argument is returned instead.
+ */
+Value *primitiveHashRef(Value *args){
+    //verify two or three args
+    if (args->type != CONS_TYPE || cdr(args)->type != CONS_TYPE ||
+        (cdr(cdr(args))->type != NULL_TYPE &&
+         cdr(cdr(cdr(args)))->type != NULL_TYPE)) {
+        raiseError("Error: Wrong number of args for hash-ref.");
     }
-    
-    // Isolate list of bindings to make
-    Value *toAssign = car(args);
-    
-    
-    // For each binding, add it to the current frame, then create a new frame
-    //for the next binding
-    while (toAssign->type != NULL_TYPE) {
-        
-        Value *cur = car(toAssign);
-        
-        //make sure binding has 1 variable name and 1 value
-        if(cdr(cur)->type == NULL_TYPE || cdr(cdr(cur))->type != NULL_TYPE){
-            printf("Error: \"let\" statement does not bind variables correctly.\n");
-            texit(EXIT_FAILURE);
+    Value *result = hashLookup(car(args), car(cdr(args)), "hash-ref");
+    if (result == NULL) {
+        if (cdr(cdr(args))->type == NULL_TYPE) {
+            raiseError("Error: hash-ref could not find key %s", valueToString(car(cdr(args))));
         }
-        
-        // Let vali be the result of evaluating cur value in 
-        // Frame frame (environment let statement is in--parent to new frame f).
-        Value *vali = eval(car(cdr(cur)), curFrame);
-        
-        // Create new binding (cons cell) that includes both the variable (in car) 
-        // and result of evaluation of value (in cdr)
-        Value *binding = makeNull();
-        binding = cons(vali, binding);
-        binding = cons(car(cur), binding);
-        
-        // Add this new binding to f->bindings
-        curFrame->bindings = cons(binding, curFrame->bindings);
-        
-        //set the parent frame to be the current frame,
-        //then create a new frame for the next binding
-        parentFrame = curFrame;
-        curFrame = newFrame(parentFrame);
-        toAssign = cdr(toAssign);
-    }
-    
-    // Evaluate body in Frame curFrame and return the result.
-    // There should only be one arg after the bindings
-    // but if there are more, go to the last one (like Racket does).
-    // If there is no body, error.
-    if(cdr(args)->type == NULL_TYPE){
-        printf("Error: \"let\" statement is not formatted properly.\n");
-        texit(EXIT_FAILURE);
-    }
-    
-    // Unwrap extra cons cells to get to actual let body and return.
-    Value *toReturn = NULL;
-    if (cdr(cdr(args))->type == CONS_TYPE) {
-        Value *curr = cdr(cdr(args));
-        while(cdr(curr)->type != NULL_TYPE){
-            curr = cdr(curr);
+        result = car(cdr(cdr(args)));
+        //a procedure given as the default is called to get the result
+        if (result->type == CLOSURE_TYPE || result->type == PRIMITIVE_TYPE) {
+            result = applyProcedure(result, makeNull());
         }
-        toReturn = eval(car(curr), curFrame);
-    } else {
-        toReturn = eval(car(cdr(args)), curFrame);
     }
-    return toReturn;
+    return result;
 }
 
 /*
- * Evaluates a let expression with arguments args in environment frame.
- * Similar to let, but evaluates everything in parent frame
+ * Primitive function to bind a key to a value in a hash table in Racket.
  */
-Value *evalLetRec(Value *args, Frame *frame){
-    
-    // Create a new Frame curFrame whose parent Frame is frame.
-    Frame *curFrame = newFrame(frame);
-    
-    //create a holder pointer for the parent frame
-    Frame *parentFrame = frame;
-    
-    // If the list of bindings is not a nested list, error.
-    if (args->type != CONS_TYPE || 
-        car(args)->type != CONS_TYPE || 
-        car(car(args))->type != CONS_TYPE) {
-        printf("Error: list of bindings for let does not contain a nested list\n");
-        texit(EXIT_FAILURE);
+Value *primitiveHashSet(Value *args){
+    checkArgs(args, 3, "hash-set!");
+    HashTable *table = hashArg(car(args), "hash-set!");
+    hashPut(table, car(cdr(args)), car(cdr(cdr(args))));
+    return makeVoid();
+}
+
+/*
+ * Primitive function to remove a key from a hash table in Racket.
+ */
+Value *primitiveHashRemove(Value *args){
+    checkArgs(args, 2, "hash-remove!");
+    HashTable *table = hashArg(car(args), "hash-remove!");
+    hashRemove(table, car(cdr(args)));
+    return makeVoid();
+}
+
+/*
+ * Primitive function to get the number of keys in a hash table in Racket.
+ */
+Value *primitiveHashCount(Value *args){
+    checkArgs(args, 1, "hash-count");
+    Value *hash = car(args);
+    Value *result = tallocKind(sizeof(Value), ALLOC_NUMBER);
+    result->type = INT_TYPE;
+    if (hash->type == HAMT_TYPE) {
+        result->i = hash->hm.count;
+    } else {
+        result->i = hashArg(hash, "hash-count")->count;
     }
-    
-    // Isolate list of bindings to make
-    Value *toAssign = car(args);
-    
-    
-    // For each binding, add it to the current frame, then create a new frame
-    //for the next binding
-    while (toAssign->type != NULL_TYPE) {
-        
-        Value *cur = car(toAssign);
+    return result;
+}
+
+/*
+ * Primitive function to check whether a hash table contains a key in Racket.
+ */
+Value *primitiveHashHasKey(Value *args){
+    checkArgs(args, 2, "hash-has-key?");
+    return makeBool(hashLookup(car(args), car(cdr(args)), "hash-has-key?") != NULL);
+}
+
+/*
+ * Primitive function to list the keys of a hash table in Racket.
+ */
+Value *primitiveHashKeys(Value *args){
+    checkArgs(args, 1, "hash-keys");
+    return hashContents(car(args), 0, "hash-keys");
+}
+
+/*
+ * Primitive function to list the values of a hash table in Racket.
+ */
+Value *primitiveHashValues(Value *args){
+    checkArgs(args, 1, "hash-values");
+    return hashContents(car(args), 1, "hash-values");
+}
+
+/*
+ * Primitive function to list the bindings of a hash table in Racket. Each
+ * binding is a (key value) list, since this interpreter has no dotted pairs.
+ */
+Value *primitiveHashToList(Value *args){
+    checkArgs(args, 1, "hash->list");
+    return hashContents(car(args), 2, "hash->list");
+}
+
+/*
+ * Primitive function to create an immutable hash from alternating keys and
+ * values in Racket.
+ */
+Value *primitiveHash(Value *args){
+    Value *hash = talloc(sizeof(Value));
+    hash->type = HAMT_TYPE;
+    hash->hm.root = NULL;
+    hash->hm.count = 0;
+    while (args->type != NULL_TYPE) {
+        if (cdr(args)->type == NULL_TYPE) {
+            raiseError("Error: hash needs a value for every key.");
+        }
+        bool added;
+        hash->hm.root = hamtSet(hash->hm.root, car(args), car(cdr(args)), &added);
+        if (added) {
+            hash->hm.count++;
+        }
+        args = cdr(cdr(args));
+    }
+    return hash;
+}
+
+/*
+ * Primitive function to make a new immutable hash that also binds a key to a
+ * value in Racket. The old hash is unchanged and shares structure with the new one.
+ */
+Value *primitiveHashFunctionalSet(Value *args){
+    checkArgs(args, 3, "hash-set");
+    Value *old = hamtArg(car(args), "hash-set");
+    bool added;
+    Value *hash = talloc(sizeof(Value));
+    hash->type = HAMT_TYPE;
+    hash->hm.root = hamtSet(old->hm.root, car(cdr(args)), car(cdr(cdr(args))), &added);
+    hash->hm.count = old->hm.count + (added ? 1 : 0);
+    return hash;
+}
+
+/*
+ * Primitive function to make a new immutable hash without a key in Racket.
+ * The old hash is unchanged and shares structure with the new one.
+ */
+Value *primitiveHashFunctionalRemove(Value *args){
+    checkArgs(args, 2, "hash-remove");
+    Value *old = hamtArg(car(args), "hash-remove");
+    bool removed;
+    HamtNode *root = hamtRemove(old->hm.root, car(cdr(args)), &removed);
+    if (!removed) {
+        return old;
+    }
+    Value *hash = talloc(sizeof(Value));
+    hash->type = HAMT_TYPE;
+    hash->hm.root = root;
+    hash->hm.count = old->hm.count - 1;
+    return hash;
+}
+
+/*
+ * Primitive function to count the items of a list in Racket.
+ */
+Value *primitiveLength(Value *args){
+    checkArgs(args, 1, "length");
+    Value *result = tallocKind(sizeof(Value), ALLOC_NUMBER);
+    result->type = INT_TYPE;
+    result->i = length(listArg(car(args), "length"));
+    return result;
+}
+
+/*
+ * Primitive function to join lists together in Racket. Every list but the
+ * last is copied; the last one is shared with the result.
+ */
+Value *primitiveAppend(Value *args){
+    if (args->type == NULL_TYPE) {
+        return makeNull();
+    }
+    //count the items that have to be copied
+    int count = 0;
+    Value *cur = args;
+    while (cdr(cur)->type != NULL_TYPE) {
+        count += length(listArg(car(cur), "append"));
+        cur = cdr(cur);
+    }
+    Value *last = listArg(car(cur), "append");
+    if (count == 0) {
+        return last;
+    }
+    //copy the items into one block, then hook the last list onto the end
+    Value *result = makeList(count);
+    int next = 0;
+    for (cur = args; cdr(cur)->type != NULL_TYPE; cur = cdr(cur)) {
+        for (Value *item = car(cur); item->type != NULL_TYPE; item = cdr(item)) {
+            result[next].c.car = car(item);
+            next++;
+        }
+    }
+    result[count - 1].c.cdr = last;
+    return result;
+}
+
+/*
+ * Primitive function to reverse a list in Racket.
+ */
+Value *primitiveReverse(Value *args){
+    checkArgs(args, 1, "reverse");
+    return reverse(listArg(car(args), "reverse"));
+}
+
+/*
+ * Primitive function to make a list of its arguments in Racket. The argument
+ * list is freshly built for every call, so it can be returned as it is.
+ */
+Value *primitiveList(Value *args){
+    return args;
+}
+
+/*
+ * Primitive function to get the item at an index of a list in Racket.
+ */
+Value *primitiveListRef(Value *args){
+    checkArgs(args, 2, "list-ref");
+    Value *rest = dropItems(car(args), indexArg(car(cdr(args)), -1, "list-ref"), "list-ref");
+    if (rest->type != CONS_TYPE) {
+        raiseError("Error: Index out of range for list-ref.");
+    }
+    return car(rest);
+}
+
+/*
+ * Primitive function to drop the first items of a list in Racket.
+ */
+Value *primitiveListTail(Value *args){
+    checkArgs(args, 2, "list-tail");
+    return dropItems(car(args), indexArg(car(cdr(args)), -1, "list-tail"), "list-tail");
+}
+
+/*
+ * Primitive function to find the first part of a list starting with an item
+ * equal to the given one in Racket. Returns false if there is none.
+ */
+Value *primitiveMember(Value *args){
+    checkArgs(args, 2, "member");
+    Value *item = car(args);
+    Value *list = listArg(car(cdr(args)), "member");
+    while (list->type == CONS_TYPE) {
+        if (isEqual(item, car(list))) {
+            return list;
+        }
+        list = cdr(list);
+    }
+    return makeBool(false);
+}
+
+/*
+ * Primitive function to find the first list in a list of lists whose first
+ * item is equal to the given key in Racket. Returns false if there is none.
+ */
+Value *primitiveAssoc(Value *args){
+    checkArgs(args, 2, "assoc");
+    Value *key = car(args);
+    Value *list = listArg(car(cdr(args)), "assoc");
+    while (list->type == CONS_TYPE) {
+        Value *entry = car(list);
+        if (entry->type != CONS_TYPE) {
+            raiseError("Error: assoc expects a list of lists.");
+        }
+        if (isEqual(key, car(entry))) {
+            return entry;
+        }
+        list = cdr(list);
+    }
+    return makeBool(false);
+}
+
+/*
+ * Primitive function to get the last cons cell of a list in Racket.
+ */
+Value *primitiveLastPair(Value *args){
+    checkArgs(args, 1, "last-pair");
+    Value *list = car(args);
+    if (list->type != CONS_TYPE) {
+        raiseError("Error: Can't call last-pair on this type.");
+    }
+    while (cdr(list)->type == CONS_TYPE) {
+        list = cdr(list);
+    }
+    return list;
+}
+
+/*
+ * Primitive function to check if two values are structurally equal in Racket.
+ */
+Value *primitiveEqual(Value *args){
+    checkArgs(args, 2, "equal?");
+    return makeBool(isEqual(car(args), car(cdr(args))));
+}
+
+/*
+ * Primitive function to check if two values are the same object in Racket.
+ */
+Value *primitiveEqv(Value *args){
+    checkArgs(args, 2, "eq?");
+    return makeBool(isEq(car(args), car(cdr(args))));
+}
+
+/*
+ * Primitive function to call a function on the items of one or more lists
+ * in Racket, collecting the results in a new list.
+ */
+Value *primitiveMap(Value *args){
+    if (args->type != CONS_TYPE || cdr(args)->type == NULL_TYPE) {
+        raiseError("Error: Wrong number of args for map.");
+    }
+    Value *function = procedureArg(car(args), "map");
+    int count = listsLength(cdr(args), "map");
+    int lists = length(cdr(args));
+    Value **cursors = talloc(sizeof(Value *) * lists);
+    for (int i = 0; i < lists; i++) {
+        cursors[i] = car(dropItems(cdr(args), i, "map"));
+    }
+    //the result has the same length as the lists, so build it all at once
+    Value *result = makeList(count);
+    for (int i = 0; i < count; i++) {
+        result[i].c.car = applyProcedure(function, nextArgs(cursors, lists, NULL));
+    }
+    return result;
+}
+
+/*
+ * Primitive function to call a function on the items of one or more lists
+ * in Racket, for its side effects only.
+ */
+Value *primitiveForEach(Value *args){
+    if (args->type != CONS_TYPE || cdr(args)->type == NULL_TYPE) {
+        raiseError("Error: Wrong number of args for for-each.");
+    }
+    Value *function = procedureArg(car(args), "for-each");
+    int count = listsLength(cdr(args), "for-each");
+    int lists = length(cdr(args));
+    Value **cursors = talloc(sizeof(Value *) * lists);
+    for (int i = 0; i < lists; i++) {
+        cursors[i] = car(dropItems(cdr(args), i, "for-each"));
+    }
+    for (int i = 0; i < count; i++) {
+        applyProcedure(function, nextArgs(cursors, lists, NULL));
+    }
+    return makeVoid();
+}
+
+/*
+ * Primitive function to keep the items of a list for which a function
+ * does not return false in Racket.
+ */
+Value *primitiveFilter(Value *args){
+    checkArgs(args, 2, "filter");
+    Value *function = procedureArg(car(args), "filter");
+    Value *list = listArg(car(cdr(args)), "filter");
+    //the result is no longer than the list, so make room for all of it and
+    //cut the result short after the last item kept
+    int count = length(list);
+    Value *result = makeList(count);
+    int kept = 0;
+    while (list->type != NULL_TYPE) {
+        Value *item = car(list);
+        if (!isFalse(applyProcedure(function, cons(item, makeNull())))) {
+            result[kept].c.car = item;
+            kept++;
+        }
+        list = cdr(list);
+    }
+    if (kept == 0) {
+        return &result[count];
+    }
+    result[kept - 1].c.cdr = &result[count];
+    return result;
+}
+
+/*
+ * Primitive function to combine the items of one or more lists from left to
+ * right in Racket, calling the function on each item and the result so far.
+ */
+Value *primitiveFoldl(Value *args){
+    if (args->type != CONS_TYPE || cdr(args)->type != CONS_TYPE ||
+        cdr(cdr(args))->type == NULL_TYPE) {
+        raiseError("Error: Wrong number of args for foldl.");
+    }
+    Value *function = procedureArg(car(args), "foldl");
+    Value *result = car(cdr(args));
+    Value *listArgs = cdr(cdr(args));
+    int count = listsLength(listArgs, "foldl");
+    int lists = length(listArgs);
+    Value **cursors = talloc(sizeof(Value *) * lists);
+    for (int i = 0; i < lists; i++) {
+        cursors[i] = car(dropItems(listArgs, i, "foldl"));
+    }
+    for (int i = 0; i < count; i++) {
+        result = applyProcedure(function, nextArgs(cursors, lists, result));
+    }
+    return result;
+}
+
+/*
+ * Primitive function to combine the items of one or more lists from right to
+ * left in Racket, calling the function on each item and the result so far.
+ */
+Value *primitiveFoldr(Value *args){
+    if (args->type != CONS_TYPE || cdr(args)->type != CONS_TYPE ||
+        cdr(cdr(args))->type == NULL_TYPE) {
+        raiseError("Error: Wrong number of args for foldr.");
+    }
+    Value *function = procedureArg(car(args), "foldr");
+    Value *result = car(cdr(args));
+    Value *listArgs = cdr(cdr(args));
+    int count = listsLength(listArgs, "foldr");
+    int lists = length(listArgs);
+    Value **cursors = talloc(sizeof(Value *) * lists);
+    for (int i = 0; i < lists; i++) {
+        cursors[i] = car(dropItems(listArgs, i, "foldr"));
+    }
+    //gather each call's arguments first so they can be visited backwards;
+    //the last one, the result so far, is filled in just before the call
+    Value **calls = talloc(sizeof(Value *) * count);
+    for (int i = 0; i < count; i++) {
+        calls[i] = nextArgs(cursors, lists, result);
+    }
+    for (int i = count - 1; i >= 0; i--) {
+        calls[i][lists].c.car = result;
+        result = applyProcedure(function, calls[i]);
+    }
+    return result;
+}
+
+/*
+ * Primitive function to check that a function does not return false for
+ * any item of one or more lists in Racket. Returns the last result.
+ */
+Value *primitiveAndmap(Value *args){
+    if (args->type != CONS_TYPE || cdr(args)->type == NULL_TYPE) {
+        raiseError("Error: Wrong number of args for andmap.");
+    }
+    Value *function = procedureArg(car(args), "andmap");
+    int count = listsLength(cdr(args), "andmap");
+    int lists = length(cdr(args));
+    Value **cursors = talloc(sizeof(Value *) * lists);
+    for (int i = 0; i < lists; i++) {
+        cursors[i] = car(dropItems(cdr(args), i, "andmap"));
+    }
+    Value *result = makeBool(true);
+    for (int i = 0; i < count; i++) {
+        result = applyProcedure(function, nextArgs(cursors, lists, NULL));
+        if (isFalse(result)) {
+            return result;
+        }
+    }
+    return result;
+}
+
+/*
+ * Primitive function to find the first result of a function on the items of
+ * one or more lists that is not false in Racket.
+ */
+Value *primitiveOrmap(Value *args){
+    if (args->type != CONS_TYPE || cdr(args)->type == NULL_TYPE) {
+        raiseError("Error: Wrong number of args for ormap.");
+    }
+    Value *function = procedureArg(car(args), "ormap");
+    int count = listsLength(cdr(args), "ormap");
+    int lists = length(cdr(args));
+    Value **cursors = talloc(sizeof(Value *) * lists);
+    for (int i = 0; i < lists; i++) {
+        cursors[i] = car(dropItems(cdr(args), i, "ormap"));
+    }
+    for (int i = 0; i < count; i++) {
+        Value *result = applyProcedure(function, nextArgs(cursors, lists, NULL));
+        if (!isFalse(result)) {
+            return result;
+        }
+    }
+    return makeBool(false);
+}
+
+/*
+ * Primitive function to call a function on a list of arguments in Racket.
+ * Any arguments before the list are put in front of it.
+ */
+Value *primitiveApply(Value *args){
+    if (args->type != CONS_TYPE || cdr(args)->type == NULL_TYPE) {
+        raiseError("Error: Wrong number of args for apply.");
+    }
+    Value *function = procedureArg(car(args), "apply");
+    //the arguments before the list become the start of the argument list
+    int before = length(cdr(args)) - 1;
+    Value *last = listArg(car(dropItems(cdr(args), before, "apply")), "apply");
+    if (before == 0) {
+        return applyProcedure(function, last);
+    }
+    Value *actualArgs = makeList(before);
+    Value *cur = cdr(args);
+    for (int i = 0; i < before; i++) {
+        actualArgs[i].c.car = car(cur);
+        cur = cdr(cur);
+    }
+    actualArgs[before - 1].c.cdr = last;
+    return applyProcedure(function, actualArgs);
+}
+
+/*
+ * Primitive function to start evaluating a thunk in parallel in Racket.
+ * See future.h for what a future may safely do.
+ */
+Value *primitiveFuture(Value *args){
+    checkArgs(args, 1, "future");
+    return makeFuture(procedureArg(car(args), "future"));
+}
+
+/*
+ * Primitive function to wait for the result of a future in Racket.
+ */
+Value *primitiveTouch(Value *args){
+    checkArgs(args, 1, "touch");
+    return touchFuture(car(args));
+}
+
+/*
+ * Primitive function to get the number of processors in Racket.
+ */
+Value *primitiveProcessorCount(Value *args){
+    checkArgs(args, 0, "processor-count");
+    Value *result = tallocKind(sizeof(Value), ALLOC_NUMBER);
+    result->type = INT_TYPE;
+    result->i = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    return result;
+}
+
+/*
+ * Primitive function to call a function on every item of a list or vector
+ * in parallel in Racket. The results come back in order, in a list or vector
+ * matching the input.
+ */
+Value *primitivePmap(Value *args){
+    checkArgs(args, 2, "pmap");
+    Value *function = procedureArg(car(args), "pmap");
+    Value *sequence = car(cdr(args));
+    int count;
+    Value **items = sequenceItems(sequence, &count, "pmap");
+    Value **results = talloc(sizeof(Value *) * count);
+    int chunkCount;
+    Chunk *chunks = splitChunks(function, items, count, NULL, &chunkCount);
+    for (int i = 0; i < chunkCount; i++) {
+        chunks[i].results = results;
+    }
+    runChunks(chunks, chunkCount, mapChunk);
+    //gather the results in the same kind of sequence we were given
+    if (sequence->type == VECTOR_TYPE) {
+        Value *vector = makeVector(count);
+        for (int i = 0; i < count; i++) {
+            vector->v.items[i] = results[i];
+        }
+        return vector;
+    }
+    Value *list = makeList(count);
+    for (int i = 0; i < count; i++) {
+        list[i].c.car = results[i];
+    }
+    return list;
+}
+
+/*
+ * Primitive function to call a function on every item of a list or vector
+ * in parallel in Racket, for its side effects only. The calls happen in no
+ * particular order unless deterministic mode is on.
+ */
+Value *primitivePforEach(Value *args){
+    checkArgs(args, 2, "pfor-each");
+    Value *function = procedureArg(car(args), "pfor-each");
+    int count;
+    Value **items = sequenceItems(car(cdr(args)), &count, "pfor-each");
+    int chunkCount;
+    Chunk *chunks = splitChunks(function, items, count, NULL, &chunkCount);
+    runChunks(chunks, chunkCount, mapChunk);
+    return makeVoid();
+}
+
+/*
+ * Primitive function to combine the items of a list or vector in parallel in
+ * Racket. Each chunk is folded from init with (function result-so-far item),
+ * then the chunk results are folded together in order from init, so function
+ * should be associative and init should be its identity.
+ */
+Value *primitivePreduce(Value *args){
+    checkArgs(args, 3, "preduce");
+    Value *function = procedureArg(car(args), "preduce");
+    Value *init = car(cdr(args));
+    int count;
+    Value **items = sequenceItems(car(cdr(cdr(args))), &count, "preduce");
+    int chunkCount;
+    Chunk *chunks = splitChunks(function, items, count, init, &chunkCount);
+    runChunks(chunks, chunkCount, reduceChunk);
+    if (chunkCount == 1) {
+        return chunks[0].reduced;
+    }
+    Value *result = init;
+    for (int i = 0; i < chunkCount; i++) {
+        result = applyProcedure(function, cons(result, cons(chunks[i].reduced, makeNull())));
+    }
+    return result;
+}
+
+/*
+ * Primitive function to wait for a place to finish in Racket.
+ */
+Value *primitivePlaceWait(Value *args){
+    checkArgs(args, 1, "place-wait");
+    return waitForPlace(car(args));
+}
+
+/*
+ * Primitive function to send a copy of a value to another place in Racket.
+ */
+Value *primitivePlaceChannelPut(Value *args){
+    checkArgs(args, 2, "place-channel-put");
+    channelPut(car(args), car(cdr(args)));
+    return makeVoid();
+}
+
+/*
+ * Primitive function to receive a value from another place in Racket.
+ */
+Value *primitivePlaceChannelGet(Value *args){
+    checkArgs(args, 1, "place-channel-get");
+    return channelGet(car(args));
+}
+
+/*
+ * Primitive function to raise any value as an exception in Racket.
+ */
+Value *primitiveRaise(Value *args){
+    checkArgs(args, 1, "raise");
+    raiseValue(car(args));
+    return NULL;
+}
+
+/*
+ * Primitive function to raise an error in Racket. (error 'name "message")
+ * gives the message "name: message"; (error "message" v ...) gives the
+ * message followed by each v as display shows it.
+ */
+Value *primitiveError(Value *args){
+    if (args->type != CONS_TYPE) {
+        raiseError("Error: error expects at least one argument.");
+    }
+    Value *first = car(args);
+    if (first->type == SYMBOL_TYPE && cdr(args)->type == CONS_TYPE &&
+        car(cdr(args))->type == STR_TYPE) {
+        char *message = talloc(strlen(first->s) + strlen(car(cdr(args))->s) + 3);
+        sprintf(message, "%s: %s", first->s, car(cdr(args))->s);
+        raiseValue(makeError(message));
+    }
+    if (first->type != STR_TYPE && first->type != SYMBOL_TYPE) {
+        raiseError("Error: error expects a string or symbol.");
+    }
+    char *message = first->s;
+    for (Value *cur = cdr(args); cur->type == CONS_TYPE; cur = cdr(cur)) {
+        char *shown = valueToString(car(cur));
+        // display leaves a space after each value
+        int size = strlen(shown);
+        if (size > 0 && shown[size - 1] == ' ') {
+            shown[size - 1] = '\0';
+        }
+        char *longer = talloc(strlen(message) + strlen(shown) + 2);
+        sprintf(longer, "%s %s", message, shown);
+        message = longer;
+    }
+    raiseValue(makeError(message));
+    return NULL;
+}
+
+/*
+ * Primitive function to check whether a value is an error in Racket.
+ */
+Value *primitiveIsExn(Value *args){
+    checkArgs(args, 1, "exn?");
+    return makeBool(car(args)->type == ERROR_TYPE);
+}
+
+/*
+ * Primitive function to get the message of an error in Racket.
+ */
+Value *primitiveExnMessage(Value *args){
+    checkArgs(args, 1, "exn-message");
+    if (car(args)->type != ERROR_TYPE) {
+        raiseError("Error: exn-message expects an exception.");
+    }
+    Value *result = talloc(sizeof(Value));
+    result->type = STR_TYPE;
+    result->s = car(args)->s;
+    return result;
+}
+
+
+
+/*************************/
+/*** Primitive Helpers ***/
+/*************************/
+
+
+/*
+ * Make sure a primitive was given exactly count arguments.
+ */
+void checkArgs(Value *args, int count, char *name){
+    int given = 0;
+    while (args->type == CONS_TYPE) {
+        given++;
+        args = cdr(args);
+    }
+    if (given != count) {
+        raiseError("Error: Wrong number of args for %s.", name);
+    }
+}
+
+/*
+ * Turn an argument into a non-negative integer index, accepting doubles with
+ * no fractional part (since arithmetic always produces doubles). If limit is
+ * not negative, the index must also be less than limit.
+ */
+int indexArg(Value *arg, int limit, char *name){
+    int index;
+    if (arg->type == INT_TYPE) {
+        index = arg->i;
+    } else if (arg->type == DOUBLE_TYPE) {
+        // Converting a double that doesn't fit in an int is undefined, so
+        // check the range first; NaN fails every comparison
+        double bound = limit >= 0 ? limit : INT_MAX + 1.0;
+        if (arg->d != arg->d) {
+            raiseError("Error: %s expects an integer index.", name);
+        }
+        if (arg->d < 0 || arg->d >= bound) {
+            raiseError("Error: Index out of range for %s.", name);
+        }
+        index = (int)arg->d;
+        if (index != arg->d) {
+            raiseError("Error: %s expects an integer index.", name);
+        }
+    } else {
+        raiseError("Error: %s expects an integer index.", name);
+    }
+    if (index < 0 || (limit >= 0 && index >= limit)) {
+        raiseError("Error: Index out of range for %s.", name);
+    }
+    return index;
+}
+
+/*
+ * Turn an int or double argument into a double.
+ */
+double numberArg(Value *arg, char *name){
+    if (arg->type == INT_TYPE) {
+        return arg->i;
+    }
+    if (arg->type != DOUBLE_TYPE) {
+        raiseError("Error: %s expects a number.", name);
+    }
+    return arg->d;
+}
+
+/*
+ * Create a vector with room for size items.
+ */
+Value *makeVector(int size){
+    Value *vector = talloc(sizeof(Value));
+    vector->type = VECTOR_TYPE;
+    vector->v.size = size;
+    vector->v.items = talloc(sizeof(Value *) * size);
+    return vector;
+}
+
+/*
+ * Create a flonum vector with room for size unboxed doubles.
+ */
+Value *makeFlVector(int size){
+    Value *vector = talloc(sizeof(Value));
+    vector->type = FLVECTOR_TYPE;
+    vector->fv.size = size;
+    vector->fv.items = talloc(sizeof(double) * size);
+    return vector;
+}
+
+/*
+ * Create a boolean value.
+ */
+Value *makeBool(bool truth){
+    Value *result = talloc(sizeof(Value));
+    result->type = BOOL_TYPE;
+    result->s = truth ? "#t" : "#f";
+    return result;
+}
+
+/*
+ * Create a hash table value, filling it from an optional list of
+ * (key value) lists given as the only argument.
+ */
+Value *makeHash(Value *args, bool eq, char *name){
+    if (args->type != NULL_TYPE) {
+        checkArgs(args, 1, name);
+    }
+    Value *hash = talloc(sizeof(Value));
+    hash->type = HASH_TYPE;
+    hash->h = newHashTable(eq);
+    if (args->type == NULL_TYPE) {
+        return hash;
+    }
+    Value *bindings = car(args);
+    while (bindings->type == CONS_TYPE) {
+        Value *binding = car(bindings);
+        if (binding->type != CONS_TYPE || cdr(binding)->type != CONS_TYPE) {
+            raiseError("Error: %s expects a list of (key value) lists.", name);
+        }
+        hashPut(hash->h, car(binding), car(cdr(binding)));
+        bindings = cdr(bindings);
+    }
+    return hash;
+}
+
+/*
+ * Make sure an argument is a hash table and return its table.
+ */
+HashTable *hashArg(Value *arg, char *name){
+    if (arg->type != HASH_TYPE) {
+        raiseError("Error: Can't call %s on this type.", name);
+    }
+    return arg->h;
+}
+
+/*
+ * Make sure an argument is an immutable hash.
+ */
+Value *hamtArg(Value *arg, char *name){
+    if (arg->type != HAMT_TYPE) {
+        raiseError("Error: Can't call %s on this type.", name);
+    }
+    return arg;
+}
+
+/*
+ * Look up key in either kind of hash. Returns NULL if it is not present.
+ */
+Value *hashLookup(Value *hash, Value *key, char *name){
+    if (hash->type == HAMT_TYPE) {
+        return hamtGet(hash->hm.root, key);
+    }
+    return hashGet(hashArg(hash, name), key);
+}
+
+/*
+ * List the keys (part 0), values (part 1) or (key value) lists (part 2)
+ * of either kind of hash, in table order.
+ */
+Value *hashContents(Value *hash, int part, char *name){
+    Collector collector;
+    collector.part = part;
+    if (hash->type == HAMT_TYPE) {
+        Value *list = makeList(hash->hm.count);
+        collector.cell = list;
+        hamtForEach(hash->hm.root, collectBinding, &collector);
+        return list;
+    }
+    HashTable *table = hashArg(hash, name);
+    Value *list = makeList(table->count);
+    collector.cell = list;
+    for (int i = 0; i < table->capacity; i++) {
+        HashEntry *entry = &table->entries[i];
+        if (entry->key != NULL && !entry->removed) {
+            collectBinding(entry->key, entry->value, &collector);
+        }
+    }
+    return list;
+}
+
+/*
+ * Store one binding of a hash in the next cell of the list being built by
+ * hashContents, then move on to the following cell.
+ */
+void collectBinding(Value *key, Value *value, void *data){
+    Collector *collector = data;
+    if (collector->part == 0) {
+        collector->cell->c.car = key;
+    } else if (collector->part == 1) {
+        collector->cell->c.car = value;
+    } else {
+        collector->cell->c.car = cons(key, cons(value, makeNull()));
+    }
+    collector->cell = cdr(collector->cell);
+}
+
+/*
+ * Make sure an argument is a list (possibly empty).
+ */
+Value *listArg(Value *arg, char *name){
+    if (arg->type != CONS_TYPE && arg->type != NULL_TYPE) {
+        raiseError("Error: %s expects a list.", name);
+    }
+    return arg;
+}
+
+/*
+ * Drop the first count items of a list.
+ */
+Value *dropItems(Value *list, int count, char *name){
+    listArg(list, name);
+    for (int i = 0; i < count; i++) {
+        if (list->type != CONS_TYPE) {
+            raiseError("Error: Index out of range for %s.", name);
+        }
+        list = cdr(list);
+    }
+    return list;
+}
+
+/*
+ * Make sure an argument is a closure or primitive function.
+ */
+Value *procedureArg(Value *arg, char *name){
+    if (arg->type != CLOSURE_TYPE && arg->type != PRIMITIVE_TYPE) {
+        raiseError("Error: %s expects a procedure.", name);
+    }
+    return arg;
+}
+
+/*
+ * Make sure a list of arguments are all lists of the same length, and
+ * return that length.
+ */
+int listsLength(Value *lists, char *name){
+    int count = length(listArg(car(lists), name));
+    for (Value *cur = cdr(lists); cur->type != NULL_TYPE; cur = cdr(cur)) {
+        if (length(listArg(car(cur), name)) != count) {
+            raiseError("Error: %s expects lists of the same length.", name);
+        }
+    }
+    return count;
+}
+
+/*
+ * Build an argument list out of the next item of each of count lists, moving
+ * each list along by one. If extra is not NULL, it is added as a last argument.
+ */
+Value *nextArgs(Value **cursors, int count, Value *extra){
+    Value *args = makeList(count + (extra != NULL ? 1 : 0));
+    for (int i = 0; i < count; i++) {
+        args[i].c.car = car(cursors[i]);
+        cursors[i] = cdr(cursors[i]);
+    }
+    if (extra != NULL) {
+        args[count].c.car = extra;
+    }
+    return args;
+}
+
+/*
+ * Check whether a value is #f, the only value Racket treats as false.
+ */
+bool isFalse(Value *value){
+    return value->type == BOOL_TYPE && !strcmp(value->s, "#f");
+}
+
+/*
+ * Get the items of a list or vector as an array, and how many there are.
+ */
+Value **sequenceItems(Value *sequence, int *count, char *name){
+    if (sequence->type == VECTOR_TYPE) {
+        *count = sequence->v.size;
+        return sequence->v.items;
+    }
+    Value *list = listArg(sequence, name);
+    *count = length(list);
+    Value **items = talloc(sizeof(Value *) * *count);
+    for (int i = 0; i < *count; i++) {
+        items[i] = car(list);
+        list = cdr(list);
+    }
+    return items;
+}
+
+/*
+ * Split count items into chunks for the parallel primitives. Small inputs get
+ * a single chunk; otherwise the chunk size adapts to the number of workers.
+ */
+Chunk *splitChunks(Value *function, Value **items, int count, Value *init, int *chunkCount){
+    int size = count;
+    if (count >= PARALLEL_THRESHOLD) {
+        int target = futureWorkers() * CHUNKS_PER_WORKER;
+        size = (count + target - 1) / target;
+        if (size < MIN_CHUNK_SIZE) {
+            size = MIN_CHUNK_SIZE;
+        }
+    }
+    *chunkCount = count == 0 ? 1 : (count + size - 1) / size;
+    Chunk *chunks = talloc(sizeof(Chunk) * *chunkCount);
+    for (int i = 0; i < *chunkCount; i++) {
+        chunks[i].function = function;
+        chunks[i].items = items;
+        chunks[i].results = NULL;
+        chunks[i].reduced = init;
+        chunks[i].start = i * size;
+        chunks[i].end = (i + 1) * size < count ? (i + 1) * size : count;
+    }
+    return chunks;
+}
+
+/*
+ * Run work on every chunk on the thread pool. Joining them in order runs the
+ * first one right here (unless a worker got to it first). If any chunk
+ * raised an error, the first one is raised once all chunks are done.
+ */
+void runChunks(Chunk *chunks, int chunkCount, void (*work)(void *)){
+    if (chunkCount == 1) {
+        work(&chunks[0]);
+        return;
+    }
+    Task **tasks = talloc(sizeof(Task *) * chunkCount);
+    for (int i = 0; i < chunkCount; i++) {
+        tasks[i] = spawnTask(work, &chunks[i]);
+    }
+    joinTasks(tasks, chunkCount);
+}
+
+/*
+ * Work function for pmap and pfor-each: call the function on each item of
+ * the chunk, keeping the results if there is somewhere to put them.
+ */
+void mapChunk(void *data){
+    Chunk *chunk = data;
+    for (int i = chunk->start; i < chunk->end; i++) {
+        Value *result = applyProcedure(chunk->function, cons(chunk->items[i], makeNull()));
+        if (chunk->results != NULL) {
+            chunk->results[i] = result;
+        }
+    }
+}
+
+/*
+ * Work function for preduce: fold the items of the chunk from its start value.
+ */
+void reduceChunk(void *data){
+    Chunk *chunk = data;
+    for (int i = chunk->start; i < chunk->end; i++) {
+        chunk->reduced = applyProcedure(chunk->function,
+                                        cons(chunk->reduced, cons(chunk->items[i], makeNull())));
+    }
+}
+
+/*
+ * Create the void value returned by statements with no result.
+ */
+Value *makeVoid(){
+    Value *result = makeNull();
+    result->type = VOID_TYPE;
+    return result;
+}
+
+
+
+/*********************/
+/*** Special Forms ***/
+/*********************/
+
+
+/*
+ * Evaluates a let expression with arguments args in environment frame.
+ */
+Value *evalLet(Value *args, Frame *frame){
+    // Create a new Frame f whose parent Frame is frame.
+    Frame *f = newFrame(frame);
+    
+    // If the list of bindings is not a nested list, error.
+    if (args->type != CONS_TYPE || 
+        car(args)->type != CONS_TYPE || 
+        car(car(args))->type != CONS_TYPE) {
+        raiseError("Error: list of bindings for let does not contain a nested list");
+    }
+    
+    // Isolate list of bindings to make
+    Value *toAssign = car(args);
+    
+    // For each binding, add binding to frame f
+    while (toAssign->type != NULL_TYPE) {
+        Value *cur = car(toAssign);
+        
+        //make sure binding has 1 variable name and 1 value
+        if(cdr(cur)->type == NULL_TYPE || cdr(cdr(cur))->type != NULL_TYPE){
+            raiseError("Error: \"let\" statement does not bind variables correctly.");
+        }
+        
+        // Let vali be the result of evaluating cur value in 
+        // Frame frame (environment let statement is in--parent to new frame f).
+        Value *vali = eval(car(cdr(cur)), frame);
+        
+        // Create new binding (cons cell) that includes both the variable (in car) 
+        // and result of evaluation of value (in cdr)
+        Value *binding = makeNull();
+        binding = cons(vali, binding);
+        binding = cons(car(cur), binding);
+        
+        // Add this new binding to f->bindings
+        f->bindings = cons(binding, f->bindings);
+        
+        toAssign = cdr(toAssign);
+    }
+    
+    // Evaluate body in Frame f and return the result.
+    // There should only be one arg after the bindings
+    // but if there are more, go to the last one (like Racket does).
+    // If there is no body, error.
+    if(cdr(args)->type == NULL_TYPE){
+        raiseError("Error: \"let\" statement is not formatted properly.");
+    }
+    
+    // Unwrap extra cons cells to get to actual let body and return.
+    Value *toReturn = NULL;
+    if (cdr(cdr(args))->type == CONS_TYPE) {
+        Value *curr = cdr(cdr(args));
+        while(cdr(curr)->type != NULL_TYPE){
+            curr = cdr(curr);
+        }
+        toReturn = eval(car(curr), f);
+    } else {
+        toReturn = eval(car(cdr(args)), f);
+    }
+    return toReturn;
+}
+
+/*
+ * Evaluates a let* expression with arguments args in environment frame.
+ */
+Value *evalLetStar(Value *args, Frame *frame){
+    //instead of adding each binding to a single frame,
+    //create a new frame for each new binding
+    
+    // Create a new Frame curFrame whose parent Frame is frame.
+    Frame *curFrame = newFrame(frame);
+    
+    //create a holder pointer for the parent frame
+    Frame *parentFrame = frame;
+    
+    // If the list of bindings is not a nested list, error.
+    if (args->type != CONS_TYPE || 
+        car(args)->type != CONS_TYPE || 
+        car(car(args))->type != CONS_TYPE) {
+        raiseError("Error: list of bindings for let does not contain a nested list");
+    }
+    
+    // Isolate list of bindings to make
+    Value *toAssign = car(args);
+    
+    
+    // For each binding, add it to the current frame, then create a new frame
+    //for the next binding
+    while (toAssign->type != NULL_TYPE) {
+        
+        Value *cur = car(toAssign);
+        
+        //make sure binding has 1 variable name and 1 value
+        if(cdr(cur)->type == NULL_TYPE || cdr(cdr(cur))->type != NULL_TYPE){
+            raiseError("Error: \"let\" statement does not bind variables correctly.");
+        }
+        
+        // Let vali be the result of evaluating cur value in 
+        // Frame frame (environment let statement is in--parent to new frame f).
+        Value *vali = eval(car(cdr(cur)), curFrame);
+        
+        // Create new binding (cons cell) that includes both the variable (in car) 
+        // and result of evaluation of value (in cdr)
+        Value *binding = makeNull();
+        binding = cons(vali, binding);
+        binding = cons(car(cur), binding);
+        
+        // Add this new binding to f->bindings
+        curFrame->bindings = cons(binding, curFrame->bindings);
+        
+        //set the parent frame to be the current frame,
+        //then create a new frame for the next binding
+        parentFrame = curFrame;
+        curFrame = newFrame(parentFrame);
+        toAssign = cdr(toAssign);
+    }
+    
+    // Evaluate body in Frame curFrame and return the result.
+    // There should only be one arg after the bindings
+    // but if there are more, go to the last one (like Racket does).
+    // If there is no body, error.
+    if(cdr(args)->type == NULL_TYPE){
+        raiseError("Error: \"let\" statement is not formatted properly.");
+    }
+    
+    // Unwrap extra cons cells to get to actual let body and return.
+    Value *toReturn = NULL;
+    if (cdr(cdr(args))->type == CONS_TYPE) {
+        Value *curr = cdr(cdr(args));
+        while(cdr(curr)->type != NULL_TYPE){
+            curr = cdr(curr);
+        }
+        toReturn = eval(car(curr), curFrame);
+    } else {
+        toReturn = eval(car(cdr(args)), curFrame);
+    }
+    return toReturn;
+}
+
+/*
+ * Evaluates a let expression with arguments args in environment frame.
+ * Similar to let, but evaluates everything in parent frame
+ */
+Value *evalLetRec(Value *args, Frame *frame){
+    
+    // Create a new Frame curFrame whose parent Frame is frame.
+    Frame *curFrame = newFrame(frame);
+    
+    //create a holder pointer for the parent frame
+    Frame *parentFrame = frame;
+    
+    // If the list of bindings is not a nested list, error.
+    if (args->type != CONS_TYPE || 
+        car(args)->type != CONS_TYPE || 
+        car(car(args))->type != CONS_TYPE) {
+        raiseError("Error: list of bindings for let does not contain a nested list");
+    }
+    
+    // Isolate list of bindings to make
+    Value *toAssign = car(args);
+    
+    
+    // For each binding, add it to the current frame, then create a new frame
+    //for the next binding
+    while (toAssign->type != NULL_TYPE) {
+        
+        Value *cur = car(toAssign);
         
         //make sure binding has 1 variable name and 1 value
         if(cdr(cur)->type == NULL_TYPE || cdr(cdr(cur))->type != NULL_TYPE){
-            printf("Error: \"let\" statement does not bind variables correctly.\n");
-            texit(EXIT_FAILURE);
+            raiseError("Error: \"let\" statement does not bind variables correctly.");
         }
         
         // Let vali be the result of evaluating cur value in 
@@ -948,8 +2454,7 @@ Value *evalLetRec(Value *args, Frame *frame){
     // but if there are more, go to the last one (like Racket does).
     // If there is no body, error.
     if(cdr(args)->type == NULL_TYPE){
-        printf("Error: \"let\" statement is not formatted properly.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: \"let\" statement is not formatted properly.");
     }
     
     // Unwrap extra cons cells to get to actual let body and return.
@@ -975,12 +2480,10 @@ Value *evalQuote(Value *tree) {
     args = cdr(tree);
     // Check that quote has exactly one argument 
     if (args->type == NULL_TYPE) {
-        printf("Error: \"quote\" not given any arguments\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: \"quote\" not given any arguments");
     }
     if (cdr(args)->type != NULL_TYPE) {
-        printf("Error: \"quote\" given too many arguments.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: \"quote\" given too many arguments.");
     }
     // Return the whole tree (including "quote").
     return car(args);
@@ -998,8 +2501,7 @@ Value *evalIf(Value *args, Frame *frame){
         cur = cdr(cur);
     }
     if (count != 3) {
-        printf("Error: \"if\" statement does not contain three arguments.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: \"if\" statement does not contain three arguments.");
     }
     
     // See if condition is true or false.
@@ -1007,8 +2509,7 @@ Value *evalIf(Value *args, Frame *frame){
     Value *truthValue = eval(condition, frame);
     // Check that condition is a boolean.
     if (truthValue->type != BOOL_TYPE) {
-        printf("Error: \"if\" condition does not evaluate to boolean.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: \"if\" condition does not evaluate to boolean.");
     }
     
     // If true, evaluate second element in args.
@@ -1035,12 +2536,12 @@ Value *evalDefine(Value *args, Frame *frame) {
         cur = cdr(cur);
     }
     if (count != 2) {
-        printf("Error: \"define\" statement does not contain two arguments.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: \"define\" statement does not contain two arguments.");
     }
     
     // Let vali be the result of evaluating value in cur in frame frame.
     Value *vali = eval(car(cdr(args)), frame);
+    nameClosure(vali, car(args)->s);
     
     // Create new binding that includes both the variable 
     // and result of evaluation of value.
@@ -1070,18 +2571,17 @@ Value *evalLambda(Value *args, Frame *frame) {
         cur = cdr(cur);
     }
     if (count < 2) {
-        printf("Error: \"lambda\" statement does not contain one or more arguments.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: \"lambda\" statement does not contain one or more arguments.");
     }
     
     // Make a new closure that contains the names of the 
     // parameters for the function, the function code, and the environment.
-    Value *closure = makeNull();
+    Value *closure = tallocKind(sizeof(Value), ALLOC_CLOSURE);
     closure->type = CLOSURE_TYPE;
     
-    closure->cl.paramNames = car(args);
-    closure->cl.functionCode = cdr(args);
+    closure->cl.code = args;
     closure->cl.frame = frame;
+    closure->cl.name = NULL;
     
     return closure;
 }
@@ -1099,28 +2599,18 @@ Value *evalBegin(Value *args, Frame *frame) {
         cur = cdr(cur);
     }
     if (count < 1) {
-        printf("Error: \"begin\" statement does not contain two arguments.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: \"begin\" statement does not contain two arguments.");
     }
     
-    //eval each statement in the function code
+    //eval each statement except the last one
     Value *commandList = args;
-    cur = car(commandList);
-    while(cur->type != NULL_TYPE){
-        eval(cur, frame);
+    while(cdr(commandList)->type != NULL_TYPE){
+        eval(car(commandList), frame);
         commandList = cdr(commandList);
-        if(commandList->type != NULL_TYPE){
-            cur = car(commandList);
-        }
-        else{
-            break;
-        }
     }
     
-    //get the last thing in the list of things that happen in the closure and return that
-    Value *lastCommand = car(reverse(args));
-    
-    return eval(lastCommand, frame);
+    //the last statement gives the result
+    return eval(car(commandList), frame);
 }
 
 /*
@@ -1140,8 +2630,7 @@ Value *evalSet(Value *args, Frame *frame) {
         cur = cdr(cur);
     }
     if (count != 2) {
-        printf("Error: \"set!\" statement does not contain two arguments.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: \"set!\" statement does not contain two arguments.");
     }
     
     // Let vali be the result of evaluating value in cur in frame frame.
@@ -1153,7 +2642,7 @@ Value *evalSet(Value *args, Frame *frame) {
     //iterate through the bindings in frame->bindings
     Frame *curFrame = frame;
     int foundMatch = 0;
-     while(curFrame != NULL){
+     while(curFrame != NULL && !foundMatch){
         Value *bindingList = curFrame->bindings;
         Value *curBinding = car(bindingList);
         //check all levels of bindings
@@ -1170,6 +2659,8 @@ Value *evalSet(Value *args, Frame *frame) {
                 //make the pointer to the old binding now point to the new binding
                 curBinding = newBinding;
                 curFrame->bindings = cons(curBinding, curFrame->bindings);
+                //only the innermost binding changes; the older ones it shadows stay
+                break;
             }
             bindingList = cdr(bindingList);
             if(bindingList->type != NULL_TYPE){
@@ -1183,8 +2674,7 @@ Value *evalSet(Value *args, Frame *frame) {
     }
     
     if(foundMatch == 0){
-        printf("Error: \"set!\" must modify an existing symbol.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: \"set!\" must modify an existing symbol.");
     }
     
     Value* toReturn = makeNull();
@@ -1208,8 +2698,7 @@ Value *evalAnd(Value *args, Frame *frame) {
         }
         // Error if there are any non-boolean arguments.
         else {
-            printf("Error: \"and\" cannot handle non-boolean arguments.\n");
-            texit(EXIT_FAILURE);
+            raiseError("Error: \"and\" cannot handle non-boolean arguments.");
         }
         current = cdr(current);
     }
@@ -1237,8 +2726,7 @@ Value *evalOr(Value *args, Frame *frame) {
         }
         // Error if there are any non-boolean arguments.
         else {
-            printf("Error: \"or\" cannot handle non-boolean arguments.\n");
-            texit(EXIT_FAILURE);
+            raiseError("Error: \"or\" cannot handle non-boolean arguments.");
         }
         current = cdr(current);
     }
@@ -1261,15 +2749,13 @@ Value *evalCond(Value *args, Frame *frame) {
         
         // Check current is a nested cons type
         if (current->type != CONS_TYPE) {
-            printf("Error: \"cond\" statement not formatted correctly.\n");
-            texit(EXIT_FAILURE);
+            raiseError("Error: \"cond\" statement not formatted correctly.");
         }
         
         Value *curExp = car(current);
         
         if (curExp->type != CONS_TYPE) {
-            printf("Error: \"cond\" statement not formatted correctly.\n");
-            texit(EXIT_FAILURE);
+            raiseError("Error: \"cond\" statement not formatted correctly.");
         }
         
         Value *condition = car(curExp);
@@ -1277,12 +2763,10 @@ Value *evalCond(Value *args, Frame *frame) {
         
         // Check length of body (there must be exactly one expression in a cond body)
         if (body->type != CONS_TYPE) {
-            printf("Error: \"cond\" clause does not have a body.\n");
-            texit(EXIT_FAILURE);
+            raiseError("Error: \"cond\" clause does not have a body.");
         }
         if (cdr(body)->type != NULL_TYPE) {
-            printf("Error: \"cond\" body given too many arguments.\n");
-            texit(EXIT_FAILURE);
+            raiseError("Error: \"cond\" body given too many arguments.");
         }
         
         // default "else" case
@@ -1296,8 +2780,7 @@ Value *evalCond(Value *args, Frame *frame) {
         
         // If the condition is not the else case, it must be a boolean.
         if (condition->type != BOOL_TYPE) {
-            printf("Error: \"cond\" condition does not evaluate to boolean.\n");
-            texit(EXIT_FAILURE);
+            raiseError("Error: \"cond\" condition does not evaluate to boolean.");
         }
         
         // The first time we see a condition evaluate to true, evaluate and 
@@ -1314,6 +2797,134 @@ Value *evalCond(Value *args, Frame *frame) {
     return result;
 }
 
+/*
+ * Evaluates a "place" expression, with arguments args, with frame as enviroment.
+ * Starts the body running in a new place (see place.h) with the given name
+ * bound to its end of a channel, and returns the place descriptor.
+ */
+Value *evalPlace(Value *args, Frame *frame) {
+    if (args->type != CONS_TYPE || car(args)->type != SYMBOL_TYPE ||
+        cdr(args)->type != CONS_TYPE) {
+        raiseError("Error: \"place\" needs a channel name and a body.");
+    }
+    return startPlace(car(args), cdr(args));
+}
+
+/*
+ * Evaluates a "with-handlers" expression, with arguments args, with frame as
+ * enviroment. The first argument is a list of (predicate handler) clauses,
+ * and the rest are the body. If the body raises a value, the handler of the
+ * first clause whose predicate accepts it is called on it, and its result is
+ * the result; if no predicate accepts it, it is raised again.
+ */
+Value *evalWithHandlers(Value *args, Frame *frame) {
+    if (args->type != CONS_TYPE || cdr(args)->type != CONS_TYPE) {
+        raiseError("Error: \"with-handlers\" needs a list of handlers and a body.");
+    }
+    // Evaluate the predicates and handlers before running the body
+    int count = 0;
+    Value *clause;
+    for (clause = car(args); clause->type == CONS_TYPE; clause = cdr(clause)) {
+        count++;
+    }
+    Value **handlers = talloc(sizeof(Value *) * (2 * count + 1));
+    int i = 0;
+    for (clause = car(args); clause->type == CONS_TYPE; clause = cdr(clause)) {
+        Value *pair = car(clause);
+        if (pair->type != CONS_TYPE || cdr(pair)->type != CONS_TYPE ||
+            cdr(cdr(pair))->type != NULL_TYPE) {
+            raiseError("Error: \"with-handlers\" clauses must be (predicate handler).");
+        }
+        handlers[i++] = procedureArg(eval(car(pair), frame), "with-handlers");
+        handlers[i++] = procedureArg(eval(car(cdr(pair)), frame), "with-handlers");
+    }
+
+    ErrorTrap trap;
+    pushErrorTrap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        Value *result = evalBegin(cdr(args), frame);
+        popErrorTrap(&trap);
+        return result;
+    }
+    Value *raised = trap.raised;
+    // Going over a limit ends the run, so it can't be handled
+    if (isLimitError(raised)) {
+        raiseValue(raised);
+    }
+    for (i = 0; i < 2 * count; i += 2) {
+        if (!isFalse(applyProcedure(handlers[i], cons(raised, makeNull())))) {
+            return applyProcedure(handlers[i + 1], cons(raised, makeNull()));
+        }
+    }
+    raiseValue(raised);
+    return NULL;
+}
+
+/*
+ * Evaluates a "time" expression, with arguments args, with frame as
+ * enviroment. Evaluates the body as begin would and returns its result,
+ * after printing the CPU and real time it took in milliseconds, what it
+ * allocated, and how deeply it recursed. CPU time is the whole process's,
+ * so it includes futures running meanwhile. Nothing allocated by talloc is
+ * freed before the end of the run, so gc time is always 0.
+ *
+ * The report goes through the thread's stdout writer (see output.h) and is
+ * flushed straight away as one write, so a report from a future can come out
+ * between two lines of the main thread's output but never inside one. Under
+ * --parallel-toplevel, forms using time run alone, so it is never mixed up
+ * with other forms' results.
+ */
+Value *evalTime(Value *args, Frame *frame) {
+    if (args->type != CONS_TYPE) {
+        raiseError("Error: \"time\" needs an expression to time.");
+    }
+    long allocationsBefore, bytesBefore;
+    tallocStats(&allocationsBefore, &bytesBefore);
+    // Track the deepest evaluation from here, and put back the deepest of
+    // the run afterwards
+    long deepest = stats.maxDepth;
+    __atomic_store_n(&stats.maxDepth, evalDepth, __ATOMIC_RELAXED);
+    struct timespec cpuStart, realStart, cpuEnd, realEnd;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuStart);
+    clock_gettime(CLOCK_MONOTONIC, &realStart);
+
+    // An error in the body still has to put back the deepest of the run
+    Value *result;
+    ErrorTrap trap;
+    pushErrorTrap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        result = evalBegin(args, frame);
+        popErrorTrap(&trap);
+    } else {
+        if (stats.maxDepth > deepest) {
+            deepest = stats.maxDepth;
+        }
+        __atomic_store_n(&stats.maxDepth, deepest, __ATOMIC_RELAXED);
+        raiseValue(trap.raised);
+    }
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuEnd);
+    clock_gettime(CLOCK_MONOTONIC, &realEnd);
+    long allocations, bytes;
+    tallocStats(&allocations, &bytes);
+    long depth = stats.maxDepth - evalDepth;
+    if (stats.maxDepth > deepest) {
+        deepest = stats.maxDepth;
+    }
+    __atomic_store_n(&stats.maxDepth, deepest, __ATOMIC_RELAXED);
+    char report[256];
+    snprintf(report, sizeof(report),
+             "cpu time: %.3f real time: %.3f gc time: 0 allocated: %ld bytes in %ld objects "
+             "max depth: %ld\n",
+             (cpuEnd.tv_sec - cpuStart.tv_sec) * 1000.0 + (cpuEnd.tv_nsec - cpuStart.tv_nsec) / 1e6,
+             (realEnd.tv_sec - realStart.tv_sec) * 1000.0 + (realEnd.tv_nsec - realStart.tv_nsec) / 1e6,
+             bytes - bytesBefore, allocations - allocationsBefore, depth);
+    Output *output = standardOutput();
+    writeText(output, report);
+    flushOutput(output);
+    return result;
+}
+
 
 
 /*****************************/
@@ -1321,27 +2932,51 @@ Value *evalCond(Value *args, Frame *frame) {
 /*****************************/
 
 
+/*
+ * Apply the given closure or primitive function to the given (already
+ * evaluated) arguments args.
+ */
+Value *applyProcedure(Value *function, Value *args) {
+    if (function->type != PRIMITIVE_TYPE && function->type != CLOSURE_TYPE) {
+        raiseError("Error: Can't apply this type as a procedure.");
+    }
+    COUNT(applies);
+    // A procedure call is a safe point to answer SIGUSR1
+    if (statsRequested) {
+        dumpStats(stderr);
+    }
+    if (profiling) {
+        enterProcedure(function);
+        Value *result = function->type == PRIMITIVE_TYPE ?
+            function->pf(args) : apply(function, args);
+        leaveProcedure();
+        return result;
+    }
+    if (function->type == PRIMITIVE_TYPE) {
+        return function->pf(args);
+    }
+    return apply(function, args);
+}
+
 /*
  * Apply the given function closure to the given arguments args.
  */
 Value *apply(Value *function, Value *args) {
+    useFuel();
     Frame *f = newFrame(function->cl.frame);
     
     // Isolate list of bindings to make
-    Value *formalParams = function->cl.paramNames;
+    Value *formalParams = car(function->cl.code);
     Value *actualParams = args;
     // For each binding, add binding to frame f
     while (formalParams->type != NULL_TYPE) {
         // If actualParams is null, error (not enough actual params)
         if (actualParams->type == NULL_TYPE){
-            printf("Error: function given too few arguments. \n");
-            texit(EXIT_FAILURE);
+            raiseError("Error: function given too few arguments. ");
         }
         Value *curFormal = car(formalParams);
-        Value *curActual = car(actualParams);
-
-        // Let vali be the result of evaluating value in cur in parent frame.
-        Value *vali = eval(curActual, f->parent);
+        // The actual params have already been evaluated by the caller
+        Value *vali = car(actualParams);
         // Create new binding that includes the formal param and the corresponding actual param
         Value *binding = makeNull();
         binding = cons(vali, binding);
@@ -1354,44 +2989,34 @@ Value *apply(Value *function, Value *args) {
     }
     // If actualParams is not null, error (too many actual params)
     if (actualParams->type != NULL_TYPE){
-        printf("Error: function given too many arguments. \n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: function given too many arguments. ");
         }
 
-    //eval each statement in the function code
-    Value *commandList = function->cl.functionCode;
-    Value *cur = car(commandList);
-    while(cur->type != NULL_TYPE){
+    //eval each statement in the function code except the last one
+    Value *commandList = cdr(function->cl.code);
+    while(cdr(commandList)->type != NULL_TYPE){
+        Value *cur = car(commandList);
         //skip begin statements, since lambda already has an implicit begin statement
-        if(cur->type == CONS_TYPE && car(cur)->type == SYMBOL_TYPE && (!strcmp(car(cur)->s, "begin"))){
-            commandList = cdr(commandList);
-        }
-        else{
+        if(!(cur->type == CONS_TYPE && car(cur)->type == SYMBOL_TYPE && (!strcmp(car(cur)->s, "begin")))){
             eval(cur, f);
-            commandList = cdr(commandList);
-        }
-        if(commandList->type != NULL_TYPE){
-            cur = car(commandList);
-        }
-        else{
-            break;
         }
+        commandList = cdr(commandList);
     }
     
-    //get the last thing in the list of things that happen in the closure and return that
-    Value *lastCommand = car(reverse(function->cl.functionCode));
-    
-    return eval(lastCommand, f);
-    
+    //the last thing in the list of things that happen in the closure is the result
+    return eval(car(commandList), f);
+
 }
 
 /*
  * Looks up the value of a variable using current and parent frames.
  */
 Value *lookUpSymbol(Value *tree, Frame *frame){
+    COUNT(framesScanned);
     // Loop through all bindings in current frame
     Value *curBindings = frame->bindings;
     while (curBindings->type != NULL_TYPE) {
+        COUNT(bindingsScanned);
         // If we've found a match, return the result
         if(strcmp(tree->s, car(car(curBindings))->s) == 0){
             if (cdr(car(curBindings))->type == CONS_TYPE){
@@ -1405,12 +3030,9 @@ Value *lookUpSymbol(Value *tree, Frame *frame){
     }
     // Print error if variable is not bound in current or parent frames
     if(frame->parent == NULL){
-        printf("Error 404: variable not found: ");
-        display(tree);
-        printf("\n");
-        texit(EXIT_FAILURE); 
+        raiseError("Error 404: variable not found: %s", valueToString(tree));
     }
     // Recurse on parent frame
     return lookUpSymbol(tree, frame->parent);
     
-}
\ No newline at end of file
+}
@@ -1,4 +1,6 @@
 #include "value.h"
+#include "talloc.h"
+#include "sandbox.h"
 
 #ifndef _INTERPRETER
 #define _INTERPRETER
@@ -14,7 +16,44 @@ struct Frame {
 
 typedef struct Frame Frame;
 
-void interpret(Value *tree);
+// One interpreter instance: its own top-level frame, with the primitives
+// bound, and the talloc arena it allocates from. Instances share no Racket
+// values, so separate instances can run at the same time on different threads.
+// (Symbols are compared by name, so there is no symbol table to hold.)
+struct Interp {
+    Frame *topFrame;
+    Arena *heap;
+    // Message of the last error caught by the embedding API (see embed.h)
+    char *error;
+    // Limits for each run of a program in this instance (see sandbox.h)
+    Limits limits;
+};
+
+typedef struct Interp Interp;
+
+// Create an interpreter instance allocating from the current thread's arena.
+Interp *newInterp();
+
+// Evaluate each expression of a program at the top level of interp, and
+// print each result. If an expression raises an error that it doesn't handle,
+// the error is printed and the next expression runs, unless the error was for
+// going over one of interp's limits, which ends the run. Returns the number of
+// expressions that raised errors.
+int interpretIn(Interp *interp, Value *tree);
+
+// Evaluate each expression of a program in a new interpreter instance.
+// Returns the number of expressions that raised errors.
+int interpret(Value *tree);
 Value *eval(Value *expr, Frame *frame);
 
+// Call a closure or primitive function on a list of already evaluated
+// arguments. This lets primitives call back into Racket code.
+Value *applyProcedure(Value *function, Value *args);
+
+// Bind name to value in frame, as define would.
+void bindValue(char *name, Value *value, Frame *frame);
+
+// Create a new, empty frame whose parent is parent.
+Frame *newFrame(Frame *parent);
+
 #endif
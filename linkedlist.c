@@ -9,73 +9,180 @@
 #include <stdlib.h>
 #include <string.h>
 #include "talloc.h"
+#include "error.h"
+#include "hashtable.h"
+#include "hamt.h"
+#include "output.h"
 
-void displayHelper(Value *);
-void displayCons(Value *);
+void displayOn(Value *, Output *);
+void displayHelper(Value *, Output *);
+void pushBinding(Value *, Value *, void *);
 
 /*
  * Display the contents of the linked list to the screen
- * in some kind of readable format.
+ * in some kind of readable format. It goes to the current thread's
+ * buffered stdout (see output.h), which is flushed at the end of each
+ * top-level result.
  */
 void display(Value *list){
+    displayOn(list, standardOutput());
+}
+
+/*
+ * Display the contents of the linked list to out, the same way display does.
+ */
+void displayTo(Value *list, FILE *out){
+    if (out == stdout) {
+        display(list);
+        return;
+    }
+    char buffer[4096];
+    Output output;
+    openOutput(&output, out, buffer, sizeof(buffer));
+    displayOn(list, &output);
+    closeOutput(&output);
+}
+
+/*
+ * Display the contents of the linked list with the writer output.
+ */
+void displayOn(Value *list, Output *output){
     // Print ' at beginning if top level is null, cons, or symbol
     if (list->type == CONS_TYPE ||
         list->type == NULL_TYPE ||
-        list->type == SYMBOL_TYPE ) {
-        printf("'");
+        list->type == SYMBOL_TYPE ||
+        list->type == VECTOR_TYPE ||
+        list->type == HASH_TYPE ||
+        list->type == HAMT_TYPE ) {
+        writeChar(output, '\'');
         if(list->type == NULL_TYPE){
-            printf("()");
+            writeText(output, "()");
         }
     }
-    displayHelper(list);
+    displayHelper(list, output);
 }
 
-void displayCons(Value *list) {
-    Value *cur = list;
-    while (cur->type == CONS_TYPE) {
-        displayHelper(car(cur));
-        cur = cdr(cur);
-    }
-}
-    
-void displayHelper(Value *list) { 
-    Value *current = list;
+/*
+ * Display one value. Nested values are pushed on output's stack of work
+ * rather than displayed by recursing, so any depth of nesting can be
+ * displayed.
+ */
+void displayHelper(Value *list, Output *output) { 
+    int base = output->depth;
+    pushItem(output, list, NULL);
+    Item item;
+    while (popItem(output, base, &item)) {
+        if (item.text != NULL) {
+            writeText(output, item.text);
+            continue;
+        }
+        Value *current = item.value;
+        // Whatever current is made of is pushed in order, then reversed
+        int depth = output->depth;
         switch(current->type){
             case CONS_TYPE:
-                // Display parentheses and call displayCons to handle Cons Cells
-                printf("( ");
-                displayCons(current);
-                printf(") ");
+                // Display parentheses around the items of the list
+                writeText(output, "( ");
+                for (Value *cur = current; cur->type == CONS_TYPE; cur = cdr(cur)) {
+                    pushItem(output, car(cur), NULL);
+                }
+                pushItem(output, NULL, ") ");
                 break;
             case INT_TYPE:
-                printf("%i ", current->i);
+                writeLong(output, current->i);
+                writeChar(output, ' ');
                 break;
             case DOUBLE_TYPE:
-                printf("%f ", current->d);
+                writeDouble(output, current->d);
+                writeChar(output, ' ');
                 break;
             case STR_TYPE:
-                printf("\"%s\" ", current->s);
+                writeChar(output, '"');
+                writeText(output, current->s);
+                writeText(output, "\" ");
                 break;
             case PTR_TYPE:
-                printf("%p ", current->p);
+                writePointer(output, current->p);
+                writeChar(output, ' ');
                 break;
             case OPEN_TYPE:
-                printf("( ");
+                writeText(output, "( ");
                 break;
             case CLOSE_TYPE:
-                printf(") ");
+                writeText(output, ") ");
                 break;
             case SYMBOL_TYPE:
-                printf("%s ", current->s);
+                writeText(output, current->s);
+                writeChar(output, ' ');
                 break;
             case BOOL_TYPE:
-                printf("%s ", current->s);
+                writeText(output, current->s);
+                writeChar(output, ' ');
+                break;
+            case VECTOR_TYPE:
+                // Display #( and each item of the vector
+                writeText(output, "#( ");
+                for (int i = 0; i < current->v.size; i++) {
+                    pushItem(output, current->v.items[i], NULL);
+                }
+                pushItem(output, NULL, ") ");
+                break;
+            case FLVECTOR_TYPE:
+                writeText(output, "(flvector ");
+                for (int i = 0; i < current->fv.size; i++) {
+                    writeDouble(output, current->fv.items[i]);
+                    writeChar(output, ' ');
+                }
+                writeText(output, ") ");
+                break;
+            case HASH_TYPE:
+                // Display #hash( and each binding as ( key . value )
+                writeText(output, "#hash( ");
+                for (int i = 0; i < current->h->capacity; i++) {
+                    HashEntry *entry = &current->h->entries[i];
+                    if (entry->key != NULL && !entry->removed) {
+                        pushBinding(entry->key, entry->value, output);
+                    }
+                }
+                pushItem(output, NULL, ") ");
+                break;
+            case HAMT_TYPE:
+                writeText(output, "#hash( ");
+                hamtForEach(current->hm.root, pushBinding, output);
+                pushItem(output, NULL, ") ");
+                break;
+            case FUTURE_TYPE:
+                writeText(output, "#<future> ");
+                break;
+            case PLACE_TYPE:
+                writeText(output, "#<place> ");
+                break;
+            case CHANNEL_TYPE:
+                writeText(output, "#<place-channel> ");
+                break;
+            case ERROR_TYPE:
+                writeText(output, "#<exn:fail \"");
+                writeText(output, current->s);
+                writeText(output, "\"> ");
                 break;
             case CLOSURE_TYPE:
-                printf("#<procedure> ");
+                writeText(output, "#<procedure> ");
             default:
                 break;
         }
+        reversePushed(output, depth);
+    }
+}
+
+// Push one binding of a hash, to be displayed as ( key . value ), on the
+// stack of the Output in data
+void pushBinding(Value *key, Value *value, void *data) {
+    Output *output = data;
+    pushItem(output, NULL, "( ");
+    pushItem(output, key, NULL);
+    pushItem(output, NULL, ". ");
+    pushItem(output, value, NULL);
+    pushItem(output, NULL, ") ");
 }
 
 // Create a new NULL_TYPE value node.
@@ -89,28 +196,49 @@ Value *makeNull(){
 // Create a new CONS_TYPE value node.
 Value *cons(Value *car, Value *cdr){
     if (car == NULL || cdr == NULL) {
-        printf("Error: Cannot cons to null\n");
-        texit(EXIT_FAILURE);
+        raiseError("Error: Cannot cons to null");
     }
     Value *node;
-    node = talloc(sizeof(Value));
+    node = tallocKind(sizeof(Value), ALLOC_CONS);
     node->type = CONS_TYPE;
     node->c.car = car;
     node->c.cdr = cdr;
     return node;
 }
 
+// Create a list of count CONS_TYPE nodes stored contiguously in a single
+// allocation, so that walking it touches consecutive memory. The cars are
+// initialized to the empty list and should be filled in by the caller.
+Value *makeList(int count){
+    // One block holds every cons cell plus the terminating null
+    Value *cells = tallocKind(sizeof(Value) * (count + 1), ALLOC_CONS);
+    Value *end = &cells[count];
+    end->type = NULL_TYPE;
+    for (int i = 0; i < count; i++) {
+        cells[i].type = CONS_TYPE;
+        cells[i].c.car = end;
+        cells[i].c.cdr = &cells[i + 1];
+    }
+    return cells;
+}
+
 // Return a new list that is the reverse of the one that is passed in. No stored
 // data within the linked list should be duplicated; rather, a new linked list
 // of CONS_TYPE nodes should be created, that point to items in the original
 // list.
 Value *reverse(Value *list){
+    // Count the items first so the new list can be built in one block
+    int count = 0;
     Value *cur = list;
-    // Create new list
-    Value *new_list = makeNull();
     while (!isNull(cur)) {
-        // Create new cons cell with pointers to old values/nested lists
-        new_list = cons(car(cur), new_list);
+        count++;
+        cur = cdr(cur);
+    }
+    Value *new_list = makeList(count);
+    // Fill the new cells from the back with pointers to old values/nested lists
+    cur = list;
+    for (int i = count - 1; i >= 0; i--) {
+        new_list[i].c.car = car(cur);
         cur = cdr(cur);
     }
     return new_list;
@@ -137,8 +265,83 @@ bool isNull(Value *value){
 // operation.
 int length(Value *value){
     assert(value->type == CONS_TYPE || isNull(value));
-    if (isNull(value)) {
-        return 0;
+    int count = 0;
+    while (!isNull(value)) {
+        count++;
+        value = cdr(value);
     }
-    return length(cdr(value)) + 1;
-}
\ No newline at end of file
+    return count;
+}
+
+// Check whether two values are structurally equal, in the sense of Racket's
+// equal?. Numbers compare by value, so 2 and 2.0 are equal.
+bool isEqual(Value *a, Value *b){
+    // Walk down list spines iteratively, only recursing into the items
+    while (a->type == CONS_TYPE && b->type == CONS_TYPE) {
+        if (!isEqual(car(a), car(b))) {
+            return false;
+        }
+        a = cdr(a);
+        b = cdr(b);
+    }
+    if ((a->type == INT_TYPE || a->type == DOUBLE_TYPE) &&
+        (b->type == INT_TYPE || b->type == DOUBLE_TYPE)) {
+        double first = a->type == INT_TYPE ? a->i : a->d;
+        double second = b->type == INT_TYPE ? b->i : b->d;
+        return first == second;
+    }
+    if (a->type != b->type) {
+        return false;
+    }
+    switch (a->type) {
+        case STR_TYPE:
+            return !strcmp(a->s, b->s);
+        case VECTOR_TYPE:
+            if (a->v.size != b->v.size) {
+                return false;
+            }
+            for (int i = 0; i < a->v.size; i++) {
+                if (!isEqual(a->v.items[i], b->v.items[i])) {
+                    return false;
+                }
+            }
+            return true;
+        case FLVECTOR_TYPE:
+            if (a->fv.size != b->fv.size) {
+                return false;
+            }
+            for (int i = 0; i < a->fv.size; i++) {
+                if (a->fv.items[i] != b->fv.items[i]) {
+                    return false;
+                }
+            }
+            return true;
+        default:
+            return isEq(a, b);
+    }
+}
+
+// Check whether two values are the same object, in the sense of Racket's eq?.
+// Symbols are not interned, so symbols (and booleans) compare by name.
+bool isEq(Value *a, Value *b){
+    if (a == b) {
+        return true;
+    }
+    if (a->type != b->type) {
+        return false;
+    }
+    switch (a->type) {
+        case NULL_TYPE:
+        case VOID_TYPE:
+            return true;
+        case INT_TYPE:
+            return a->i == b->i;
+        case SYMBOL_TYPE:
+        case BOOL_TYPE:
+            return !strcmp(a->s, b->s);
+        case PRIMITIVE_TYPE:
+            return a->pf == b->pf;
+        default:
+            return false;
+    }
+}
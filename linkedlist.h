@@ -1,4 +1,5 @@
 #include <stdbool.h>
+#include <stdio.h>
 #include "value.h"
 
 #ifndef _LINKEDLIST
@@ -10,9 +11,17 @@ Value *makeNull();
 // Create a new CONS_TYPE value node.
 Value *cons(Value *car, Value *cdr);
 
+// Create a list of count CONS_TYPE nodes stored contiguously in a single
+// allocation, so that walking it touches consecutive memory. The cars are
+// initialized to the empty list and should be filled in by the caller.
+Value *makeList(int count);
+
 // Display the contents of the linked list to the screen in some kind of readable format
 void display(Value *list);
 
+// Display the contents of the linked list to out, the same way display does.
+void displayTo(Value *list, FILE *out);
+
 // Return a new list that is the reverse of the one that is passed in. No stored
 // data within the linked list should be duplicated; rather, a new linked list
 // of CONS_TYPE nodes should be created, that point to items in the original
@@ -35,5 +44,12 @@ bool isNull(Value *value);
 // operation.
 int length(Value *value);
 
+// Check whether two values are structurally equal, in the sense of Racket's
+// equal?. Numbers compare by value, so 2 and 2.0 are equal.
+bool isEqual(Value *a, Value *b);
+
+// Check whether two values are the same object, in the sense of Racket's eq?.
+// Symbols are not interned, so symbols (and booleans) compare by name.
+bool isEq(Value *a, Value *b);
 
 #endif
@@ -1,17 +1,161 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "tokenizer.h"
 #include "value.h"
 #include "linkedlist.h"
 #include "parser.h"
 #include "talloc.h"
 #include "interpreter.h"
+#include "future.h"
+#include "toplevel.h"
+#include "server.h"
+#include "sandbox.h"
+#include "profile.h"
+#include "stats.h"
+#include "heapprofile.h"
+#include "hwcounters.h"
 
-int main() {
+int main(int argc, char *argv[]) {
+    bool parallel = false;
+    bool allocStats = false;
+    bool showStats = false;
+    bool profile = false;
+    char *samplePath = NULL;
+    bool heapProfile = false;
+    bool hwCounters = false;
+    char *heapStacksPath = NULL;
+    char *socketPath = NULL;
+    char *prelude = NULL;
+    int workers = 0;
+    Limits limits = {0, 0, 0};
 
-    Value *list = tokenize(stdin);
-    Value *tree = parse(list);
-    interpret(tree);
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--deterministic")) {
+            // Run futures and parallel primitives on one thread, in order
+            setDeterministic(true);
+        } else if (!strcmp(argv[i], "--parallel-toplevel")) {
+            // Run independent top-level forms at the same time
+            parallel = true;
+        } else if (!strcmp(argv[i], "--profile")) {
+            // Count and time every procedure call, and report on stderr
+            profile = true;
+        } else if (!strcmp(argv[i], "--sample-profile") && i + 1 < argc) {
+            // Sample the procedures being run, and write folded stacks
+            samplePath = argv[++i];
+        } else if (!strcmp(argv[i], "--heap-profile")) {
+            // Record allocations by kind and site, and report on stderr
+            heapProfile = true;
+        } else if (!strcmp(argv[i], "--heap-stacks") && i + 1 < argc) {
+            // Sample the procedures that allocate, and write folded stacks
+            heapStacksPath = argv[++i];
+        } else if (!strcmp(argv[i], "--hwcounters")) {
+            // Read hardware counters around each top-level form
+            hwCounters = true;
+        } else if (!strcmp(argv[i], "--stats")) {
+            // Write statistics as JSON on stderr at the end
+            showStats = true;
+        } else if (!strcmp(argv[i], "--parse-chunk") && i + 1 < argc) {
+            // Read the program in pieces of about this many bytes, in
+            // parallel, however small it is
+            setParseChunkSize(atol(argv[++i]));
+        } else if (!strcmp(argv[i], "--alloc-stats")) {
+            // Report how much was allocated, on stderr, at the end
+            allocStats = true;
+        } else if (!strcmp(argv[i], "--serve") && i + 1 < argc) {
+            // Serve programs sent over a Unix domain socket
+            socketPath = argv[++i];
+        } else if (!strcmp(argv[i], "--prelude") && i + 1 < argc) {
+            prelude = argv[++i];
+        } else if (!strcmp(argv[i], "--workers") && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--fuel") && i + 1 < argc) {
+            // Limit how many evaluation steps the program may take
+            limits.fuel = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "--max-memory") && i + 1 < argc) {
+            // Limit how many bytes the program may allocate
+            limits.memory = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "--max-depth") && i + 1 < argc) {
+            // Limit how deeply the program may recurse
+            limits.depth = atoi(argv[++i]);
+        } else {
+            printf("Usage: %s [--deterministic] [--parallel-toplevel] [--profile] [--sample-profile file] [--heap-profile] [--heap-stacks file] [--hwcounters] [--stats] [--alloc-stats] [--parse-chunk bytes] [limits] < program\n", argv[0]);
+            printf("       %s --serve socket [--prelude file] [--workers n] [limits]\n", argv[0]);
+            printf("Limits: [--fuel steps] [--max-memory bytes] [--max-depth levels]\n");
+            return 1;
+        }
+    }
 
+    // Statistics can be asked for at any time with SIGUSR1
+    dumpStatsOnSignal();
+
+    if (socketPath != NULL) {
+        return serve(socketPath, prelude, workers, &limits);
+    }
+
+    if (profile) {
+        startProfiling();
+    }
+    if (samplePath != NULL) {
+        startSampling();
+    }
+    if (heapProfile || heapStacksPath != NULL) {
+        startHeapProfiling(heapStacksPath != NULL);
+    }
+    if (hwCounters) {
+        // Forms run at the same time can't be told apart
+        if (parallel) {
+            fprintf(stderr, "Hardware counters are not read with --parallel-toplevel\n");
+        } else {
+            startHwCounters();
+        }
+    }
+    Value *tree = parseFile(stdin);
+    Interp *interp = newInterp();
+    interp->limits = limits;
+    int errors;
+    if (parallel) {
+        errors = interpretParallel(interp, tree);
+    } else {
+        errors = interpretIn(interp, tree);
+    }
+
+    shutdownFutures();
+    if (profile) {
+        printProfile(stderr, interp->topFrame);
+    }
+    if (samplePath != NULL) {
+        FILE *out = fopen(samplePath, "w");
+        if (out == NULL) {
+            fprintf(stderr, "Error: can't write %s\n", samplePath);
+        } else {
+            writeSamples(out, interp->topFrame);
+            fclose(out);
+        }
+    }
+    if (hwCounters) {
+        printHwCounters(stderr);
+    }
+    if (heapProfile) {
+        printHeapProfile(stderr);
+    }
+    if (heapStacksPath != NULL) {
+        FILE *out = fopen(heapStacksPath, "w");
+        if (out == NULL) {
+            fprintf(stderr, "Error: can't write %s\n", heapStacksPath);
+        } else {
+            writeAllocationSamples(out, interp->topFrame);
+            fclose(out);
+        }
+    }
+    if (showStats) {
+        dumpStats(stderr);
+    }
+    if (allocStats) {
+        long allocations, bytes;
+        tallocStats(&allocations, &bytes);
+        fprintf(stderr, "allocations: %ld bytes: %ld\n", allocations, bytes);
+    }
     tfree();
-    return 0;
+    return errors > 0 ? 1 : 0;
 }
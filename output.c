@@ -0,0 +1,192 @@
+// output.c
+// A buffered writer for printing values.
+// part of the Racket Interpreter Project
+#include "output.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bytes each thread's stdout writer collects before writing them
+#define STANDARD_BUFFER_SIZE 65536
+#define INITIAL_STACK_SIZE 64
+// Room for the longest double %f prints, which has over 300 digits
+#define DOUBLE_SIZE 400
+// Doubles whose value in millionths is an integer below this are written by
+// hand. The product is then within a tiny fraction of the true value, so
+// rounding it to six places as %f does can't come out differently.
+#define EXACT_MILLIONTHS 1e12
+
+static __thread Output *localOutput = NULL;
+
+static void writeBytes(Output *, char *, size_t);
+
+/*
+ * The current thread's writer for stdout, made on first use.
+ */
+Output *standardOutput() {
+    if (localOutput == NULL) {
+        Output *output = malloc(sizeof(Output));
+        openOutput(output, stdout, malloc(STANDARD_BUFFER_SIZE), STANDARD_BUFFER_SIZE);
+        localOutput = output;
+    }
+    return localOutput;
+}
+
+/*
+ * Make output write to file, collecting text in buffer.
+ */
+void openOutput(Output *output, FILE *file, char *buffer, size_t size) {
+    output->file = file;
+    output->buffer = buffer;
+    output->used = 0;
+    output->size = size;
+    output->stack = NULL;
+    output->depth = 0;
+    output->stackSize = 0;
+}
+
+/*
+ * Flush output, and free its stack.
+ */
+void closeOutput(Output *output) {
+    flushOutput(output);
+    free(output->stack);
+    output->stack = NULL;
+    output->stackSize = 0;
+}
+
+/*
+ * Write everything collected so far to the file.
+ */
+void flushOutput(Output *output) {
+    if (output->used > 0) {
+        fwrite(output->buffer, 1, output->used, output->file);
+        output->used = 0;
+    }
+}
+
+/*
+ * Write length bytes of text, flushing whenever the buffer fills.
+ */
+static void writeBytes(Output *output, char *text, size_t length) {
+    while (length > 0) {
+        if (output->used == output->size) {
+            flushOutput(output);
+        }
+        size_t room = output->size - output->used;
+        size_t chunk = length < room ? length : room;
+        memcpy(output->buffer + output->used, text, chunk);
+        output->used += chunk;
+        text += chunk;
+        length -= chunk;
+    }
+}
+
+/*
+ * Write text.
+ */
+void writeText(Output *output, char *text) {
+    writeBytes(output, text, strlen(text));
+}
+
+/*
+ * Write one character.
+ */
+void writeChar(Output *output, char c) {
+    if (output->used == output->size) {
+        flushOutput(output);
+    }
+    output->buffer[output->used++] = c;
+}
+
+/*
+ * Write an integer in decimal.
+ */
+void writeLong(Output *output, long n) {
+    // Digits come out last first, so fill the buffer from its end
+    char digits[24];
+    int start = sizeof(digits);
+    // Negate as unsigned, so the most negative long works too
+    unsigned long magnitude = n < 0 ? -(unsigned long)n : (unsigned long)n;
+    do {
+        digits[--start] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (n < 0) {
+        digits[--start] = '-';
+    }
+    writeBytes(output, digits + start, sizeof(digits) - start);
+}
+
+/*
+ * Write a double as printf's %f would.
+ */
+void writeDouble(Output *output, double d) {
+    // Arithmetic gives doubles, so most are whole numbers; only write the
+    // rest with snprintf, which is slow
+    double millionths = d * 1e6;
+    if (fabs(millionths) < EXACT_MILLIONTHS && millionths == (long)millionths) {
+        long scaled = fabs(millionths);
+        // %f keeps the sign of -0.0
+        if (signbit(d)) {
+            writeChar(output, '-');
+        }
+        writeLong(output, scaled / 1000000);
+        char fraction[8] = ".000000";
+        long digits = scaled % 1000000;
+        for (int i = 6; i > 0; i--) {
+            fraction[i] = '0' + digits % 10;
+            digits /= 10;
+        }
+        writeBytes(output, fraction, 7);
+        return;
+    }
+    char text[DOUBLE_SIZE];
+    int length = snprintf(text, sizeof(text), "%f", d);
+    writeBytes(output, text, length);
+}
+
+/*
+ * Write a pointer as printf's %p would.
+ */
+void writePointer(Output *output, void *p) {
+    char text[32];
+    int length = snprintf(text, sizeof(text), "%p", p);
+    writeBytes(output, text, length);
+}
+
+/*
+ * Push a value, or text if it is not NULL, on output's stack of work.
+ */
+void pushItem(Output *output, Value *value, char *text) {
+    if (output->depth == output->stackSize) {
+        output->stackSize = output->stackSize > 0 ? output->stackSize * 2 : INITIAL_STACK_SIZE;
+        output->stack = realloc(output->stack, sizeof(Item) * output->stackSize);
+    }
+    output->stack[output->depth].value = value;
+    output->stack[output->depth].text = text;
+    output->depth++;
+}
+
+/*
+ * Reverse the items pushed since the stack was depth deep.
+ */
+void reversePushed(Output *output, int depth) {
+    for (int i = depth, j = output->depth - 1; i < j; i++, j--) {
+        Item item = output->stack[i];
+        output->stack[i] = output->stack[j];
+        output->stack[j] = item;
+    }
+}
+
+/*
+ * Pop the top item of the stack into item, unless the stack is only depth
+ * deep. Returns whether there was one.
+ */
+bool popItem(Output *output, int depth, Item *item) {
+    if (output->depth <= depth) {
+        return false;
+    }
+    *item = output->stack[--output->depth];
+    return true;
+}
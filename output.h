@@ -0,0 +1,78 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include "value.h"
+
+#ifndef _OUTPUT
+#define _OUTPUT
+
+// A buffered writer for printing values. Text collects in a buffer, and is
+// written to the FILE in one go when the writer is flushed or the buffer is
+// full, so printing a large value costs a few fwrites instead of a printf
+// per atom. Integers are formatted by hand.
+//
+// Writers also keep a stack of work for printing nested values without
+// recursion, so values nested arbitrarily deep can be printed: a value is
+// printed by pushing what it is made of, and popping until the stack is back
+// where it was.
+//
+// Each thread has a writer of its own for stdout. It is flushed at the end of
+// each top-level result, and before an error ends the program.
+
+struct Item {
+    Value *value;
+    // Text to write instead, if not NULL
+    char *text;
+};
+typedef struct Item Item;
+
+struct Output {
+    FILE *file;
+    char *buffer;
+    size_t used;
+    size_t size;
+    Item *stack;
+    int depth;
+    int stackSize;
+};
+typedef struct Output Output;
+
+// The current thread's writer for stdout.
+Output *standardOutput();
+
+// Make output write to file, collecting text in buffer, which holds size
+// bytes. The buffer may be on the caller's stack.
+void openOutput(Output *output, FILE *file, char *buffer, size_t size);
+
+// Flush output, and free its stack.
+void closeOutput(Output *output);
+
+// Write everything collected so far to the file.
+void flushOutput(Output *output);
+
+// Write text.
+void writeText(Output *output, char *text);
+
+// Write one character.
+void writeChar(Output *output, char c);
+
+// Write an integer in decimal.
+void writeLong(Output *output, long n);
+
+// Write a double as printf's %f would.
+void writeDouble(Output *output, double d);
+
+// Write a pointer as printf's %p would.
+void writePointer(Output *output, void *p);
+
+// Push a value, or text if it is not NULL, on output's stack of work.
+void pushItem(Output *output, Value *value, char *text);
+
+// Reverse the items pushed since the stack was depth deep, so that items
+// pushed in the order they should be written are popped in that order.
+void reversePushed(Output *output, int depth);
+
+// Pop the top item of the stack into item, unless the stack is only depth
+// deep. Returns whether there was one.
+bool popItem(Output *output, int depth, Item *item);
+
+#endif
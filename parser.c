@@ -2,14 +2,43 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "linkedlist.h"
 #include "tokenizer.h"
 #include "parser.h"
 #include "talloc.h"
+#include "error.h"
+#include "future.h"
+#include "output.h"
+
+// Programs smaller than this are read on one thread
+#define PARALLEL_PARSE_THRESHOLD (1 << 20)
+// Aim for this many pieces per worker, so uneven pieces balance out
+#define CHUNKS_PER_WORKER 4
+#define MIN_CHUNK_BYTES (1 << 18)
+
+// One piece of a program: its text, the line it starts on, and once it has
+// been read, its parse tree or syntax error
+struct Chunk {
+    char *start;
+    size_t size;
+    int firstLine;
+    Value *tree;
+    char *error;
+};
+typedef struct Chunk Chunk;
 
 Value *addToParseTree(Value*, int*, Value*);
-void printValue(Value*);
+void printValue(Value*, Output*);
+void pushSubtrees(Output*, Value*);
+char *readAll(FILE*, size_t*);
+Chunk *splitProgram(char*, size_t, size_t, int*);
+void parseChunk(void*);
+
+// If not 0, the size of the pieces every program is split into, however
+// small, so the parallel path can be tested
+static size_t chunkBytes = 0;
 
 // Takes a list of tokens from a Racket program, and returns a pointer to a
 // parse tree representing that program.
@@ -25,8 +54,7 @@ Value *parse(Value *tokens){
         current = cdr(current);
     }
     if (depth != 0) {
-        printf("Syntax error: not enough close parentheses.\n");
-        texit(EXIT_FAILURE);
+        raiseError("Syntax error: not enough close parentheses.");
     }
     //tree is backwards at this point, so reverse here
     tree = reverse(tree);
@@ -36,65 +64,82 @@ Value *parse(Value *tokens){
 
 // Prints the tree to the screen in a readable fashion. It should look just like
 // Racket code; use parentheses to indicate subtrees.
+// Subtrees are pushed on the writer's stack of work (see output.h) rather than
+// printed by recursing, so trees of any depth can be printed.
 void printTree(Value *tree){
-    if (tree->type == NULL_TYPE) {
-        return;
-    }
-    //if the current head of tree is a cons type, then go to its car
-    else if (tree->type == CONS_TYPE) {
-        //if the car is a cons type as well, enclose it in parentheses and recurse 
-        if (car(tree)->type == CONS_TYPE) {
-            printf("(");
-            printTree(car(tree));
-            printf(")");
-            //adds a space after the end of a subtree (for formatting reasons)
-            if (cdr(tree)->type != NULL_TYPE){
-                printf(" ");
-            }
-            //recurse on the rest of the tree
-            printTree(cdr(tree));
+    Output *output = standardOutput();
+    int base = output->depth;
+    //the top level's items are printed without parentheses around them
+    if (tree->type == CONS_TYPE) {
+        pushSubtrees(output, tree);
+    } else {
+        pushItem(output, tree, NULL);
+    }
+    Item item;
+    while (popItem(output, base, &item)) {
+        if (item.text != NULL) {
+            writeText(output, item.text);
         }
-        //if the car is not a cons type, print the car and recurse on the rest of the tree
-        else{
-            printTree(car(tree));
-            if (cdr(tree)->type != NULL_TYPE){
-                printf(" ");
-            }
-            printTree(cdr(tree));
+        //a subtree is enclosed in parentheses
+        else if (item.value->type == CONS_TYPE) {
+            writeChar(output, '(');
+            //pushed first, so the ) is printed after the subtrees
+            pushItem(output, NULL, ")");
+            pushSubtrees(output, item.value);
+        }
+        else {
+            printValue(item.value, output);
         }
-    } 
-    //if the current head is not a cons type, print it
-    else {
-        printValue(tree);
-        return;
     }
+    flushOutput(output);
+}
+
+//push the items of tree on output's stack, to be printed in order with a
+//space between each
+void pushSubtrees(Output *output, Value *tree) {
+    int depth = output->depth;
+    Value *cur = tree;
+    while (cur->type == CONS_TYPE) {
+        pushItem(output, car(cur), NULL);
+        if (cdr(cur)->type != NULL_TYPE) {
+            pushItem(output, NULL, " ");
+        }
+        cur = cdr(cur);
+    }
+    //the end of a list that isn't proper
+    if (cur->type != NULL_TYPE) {
+        pushItem(output, cur, NULL);
+    }
+    reversePushed(output, depth);
 }
 
 //print a non cons-type value based on its type
-void printValue(Value *val) {
+void printValue(Value *val, Output *output) {
     switch(val->type){
             case NULL_TYPE:
                 break;
             case CONS_TYPE:
                 break;
             case INT_TYPE:
-                printf("%i", val->i);
+                writeLong(output, val->i);
                 break;
             case DOUBLE_TYPE:
-                printf("%f", val->d);
+                writeDouble(output, val->d);
                 break;
             case STR_TYPE:
-                printf("\"%s\"", val->s);
+                writeChar(output, '"');
+                writeText(output, val->s);
+                writeChar(output, '"');
                 break;
             case BOOL_TYPE:
-                printf("%s", val->s);
+                writeText(output, val->s);
                 break;
             case OPEN_TYPE:
                 break;
             case CLOSE_TYPE:
                 break;
             case SYMBOL_TYPE:
-                printf("%s", val->s);
+                writeText(output, val->s);
                 break;
             case PTR_TYPE:
                 break;
@@ -120,24 +165,197 @@ Value *addToParseTree(Value *tree, int *depth, Value *token) {
     else {
         //check that there aren't too many close parens
         if (*depth == 0){
-            printf("Syntax error: too many close parentheses. \n");
-            texit(EXIT_FAILURE);
+            raiseError("Syntax error: too many close parentheses. ");
         }
         // if token type is close type
-        //make a new list
-        Value *subtree = makeNull();
-        Value *cur = car(tree);
-        tree = cdr(tree);
-        //while the current token isn't a open paren, keep going, adding the
-        //current token to the subtree and removing from original tree
-        while (cur->type != OPEN_TYPE) {
-            subtree = cons(cur, subtree);
-            cur = car(tree);
+        //count how many items there are back to the matching open paren
+        int count = 0;
+        Value *scan = tree;
+        while (car(scan)->type != OPEN_TYPE) {
+            count++;
+            scan = cdr(scan);
+        }
+        //make a new contiguous list and fill it from the back, removing
+        //each token from the original tree as we go
+        Value *subtree = makeList(count);
+        for (int i = count - 1; i >= 0; i--) {
+            subtree[i].c.car = car(tree);
             tree = cdr(tree);
         }
+        //drop the open paren
+        tree = cdr(tree);
         //add the subtree to the original tree and decrement depth
         tree = cons(subtree, tree);
         *depth = *depth - 1;
     }
     return tree;
 }
+
+// Reads a whole Racket program from in, and returns its parse tree. Large
+// programs are split between top-level forms and the pieces are tokenized and
+// parsed in parallel; syntax errors still give their line in the whole input.
+Value *parseFile(FILE *in) {
+    size_t size;
+    char *text = readAll(in, &size);
+    if (size == 0) {
+        free(text);
+        return makeNull();
+    }
+
+    // Find where to split, and how many lines come before each piece
+    int chunkCount = 1;
+    Chunk *chunks = NULL;
+    size_t target = chunkBytes;
+    if (target == 0 && size >= PARALLEL_PARSE_THRESHOLD && futureWorkers() > 1) {
+        target = size / (futureWorkers() * CHUNKS_PER_WORKER);
+        if (target < MIN_CHUNK_BYTES) {
+            target = MIN_CHUNK_BYTES;
+        }
+    }
+    if (target > 0) {
+        chunks = splitProgram(text, size, target, &chunkCount);
+    }
+    if (chunks == NULL) {
+        chunkCount = 1;
+        chunks = talloc(sizeof(Chunk));
+        chunks[0].start = text;
+        chunks[0].size = size;
+        chunks[0].firstLine = 1;
+    }
+
+    // Handle each piece on the thread pool, this thread doing the last one
+    Task **tasks = talloc(sizeof(Task *) * chunkCount);
+    for (int i = 0; i < chunkCount - 1; i++) {
+        tasks[i] = spawnTask(parseChunk, &chunks[i]);
+    }
+    parseChunk(&chunks[chunkCount - 1]);
+    joinTasks(tasks, chunkCount - 1);
+    free(text);
+
+    // Report the first error in the program, then join the pieces in order
+    int count = 0;
+    for (int i = 0; i < chunkCount; i++) {
+        if (chunks[i].tree == NULL) {
+            raiseError("%s", chunks[i].error);
+        }
+        count += length(chunks[i].tree);
+    }
+    if (chunkCount == 1) {
+        return chunks[0].tree;
+    }
+    Value *tree = makeList(count);
+    int next = 0;
+    for (int i = 0; i < chunkCount; i++) {
+        for (Value *cur = chunks[i].tree; cur->type != NULL_TYPE; cur = cdr(cur)) {
+            tree[next++].c.car = car(cur);
+        }
+    }
+    return tree;
+}
+
+// Makes parseFile split every program into pieces of about bytes each, or
+// only large ones again if bytes is 0.
+void setParseChunkSize(size_t bytes) {
+    chunkBytes = bytes;
+}
+
+// Reads all of in into a malloc'd buffer, and sets *size to its length.
+char *readAll(FILE *in, size_t *size) {
+    size_t capacity = 1 << 16;
+    char *text = malloc(capacity);
+    *size = 0;
+    size_t got;
+    while ((got = fread(text + *size, 1, capacity - *size, in)) > 0) {
+        *size += got;
+        if (*size == capacity) {
+            capacity *= 2;
+            text = realloc(text, capacity);
+        }
+    }
+    return text;
+}
+
+// Splits a program into pieces of about target bytes, each ending just after
+// a close paren that ends a top-level form. Strings and comments are skipped
+// the way the tokenizer skips them. Returns NULL if the parens don't balance,
+// so that parse can report the problem as usual.
+Chunk *splitProgram(char *text, size_t size, size_t target, int *chunkCount) {
+    int capacity = size / target + 2;
+    Chunk *chunks = talloc(sizeof(Chunk) * capacity);
+    int count = 0;
+    int depth = 0;
+    int line = 1;
+    size_t start = 0;
+    int startLine = 1;
+    size_t i = 0;
+    while (i < size) {
+        char c = text[i];
+        if (c == '\n') {
+            line++;
+        } else if (c == ';') {
+            // comment: up to the end of the line
+            while (i + 1 < size && text[i + 1] != '\n') {
+                i++;
+            }
+        } else if (c == '\"') {
+            // string: up to an unescaped quote
+            i++;
+            while (i < size && text[i] != '\"') {
+                if (text[i] == '\n') {
+                    line++;
+                }
+                if (text[i] == '\\' && i + 1 < size && text[i + 1] == '\"') {
+                    i++;
+                }
+                i++;
+            }
+            if (i >= size) {
+                return NULL;
+            }
+        } else if (c == '(') {
+            depth++;
+        } else if (c == ')') {
+            depth--;
+            if (depth < 0) {
+                return NULL;
+            }
+            if (depth == 0 && i + 1 - start >= target && count < capacity - 1) {
+                chunks[count].start = text + start;
+                chunks[count].size = i + 1 - start;
+                chunks[count].firstLine = startLine;
+                count++;
+                start = i + 1;
+                startLine = line;
+            }
+        }
+        i++;
+    }
+    if (depth != 0) {
+        return NULL;
+    }
+    if (start < size) {
+        chunks[count].start = text + start;
+        chunks[count].size = size - start;
+        chunks[count].firstLine = startLine;
+        count++;
+    }
+    *chunkCount = count;
+    return chunks;
+}
+
+// Tokenizes and parses one piece of a program, leaving either its tree or
+// its error message in the chunk.
+void parseChunk(void *data) {
+    Chunk *chunk = data;
+    chunk->tree = NULL;
+    chunk->error = NULL;
+    FILE *in = fmemopen(chunk->start, chunk->size, "r");
+    if (in == NULL) {
+        raiseError("Error: could not read the program.");
+    }
+    Value *tokens = tokenizeFile(in, chunk->firstLine, &chunk->error);
+    fclose(in);
+    if (tokens != NULL) {
+        chunk->tree = parse(tokens);
+    }
+}
@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include "value.h"
 
 #ifndef _PARSER
@@ -7,6 +8,16 @@
 // parse tree representing that program.
 Value *parse(Value *tokens);
 
+// Reads a whole Racket program from in, and returns its parse tree. Large
+// programs are split between top-level forms and the pieces are tokenized and
+// parsed in parallel; syntax errors still give their line in the whole input.
+Value *parseFile(FILE *in);
+
+// Make parseFile split every program into pieces of about bytes each, however
+// small the program, or only large programs again if bytes is 0. This is for
+// testing the parallel path on small inputs.
+void setParseChunkSize(size_t bytes);
+
 
 // Prints the tree to the screen in a readable fashion. It should look just like
 // Racket code; use parentheses to indicate subtrees.
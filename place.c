@@ -0,0 +1,622 @@
+// place.c
+// Places: isolated interpreter instances on their own threads, connected by
+// bounded lock-free message channels.
+// part of the Racket Interpreter Project
+#include "place.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "interpreter.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "error.h"
+#include "future.h"
+
+#define CHANNEL_CAPACITY 1024
+#define PLACE_STACK_SIZE (256 * 1024 * 1024)
+
+// One slot of a queue. sequence says whose turn the slot is: it equals the
+// position when the slot is free to write, and the position + 1 once it holds
+// a message ready to read.
+struct Cell {
+    size_t sequence;
+    char *message;
+};
+typedef struct Cell Cell;
+
+// A bounded queue of encoded messages that any number of threads may put to
+// and get from without locks (Vyukov's bounded MPMC queue).
+struct Queue {
+    Cell cells[CHANNEL_CAPACITY];
+    size_t putPosition;
+    size_t getPosition;
+};
+typedef struct Queue Queue;
+
+// One end of a place channel: where messages come in and where they go out,
+// and the link that holds them.
+struct Channel {
+    Queue *in;
+    Queue *out;
+    struct Link *link;
+};
+typedef struct Channel Channel;
+
+// The two queues of a place's channel. The creator, the place, and whoever
+// was sent the channel in a message may finish in any order, so they are
+// malloc'd and counted, and freed by whichever lets go of them last.
+struct Link {
+    Queue toPlace;
+    Queue fromPlace;
+    int references;
+};
+typedef struct Link Link;
+
+// A running place and the creator's end of its channel. It is malloc'd, so
+// that the list of places stays good even after its creator's arena is gone.
+struct Place {
+    pthread_t thread;
+    Channel channel;
+    int joined;
+    // The arena of whoever started it, and the next place in places
+    Arena *owner;
+    struct Place *next;
+};
+typedef struct Place Place;
+
+// A channel that an arena holds because it was received in a message.
+struct Hold {
+    Link *link;
+    Arena *owner;
+    struct Hold *next;
+};
+typedef struct Hold Hold;
+
+// Every place whose creator hasn't let go of it, and every channel held by
+// an arena that hasn't, guarded by placesLock
+static Place *places = NULL;
+static Hold *holds = NULL;
+static pthread_mutex_t placesLock = PTHREAD_MUTEX_INITIALIZER;
+
+// What a new place's thread needs to get going.
+struct PlaceStart {
+    char *name;
+    char *body;
+    Channel channel;
+    // A share of the creator's run
+    Budget budget;
+};
+typedef struct PlaceStart PlaceStart;
+
+// A growable buffer holding an encoded message.
+struct Buffer {
+    char *data;
+    size_t size;
+    size_t capacity;
+};
+typedef struct Buffer Buffer;
+
+void *runPlace(void *);
+void holdLink(Link *);
+void releaseLink(Link *);
+void initQueue(Queue *);
+int tryPut(Queue *, char *);
+char *tryGet(Queue *);
+void backOff(int);
+Channel *channelArg(Value *, char *);
+char *encodeMessage(Value *, char *);
+void checkSendable(Value *, char *);
+void encodeValue(Buffer *, Value *, char *);
+void writeBytes(Buffer *, void *, size_t);
+Value *decodeValue(char **);
+void readBytes(char **, void *, size_t);
+
+// Start a place running the expressions in body, with channelName bound to its
+// end of a channel back to the creator. Returns the place descriptor, which
+// is the creator's end of that channel.
+Value *startPlace(Value *channelName, Value *body){
+    // Encode first, so nothing needs freeing if the body can't be sent
+    char *encoded = encodeMessage(body, "place");
+    Link *link = malloc(sizeof(Link));
+    initQueue(&link->toPlace);
+    initQueue(&link->fromPlace);
+    link->references = 2;
+
+    // The place's end reads what the creator writes and vice versa
+    PlaceStart *start = malloc(sizeof(PlaceStart));
+    start->channel.in = &link->toPlace;
+    start->channel.out = &link->fromPlace;
+    start->channel.link = link;
+    start->name = strdup(channelName->s);
+    // Even the code is copied, so the place shares nothing with its creator
+    start->body = encoded;
+    start->budget = shareBudget();
+
+    Place *place = malloc(sizeof(Place));
+    place->channel.in = &link->fromPlace;
+    place->channel.out = &link->toPlace;
+    place->channel.link = link;
+    place->joined = 0;
+    place->owner = currentArena();
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, PLACE_STACK_SIZE);
+    int failed = pthread_create(&place->thread, &attr, runPlace, start);
+    pthread_attr_destroy(&attr);
+    if (failed) {
+        releaseBudget(start->budget);
+        free(start->body);
+        free(start->name);
+        free(start);
+        free(place);
+        free(link);
+        raiseError("Error: could not start a place.");
+    }
+    pthread_mutex_lock(&placesLock);
+    place->next = places;
+    places = place;
+    pthread_mutex_unlock(&placesLock);
+
+    Value *value = talloc(sizeof(Value));
+    value->type = PLACE_TYPE;
+    value->p = place;
+    return value;
+}
+
+// Wait for a place to finish, returning its exit code (always 0).
+Value *waitForPlace(Value *value){
+    if (value->type != PLACE_TYPE) {
+        raiseError("Error: place-wait expects a place.");
+    }
+    Place *place = value->p;
+    pthread_mutex_lock(&placesLock);
+    int joined = place->joined;
+    place->joined = 1;
+    pthread_mutex_unlock(&placesLock);
+    if (!joined) {
+        pthread_join(place->thread, NULL);
+    }
+    Value *result = talloc(sizeof(Value));
+    result->type = INT_TYPE;
+    result->i = 0;
+    return result;
+}
+
+// Let go of the places started while allocating from arena, and of the
+// channels received into it, as they are about to be freed with it. Places
+// still running carry on, and free their channel when they finish.
+void releasePlaces(Arena *arena){
+    pthread_mutex_lock(&placesLock);
+    Place **place = &places;
+    while (*place != NULL) {
+        Place *released = *place;
+        if (released->owner != arena) {
+            place = &released->next;
+            continue;
+        }
+        *place = released->next;
+        if (!released->joined) {
+            pthread_detach(released->thread);
+        }
+        releaseLink(released->channel.link);
+        free(released);
+    }
+    Hold **hold = &holds;
+    while (*hold != NULL) {
+        Hold *released = *hold;
+        if (released->owner != arena) {
+            hold = &released->next;
+            continue;
+        }
+        *hold = released->next;
+        releaseLink(released->link);
+        free(released);
+    }
+    pthread_mutex_unlock(&placesLock);
+}
+
+// Send a deep copy of message over a place channel (or a place descriptor).
+// Blocks while the channel is full.
+void channelPut(Value *channel, Value *message){
+    Queue *queue = channelArg(channel, "place-channel-put")->out;
+    char *encoded = encodeMessage(message, "place-channel-put");
+    for (int tries = 0; !tryPut(queue, encoded); tries++) {
+        backOff(tries);
+    }
+}
+
+// Receive the next message from a place channel (or a place descriptor).
+// Blocks while the channel is empty.
+Value *channelGet(Value *channel){
+    Queue *queue = channelArg(channel, "place-channel-get")->in;
+    char *encoded;
+    for (int tries = 0; (encoded = tryGet(queue)) == NULL; tries++) {
+        backOff(tries);
+    }
+    // Copy the message into this place's own memory
+    char *cur = encoded;
+    Value *message = decodeValue(&cur);
+    free(encoded);
+    return message;
+}
+
+/*
+ * Body of a place's thread: make a fresh interpreter with its own arena,
+ * evaluate the body in it, then throw the whole arena away.
+ */
+void *runPlace(void *data){
+    PlaceStart *start = data;
+    Budget budget = start->budget;
+    Budget previous = useBudget(budget);
+    Arena *heap = newArena();
+    useArena(heap);
+    Interp *interp = newInterp();
+
+    Value *channel = talloc(sizeof(Value));
+    channel->type = CHANNEL_TYPE;
+    channel->p = talloc(sizeof(Channel));
+    *(Channel *)channel->p = start->channel;
+    Link *link = start->channel.link;
+    char *name = talloc(strlen(start->name) + 1);
+    strcpy(name, start->name);
+    bindValue(name, channel, interp->topFrame);
+
+    char *cur = start->body;
+    Value *body = decodeValue(&cur);
+    free(start->body);
+    free(start->name);
+    free(start);
+
+    // An error ends the place, but not the program
+    ErrorTrap trap;
+    pushErrorTrap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        while (body->type != NULL_TYPE) {
+            eval(car(body), interp->topFrame);
+            body = cdr(body);
+        }
+        popErrorTrap(&trap);
+    } else {
+        printf("%s\n", errorMessage(trap.raised));
+    }
+    releasePlaces(heap);
+    releaseTasks(heap);
+    releaseLink(link);
+    useBudget(previous);
+    releaseBudget(budget);
+    useArena(NULL);
+    freeArena(heap);
+    return NULL;
+}
+
+/*
+ * Keep hold of a channel received in a message until the current arena is
+ * released, taking over the reference the message had to it.
+ */
+void holdLink(Link *link){
+    Arena *arena = currentArena();
+    pthread_mutex_lock(&placesLock);
+    for (Hold *hold = holds; hold != NULL; hold = hold->next) {
+        if (hold->link == link && hold->owner == arena) {
+            // Already held, so the message's reference isn't needed
+            releaseLink(link);
+            pthread_mutex_unlock(&placesLock);
+            return;
+        }
+    }
+    Hold *hold = malloc(sizeof(Hold));
+    hold->link = link;
+    hold->owner = arena;
+    hold->next = holds;
+    holds = hold;
+    pthread_mutex_unlock(&placesLock);
+}
+
+/*
+ * Let go of a place's channel, freeing it and any messages nobody got if
+ * nothing else holds it.
+ */
+void releaseLink(Link *link){
+    if (__atomic_sub_fetch(&link->references, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+    char *message;
+    while ((message = tryGet(&link->toPlace)) != NULL) {
+        free(message);
+    }
+    while ((message = tryGet(&link->fromPlace)) != NULL) {
+        free(message);
+    }
+    free(link);
+}
+
+/*
+ * Make a queue empty.
+ */
+void initQueue(Queue *queue){
+    for (size_t i = 0; i < CHANNEL_CAPACITY; i++) {
+        queue->cells[i].sequence = i;
+        queue->cells[i].message = NULL;
+    }
+    queue->putPosition = 0;
+    queue->getPosition = 0;
+}
+
+/*
+ * Put an encoded message in a queue. Returns 0 if the queue is full.
+ */
+int tryPut(Queue *queue, char *message){
+    size_t position = __atomic_load_n(&queue->putPosition, __ATOMIC_RELAXED);
+    Cell *cell;
+    while (1) {
+        cell = &queue->cells[position % CHANNEL_CAPACITY];
+        size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        long difference = (long)sequence - (long)position;
+        if (difference == 0) {
+            // The slot is free: try to claim this position
+            if (__atomic_compare_exchange_n(&queue->putPosition, &position, position + 1,
+                                            1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return 0;
+        } else {
+            position = __atomic_load_n(&queue->putPosition, __ATOMIC_RELAXED);
+        }
+    }
+    cell->message = message;
+    __atomic_store_n(&cell->sequence, position + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/*
+ * Take the oldest encoded message from a queue. Returns NULL if it is empty.
+ */
+char *tryGet(Queue *queue){
+    size_t position = __atomic_load_n(&queue->getPosition, __ATOMIC_RELAXED);
+    Cell *cell;
+    while (1) {
+        cell = &queue->cells[position % CHANNEL_CAPACITY];
+        size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        long difference = (long)sequence - (long)(position + 1);
+        if (difference == 0) {
+            // The slot holds a message: try to claim this position
+            if (__atomic_compare_exchange_n(&queue->getPosition, &position, position + 1,
+                                            1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return NULL;
+        } else {
+            position = __atomic_load_n(&queue->getPosition, __ATOMIC_RELAXED);
+        }
+    }
+    char *message = cell->message;
+    __atomic_store_n(&cell->sequence, position + CHANNEL_CAPACITY, __ATOMIC_RELEASE);
+    return message;
+}
+
+/*
+ * Wait a little before trying a full or empty queue again: spin at first,
+ * then yield, then sleep.
+ */
+void backOff(int tries){
+    if (tries < 64) {
+        return;
+    }
+    if (tries < 128) {
+        sched_yield();
+        return;
+    }
+    struct timespec pause = {0, 50000};
+    nanosleep(&pause, NULL);
+}
+
+/*
+ * Get the channel end of a place descriptor or place channel.
+ */
+Channel *channelArg(Value *value, char *name){
+    if (value->type == PLACE_TYPE) {
+        return &((Place *)value->p)->channel;
+    }
+    if (value->type != CHANNEL_TYPE) {
+        raiseError("Error: %s expects a place or place channel.", name);
+    }
+    return value->p;
+}
+
+/*
+ * Copy a value into a single block of malloc'd memory that belongs to no
+ * thread's arena, so it can be handed to another place.
+ */
+char *encodeMessage(Value *value, char *name){
+    // Check it all first, so an error can't leave a half-written buffer or
+    // channels held by a message that is never sent
+    checkSendable(value, name);
+    Buffer buffer;
+    buffer.capacity = 256;
+    buffer.size = 0;
+    buffer.data = malloc(buffer.capacity);
+    encodeValue(&buffer, value, name);
+    return buffer.data;
+}
+
+/*
+ * Raise an error unless a value, and everything in it, is of a type that can
+ * be sent to another place.
+ */
+void checkSendable(Value *value, char *name){
+    switch (value->type) {
+        case INT_TYPE:
+        case DOUBLE_TYPE:
+        case STR_TYPE:
+        case SYMBOL_TYPE:
+        case BOOL_TYPE:
+        case NULL_TYPE:
+        case VOID_TYPE:
+        case FLVECTOR_TYPE:
+        case CHANNEL_TYPE:
+        case PLACE_TYPE:
+            break;
+        case CONS_TYPE:
+            while (value->type == CONS_TYPE) {
+                checkSendable(car(value), name);
+                value = cdr(value);
+            }
+            checkSendable(value, name);
+            break;
+        case VECTOR_TYPE:
+            for (int i = 0; i < value->v.size; i++) {
+                checkSendable(value->v.items[i], name);
+            }
+            break;
+        default:
+            raiseError("Error: %s can't send this type.", name);
+    }
+}
+
+/*
+ * Append the encoding of a value to a buffer: its type, then its contents.
+ * The value must have passed checkSendable.
+ */
+void encodeValue(Buffer *buffer, Value *value, char *name){
+    valueType type = value->type;
+    // A place descriptor is sent as its end of the channel
+    if (type == PLACE_TYPE) {
+        type = CHANNEL_TYPE;
+    }
+    writeBytes(buffer, &type, sizeof(type));
+    switch (value->type) {
+        case INT_TYPE:
+            writeBytes(buffer, &value->i, sizeof(value->i));
+            break;
+        case DOUBLE_TYPE:
+            writeBytes(buffer, &value->d, sizeof(value->d));
+            break;
+        case STR_TYPE:
+        case SYMBOL_TYPE:
+        case BOOL_TYPE: {
+            int size = strlen(value->s) + 1;
+            writeBytes(buffer, &size, sizeof(size));
+            writeBytes(buffer, value->s, size);
+            break;
+        }
+        case NULL_TYPE:
+        case VOID_TYPE:
+            break;
+        case CONS_TYPE: {
+            // The items, then whatever ends the list
+            int count = 0;
+            for (Value *cur = value; cur->type == CONS_TYPE; cur = cdr(cur)) {
+                count++;
+            }
+            writeBytes(buffer, &count, sizeof(count));
+            while (value->type == CONS_TYPE) {
+                encodeValue(buffer, car(value), name);
+                value = cdr(value);
+            }
+            encodeValue(buffer, value, name);
+            break;
+        }
+        case VECTOR_TYPE:
+            writeBytes(buffer, &value->v.size, sizeof(value->v.size));
+            for (int i = 0; i < value->v.size; i++) {
+                encodeValue(buffer, value->v.items[i], name);
+            }
+            break;
+        case FLVECTOR_TYPE:
+            writeBytes(buffer, &value->fv.size, sizeof(value->fv.size));
+            writeBytes(buffer, value->fv.items, sizeof(double) * value->fv.size);
+            break;
+        case CHANNEL_TYPE:
+        case PLACE_TYPE: {
+            // Channels are shared, so only where its queues are is sent. The
+            // message holds the channel until it is received.
+            Channel *channel = channelArg(value, name);
+            __atomic_add_fetch(&channel->link->references, 1, __ATOMIC_RELAXED);
+            writeBytes(buffer, channel, sizeof(Channel));
+            break;
+        }
+        default:
+            raiseError("Error: %s can't send this type.", name);
+    }
+}
+
+/*
+ * Append size bytes to a buffer, growing it if needed.
+ */
+void writeBytes(Buffer *buffer, void *bytes, size_t size){
+    while (buffer->size + size > buffer->capacity) {
+        buffer->capacity *= 2;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+    memcpy(buffer->data + buffer->size, bytes, size);
+    buffer->size += size;
+}
+
+/*
+ * Rebuild a value from its encoding at *cur, allocating it with talloc, and
+ * move *cur past it.
+ */
+Value *decodeValue(char **cur){
+    Value *value = talloc(sizeof(Value));
+    readBytes(cur, &value->type, sizeof(value->type));
+    switch (value->type) {
+        case INT_TYPE:
+            readBytes(cur, &value->i, sizeof(value->i));
+            break;
+        case DOUBLE_TYPE:
+            readBytes(cur, &value->d, sizeof(value->d));
+            break;
+        case STR_TYPE:
+        case SYMBOL_TYPE:
+        case BOOL_TYPE: {
+            int size;
+            readBytes(cur, &size, sizeof(size));
+            value->s = talloc(size);
+            readBytes(cur, value->s, size);
+            break;
+        }
+        case CONS_TYPE: {
+            int count;
+            readBytes(cur, &count, sizeof(count));
+            Value *list = makeList(count);
+            for (int i = 0; i < count; i++) {
+                list[i].c.car = decodeValue(cur);
+            }
+            list[count - 1].c.cdr = decodeValue(cur);
+            return list;
+        }
+        case VECTOR_TYPE:
+            readBytes(cur, &value->v.size, sizeof(value->v.size));
+            value->v.items = talloc(sizeof(Value *) * value->v.size);
+            for (int i = 0; i < value->v.size; i++) {
+                value->v.items[i] = decodeValue(cur);
+            }
+            break;
+        case FLVECTOR_TYPE:
+            readBytes(cur, &value->fv.size, sizeof(value->fv.size));
+            value->fv.items = talloc(sizeof(double) * value->fv.size);
+            readBytes(cur, value->fv.items, sizeof(double) * value->fv.size);
+            break;
+        case CHANNEL_TYPE:
+            value->p = talloc(sizeof(Channel));
+            readBytes(cur, value->p, sizeof(Channel));
+            holdLink(((Channel *)value->p)->link);
+            break;
+        default:
+            break;
+    }
+    return value;
+}
+
+/*
+ * Copy size bytes out of an encoding and move past them.
+ */
+void readBytes(char **cur, void *bytes, size_t size){
+    memcpy(bytes, *cur, size);
+    *cur += size;
+}
@@ -0,0 +1,41 @@
+#include "value.h"
+#include "talloc.h"
+
+#ifndef _PLACE
+#define _PLACE
+
+// Places are separate interpreter instances, each running on its own thread
+// with its own top-level frame and its own talloc arena. They share nothing:
+// they talk only through place channels, and every message is deep-copied
+// from the sender's memory into the receiver's. A place's arena is freed when
+// its body finishes, so futures it starts must be touched before then.
+//
+// A program, or a place, whose body finishes doesn't wait for the places it
+// started: they carry on until the whole program exits. Each channel is
+// freed once the place, its creator, and every place it was passed on to in
+// a message are done with it.
+//
+// Messages may be numbers, strings, symbols, booleans, void, lists, vectors,
+// flvectors and place channels (which are passed by reference).
+
+// Start a place running the expressions in body, with channelName bound to its
+// end of a channel back to the creator. Returns the place descriptor, which
+// is the creator's end of that channel.
+Value *startPlace(Value *channelName, Value *body);
+
+// Wait for a place to finish, returning its exit code (always 0).
+Value *waitForPlace(Value *place);
+
+// Let go of the places started and the channels received while allocating
+// from arena. Must be done before an arena made by newArena is freed.
+void releasePlaces(Arena *arena);
+
+// Send a deep copy of message over a place channel (or a place descriptor).
+// Blocks while the channel is full.
+void channelPut(Value *channel, Value *message);
+
+// Receive the next message from a place channel (or a place descriptor).
+// Blocks while the channel is empty.
+Value *channelGet(Value *channel);
+
+#endif
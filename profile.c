@@ -0,0 +1,468 @@
+// profile.c
+// Counting and timing calls of closures and primitives, and sampling the
+// stack of procedures being run.
+// part of the Racket Interpreter Project
+#include "profile.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include "linkedlist.h"
+
+#define INITIAL_TABLE_SIZE 64
+#define INITIAL_STACK_SIZE 256
+// Microseconds of CPU time between samples
+#define SAMPLE_INTERVAL 1000
+
+// Calls and times of one procedure on one thread
+struct Entry {
+    // The code of the lambda expression, or the primitive's C function
+    void *key;
+    // What a closure was defined as; NULL for primitives and anonymous lambdas
+    char *name;
+    bool primitive;
+    long calls;
+    long totalNs;
+    long selfNs;
+    // How many calls of it are on the shadow stack
+    int active;
+};
+typedef struct Entry Entry;
+
+// A call on the shadow stack
+struct Call {
+    Entry *entry;
+    long start;
+    // Time spent in the procedures it has called so far
+    long childNs;
+};
+typedef struct Call Call;
+
+// A node of a thread's tree of sampled stacks: the procedure called, how many
+// samples stopped here (or how many bytes they allocated), and the procedures
+// it was seen calling
+struct Node {
+    Entry *entry;
+    long samples;
+    struct Node *children;
+    struct Node *sibling;
+};
+typedef struct Node Node;
+
+// A distinct stack, as written by writeSamples
+struct Stack {
+    char *names;
+    long samples;
+};
+typedef struct Stack Stack;
+
+// What one thread has recorded: a hash table of its entries, by key, and its
+// shadow stack
+struct Profile {
+    Entry **table;
+    int size;
+    int count;
+    Call *stack;
+    int stackSize;
+    // Roots of the trees of stacks sampled by time and by allocation
+    Node *samples;
+    Node *allocations;
+    struct Profile *next;
+};
+typedef struct Profile Profile;
+
+bool profiling = false;
+__thread int callDepth = 0;
+
+// Whether the call profiler is on
+static bool timing = false;
+
+static __thread Profile *localProfile = NULL;
+
+// Set by SIGPROF on the thread it interrupts, to take a sample at that
+// thread's next call or return
+static __thread volatile sig_atomic_t sampleDue = 0;
+
+// Every thread's profile, guarded by profilesLock
+Profile *profiles = NULL;
+pthread_mutex_t profilesLock = PTHREAD_MUTEX_INITIALIZER;
+
+Profile *newProfile();
+Entry *findEntry(Profile *, Value *);
+char *entryName(Entry *, Frame *);
+void onSampleTimer(int);
+void takeSample(Profile *);
+void addStack(Profile *, Node *, long);
+void writeStacks(FILE *, Frame *, bool);
+void collectStacks(Node *, char *, Stack **, int *, int *, Frame *);
+long now();
+int compareSelf(const void *, const void *);
+int compareStacks(const void *, const void *);
+
+/*
+ * Turn the call profiler on, from now on.
+ */
+void startProfiling() {
+    timing = true;
+    profiling = true;
+}
+
+/*
+ * Turn the sampling profiler on, from now on.
+ */
+void startSampling() {
+    profiling = true;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSampleTimer;
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGPROF, &action, NULL);
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = SAMPLE_INTERVAL;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+/*
+ * Signal handler for SIGPROF: ask the interrupted thread for a sample.
+ */
+void onSampleTimer(int signal) {
+    sampleDue = 1;
+}
+
+/*
+ * Note that function is being called, and push it on the shadow stack.
+ */
+void enterProcedure(Value *function) {
+    Profile *profile = localProfile;
+    if (profile == NULL) {
+        profile = newProfile();
+    }
+    Entry *entry = findEntry(profile, function);
+    if (callDepth == profile->stackSize) {
+        profile->stackSize *= 2;
+        profile->stack = realloc(profile->stack, sizeof(Call) * profile->stackSize);
+    }
+    Call *call = &profile->stack[callDepth++];
+    call->entry = entry;
+    if (sampleDue) {
+        takeSample(profile);
+    }
+    if (timing) {
+        entry->calls++;
+        entry->active++;
+        call->childNs = 0;
+        call->start = now();
+    }
+}
+
+/*
+ * Note that the most recent call has returned, and add up its time.
+ */
+void leaveProcedure() {
+    Profile *profile = localProfile;
+    if (sampleDue) {
+        takeSample(profile);
+    }
+    Call *call = &profile->stack[--callDepth];
+    if (!timing) {
+        return;
+    }
+    long elapsed = now() - call->start;
+    Entry *entry = call->entry;
+    // A recursive call's time is already inside the outermost call's
+    if (--entry->active == 0) {
+        entry->totalNs += elapsed;
+    }
+    entry->selfNs += elapsed - call->childNs;
+    if (callDepth > 0) {
+        profile->stack[callDepth - 1].childNs += elapsed;
+    }
+}
+
+/*
+ * Finish calls abandoned by an error, as if they had returned now, until
+ * only depth calls are left.
+ */
+void unwindProcedures(int depth) {
+    while (callDepth > depth) {
+        leaveProcedure();
+    }
+}
+
+/*
+ * Make and register the current thread's profile.
+ */
+Profile *newProfile() {
+    Profile *profile = malloc(sizeof(Profile));
+    profile->size = INITIAL_TABLE_SIZE;
+    profile->count = 0;
+    profile->table = calloc(profile->size, sizeof(Entry *));
+    profile->stackSize = INITIAL_STACK_SIZE;
+    profile->stack = malloc(sizeof(Call) * profile->stackSize);
+    profile->samples = calloc(1, sizeof(Node));
+    profile->allocations = calloc(1, sizeof(Node));
+    pthread_mutex_lock(&profilesLock);
+    profile->next = profiles;
+    profiles = profile;
+    pthread_mutex_unlock(&profilesLock);
+    localProfile = profile;
+    return profile;
+}
+
+/*
+ * The entry for a procedure in a thread's profile, made if it is new.
+ */
+Entry *findEntry(Profile *profile, Value *function) {
+    void *key;
+    if (function->type == CLOSURE_TYPE) {
+        key = function->cl.code;
+    } else {
+        key = (void *)function->pf;
+    }
+    // Open addressing; pointers are aligned, so skip their low bits
+    unsigned long slot = ((unsigned long)key >> 4) & (profile->size - 1);
+    while (profile->table[slot] != NULL) {
+        if (profile->table[slot]->key == key) {
+            return profile->table[slot];
+        }
+        slot = (slot + 1) & (profile->size - 1);
+    }
+
+    Entry *entry = malloc(sizeof(Entry));
+    entry->key = key;
+    entry->primitive = function->type == PRIMITIVE_TYPE;
+    entry->name = entry->primitive ? NULL : function->cl.name;
+    entry->calls = 0;
+    entry->totalNs = 0;
+    entry->selfNs = 0;
+    entry->active = 0;
+    profile->table[slot] = entry;
+
+    // Keep the table at most half full
+    if (++profile->count * 2 > profile->size) {
+        Entry **old = profile->table;
+        int oldSize = profile->size;
+        profile->size *= 2;
+        profile->table = calloc(profile->size, sizeof(Entry *));
+        for (int i = 0; i < oldSize; i++) {
+            if (old[i] != NULL) {
+                slot = ((unsigned long)old[i]->key >> 4) & (profile->size - 1);
+                while (profile->table[slot] != NULL) {
+                    slot = (slot + 1) & (profile->size - 1);
+                }
+                profile->table[slot] = old[i];
+            }
+        }
+        free(old);
+    }
+    return entry;
+}
+
+/*
+ * Print the profile of every thread, most self time first.
+ */
+void printProfile(FILE *out, Frame *frame) {
+    // Add up each procedure's entries from all threads
+    int count = 0;
+    int size = 64;
+    Entry *merged = malloc(sizeof(Entry) * size);
+    long calls = 0;
+    long totalNs = 0;
+    pthread_mutex_lock(&profilesLock);
+    for (Profile *profile = profiles; profile != NULL; profile = profile->next) {
+        for (int i = 0; i < profile->size; i++) {
+            Entry *entry = profile->table[i];
+            if (entry == NULL) {
+                continue;
+            }
+            calls += entry->calls;
+            totalNs += entry->selfNs;
+            int j = 0;
+            while (j < count && merged[j].key != entry->key) {
+                j++;
+            }
+            if (j == count) {
+                if (count == size) {
+                    size *= 2;
+                    merged = realloc(merged, sizeof(Entry) * size);
+                }
+                merged[count++] = *entry;
+            } else {
+                merged[j].calls += entry->calls;
+                merged[j].totalNs += entry->totalNs;
+                merged[j].selfNs += entry->selfNs;
+            }
+        }
+    }
+    pthread_mutex_unlock(&profilesLock);
+    qsort(merged, count, sizeof(Entry), compareSelf);
+
+    fprintf(out, "Profile: %ld calls, %.3f ms in procedures\n", calls, totalNs / 1e6);
+    fprintf(out, "%12s %12s %12s %7s  %s\n", "calls", "total ms", "self ms", "self %", "procedure");
+    for (int i = 0; i < count; i++) {
+        Entry *entry = &merged[i];
+        char *name = entryName(entry, frame);
+        fprintf(out, "%12ld %12.3f %12.3f %6.1f%%  %s\n", entry->calls, entry->totalNs / 1e6,
+                entry->selfNs / 1e6, totalNs > 0 ? 100.0 * entry->selfNs / totalNs : 0.0, name);
+    }
+    free(merged);
+}
+
+/*
+ * The name to report a procedure under. A primitive is named by what it is
+ * bound to in frame.
+ */
+char *entryName(Entry *entry, Frame *frame) {
+    if (!entry->primitive) {
+        return entry->name != NULL ? entry->name : "lambda";
+    }
+    for (Value *cur = frame->bindings; cur->type == CONS_TYPE; cur = cdr(cur)) {
+        Value *value = car(cdr(car(cur)));
+        if (value->type == PRIMITIVE_TYPE && (void *)value->pf == entry->key) {
+            return car(car(cur))->s;
+        }
+    }
+    return "#<primitive>";
+}
+
+/*
+ * Record the current thread's shadow stack in its tree of samples.
+ */
+void takeSample(Profile *profile) {
+    sampleDue = 0;
+    addStack(profile, profile->samples, 1);
+}
+
+/*
+ * Record the current thread's shadow stack as having allocated bytes.
+ */
+void sampleAllocation(long bytes) {
+    Profile *profile = localProfile;
+    if (profile == NULL) {
+        profile = newProfile();
+    }
+    addStack(profile, profile->allocations, bytes);
+}
+
+/*
+ * Add weight to the current shadow stack in the tree under root.
+ */
+void addStack(Profile *profile, Node *root, long weight) {
+    Node *node = root;
+    for (int i = 0; i < callDepth; i++) {
+        Node *child = node->children;
+        while (child != NULL && child->entry != profile->stack[i].entry) {
+            child = child->sibling;
+        }
+        if (child == NULL) {
+            child = calloc(1, sizeof(Node));
+            child->entry = profile->stack[i].entry;
+            child->sibling = node->children;
+            node->children = child;
+        }
+        node = child;
+    }
+    node->samples += weight;
+}
+
+/*
+ * Stop sampling, and write the samples of every thread as folded stacks.
+ */
+void writeSamples(FILE *out, Frame *frame) {
+    struct itimerval off;
+    memset(&off, 0, sizeof(off));
+    setitimer(ITIMER_PROF, &off, NULL);
+    writeStacks(out, frame, false);
+}
+
+/*
+ * Write the allocation samples of every thread as folded stacks.
+ */
+void writeAllocationSamples(FILE *out, Frame *frame) {
+    writeStacks(out, frame, true);
+}
+
+/*
+ * Write the stacks sampled by time, or by allocation, of every thread.
+ */
+void writeStacks(FILE *out, Frame *frame, bool allocations) {
+    // Threads have trees of their own, so the same stack can come from more
+    // than one; sort the stacks to add those up
+    int count = 0;
+    int size = 64;
+    Stack *stacks = malloc(sizeof(Stack) * size);
+    pthread_mutex_lock(&profilesLock);
+    for (Profile *profile = profiles; profile != NULL; profile = profile->next) {
+        collectStacks(allocations ? profile->allocations : profile->samples, NULL,
+                      &stacks, &count, &size, frame);
+    }
+    pthread_mutex_unlock(&profilesLock);
+    qsort(stacks, count, sizeof(Stack), compareStacks);
+    for (int i = 0; i < count; i++) {
+        long samples = stacks[i].samples;
+        while (i + 1 < count && !strcmp(stacks[i].names, stacks[i + 1].names)) {
+            free(stacks[i].names);
+            samples += stacks[++i].samples;
+        }
+        fprintf(out, "%s %ld\n", stacks[i].names, samples);
+        free(stacks[i].names);
+    }
+    free(stacks);
+}
+
+/*
+ * Add the stacks of node and everything under it that have samples to
+ * stacks. path is the names of the procedures calling node, or NULL at the
+ * root.
+ */
+void collectStacks(Node *node, char *path, Stack **stacks, int *count, int *size,
+                   Frame *frame) {
+    char *names = NULL;
+    if (node->entry != NULL) {
+        char *name = entryName(node->entry, frame);
+        names = malloc((path != NULL ? strlen(path) + 1 : 0) + strlen(name) + 1);
+        sprintf(names, "%s%s%s", path != NULL ? path : "", path != NULL ? ";" : "", name);
+    }
+    if (node->samples > 0 && names != NULL) {
+        if (*count == *size) {
+            *size *= 2;
+            *stacks = realloc(*stacks, sizeof(Stack) * *size);
+        }
+        (*stacks)[*count].names = strdup(names);
+        (*stacks)[*count].samples = node->samples;
+        (*count)++;
+    }
+    for (Node *child = node->children; child != NULL; child = child->sibling) {
+        collectStacks(child, names, stacks, count, size, frame);
+    }
+    free(names);
+}
+
+/*
+ * The time in nanoseconds, from a monotonic clock.
+ */
+long now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000L + time.tv_nsec;
+}
+
+/*
+ * Order stacks by their names, for qsort.
+ */
+int compareStacks(const void *a, const void *b) {
+    return strcmp(((const Stack *)a)->names, ((const Stack *)b)->names);
+}
+
+/*
+ * Order entries by self time, most first, for qsort.
+ */
+int compareSelf(const void *a, const void *b) {
+    long x = ((const Entry *)a)->selfNs;
+    long y = ((const Entry *)b)->selfNs;
+    return (x < y) - (x > y);
+}
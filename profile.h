@@ -0,0 +1,70 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include "value.h"
+#include "interpreter.h"
+
+#ifndef _PROFILE
+#define _PROFILE
+
+// The profilers. Each thread keeps a shadow stack of the procedures it is
+// in, pushed and popped by applyProcedure while either profiler is on.
+//
+// The call profiler counts and times every call of a closure or primitive.
+// The shadow stack lets time spent in a procedure itself (self time) be told
+// apart from time spent in the procedures it calls. Total time counts a
+// recursive procedure once, from its outermost call.
+//
+// The sampling profiler doesn't time calls, so it doesn't slow short ones
+// down. Instead, SIGPROF arrives about every millisecond of CPU time, and the
+// shadow stack of the thread it arrives on is recorded at that thread's next
+// call or return (a signal handler can't safely allocate). The samples are
+// written in the folded-stack format that flamegraph.pl reads: one line per
+// distinct stack, outermost procedure first, separated by semicolons and
+// followed by the number of samples.
+//
+// Heap profiling (see heapprofile.h) can also use the shadow stack, to record
+// which procedures were running as memory was allocated. Those samples are
+// written in the same format, weighted by bytes instead of samples.
+//
+// Closures are reported under the name they were defined with (or "lambda"),
+// and all closures made by the same lambda expression count as one
+// procedure. Primitives are reported under the name they are bound to at the
+// top level.
+
+// Whether either profiler is on, so calls must be tracked
+extern bool profiling;
+
+// How many calls this thread is inside; error traps keep it to unwind to
+extern __thread int callDepth;
+
+// Turn the call profiler on, from now on.
+void startProfiling();
+
+// Turn the sampling profiler on, from now on.
+void startSampling();
+
+// Note that function is being called, and push it on the shadow stack.
+void enterProcedure(Value *function);
+
+// Note that the most recent call has returned.
+void leaveProcedure();
+
+// Finish calls abandoned by an error, until only depth calls are left.
+void unwindProcedures(int depth);
+
+// Print the call profile of every thread, most self time first. Primitives
+// are named by looking them up in frame.
+void printProfile(FILE *out, Frame *frame);
+
+// Stop sampling, and write the samples of every thread as folded stacks.
+// Primitives are named by looking them up in frame.
+void writeSamples(FILE *out, Frame *frame);
+
+// Record the current thread's shadow stack as having allocated bytes.
+void sampleAllocation(long bytes);
+
+// Write the allocation samples of every thread as folded stacks, weighted by
+// the bytes allocated.
+void writeAllocationSamples(FILE *out, Frame *frame);
+
+#endif
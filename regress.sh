@@ -0,0 +1,113 @@
+#!/bin/bash
+# Runs the benchmark workloads under cachegrind and massif, and fails if any
+# of them got worse than its baseline by more than THRESHOLD percent (2 by
+# default). The metrics are instructions run, D1 and LL miss rates, and peak
+# heap; unlike wall time they come out the same on every run, so a small
+# change shows up even on a busy machine.
+#
+# Usage: ./regress.sh [--update] [workload...]
+#
+# With --update, the baselines are set to what was measured instead. They are
+# kept in bench/baselines, one "workload metric value" per line, and
+# should be updated (and committed) along with any change that is meant to
+# make a workload slower. A workload with no baseline fails. With no
+# workloads, every bench/*.txt is run.
+#
+# No baselines have been recorded yet, so this is not run by make: record
+# them with --update on a machine with valgrind, and add a regress target
+# to the Makefile in the same commit as bench/baselines.
+
+baselines=bench/baselines
+threshold=${THRESHOLD:-2}
+interpreter=./interpreter
+
+update=false
+if [ "$1" = "--update" ]; then
+    update=true
+    shift
+fi
+workloads=("$@")
+if [ ${#workloads[@]} -eq 0 ]; then
+    workloads=(bench/*.txt)
+fi
+
+if ! command -v valgrind > /dev/null; then
+    echo "Error: valgrind is not installed"
+    exit 2
+fi
+if [ ! -x "$interpreter" ]; then
+    echo "Error: $interpreter has not been built"
+    exit 2
+fi
+
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+
+# Print the metrics of one workload, as "metric value" lines
+measure() {
+    valgrind --tool=cachegrind --cache-sim=yes --cachegrind-out-file="$scratch/cachegrind" \
+        "$interpreter" < "$1" > /dev/null 2> "$scratch/cachegrind.log" || return 1
+    valgrind --tool=massif --massif-out-file="$scratch/massif" \
+        "$interpreter" < "$1" > /dev/null 2> /dev/null || return 1
+
+    # The summary cachegrind prints has the counts with commas; miss rates
+    # are worked out from them, since it only prints those to one decimal
+    tr -d , < "$scratch/cachegrind.log" | awk '
+        /I +refs:/ { instructions = $4 }
+        /D +refs:/ { data = $4 }
+        /D1 +misses:/ { d1 = $4 }
+        /LL misses:/ { ll = $4 }
+        END {
+            if (instructions == "") exit 1
+            printf "instructions %.0f\n", instructions
+            printf "d1_miss_rate %.6g\n", (data > 0 ? 100 * d1 / data : 0)
+            printf "ll_miss_rate %.6g\n", 100 * ll / (instructions + data)
+        }' || return 1
+    # Each massif snapshot has the heap in use and the allocator's overhead
+    awk -F= '
+        /^mem_heap_B=/ { heap = $2 }
+        /^mem_heap_extra_B=/ { if (heap + $2 > peak) peak = heap + $2 }
+        END { printf "peak_heap %.0f\n", peak }' "$scratch/massif"
+}
+
+failed=0
+for workload in "${workloads[@]}"; do
+    name=$(basename "$workload" .txt)
+    if ! measure "$workload" > "$scratch/$name"; then
+        echo "Error: $name failed under valgrind"
+        failed=1
+        continue
+    fi
+
+    if $update; then
+        # Replace this workload's lines, keeping the others
+        touch "$baselines"
+        grep -v "^$name " "$baselines" > "$scratch/baselines"
+        sed "s/^/$name /" "$scratch/$name" >> "$scratch/baselines"
+        sort "$scratch/baselines" > "$baselines"
+        echo "Updated $name"
+        continue
+    fi
+
+    while read -r metric value; do
+        baseline=$(awk -v name="$name" -v metric="$metric" \
+            '$1 == name && $2 == metric { print $3 }' "$baselines" 2> /dev/null)
+        # A metric with nothing to compare to can't pass: run with --update
+        # and commit bench/baselines first
+        if [ -z "$baseline" ]; then
+            printf "%-12s %-14s %16s  NO BASELINE (run with --update)\n" "$name" "$metric" "$value"
+            failed=1
+            continue
+        fi
+        # Worse means bigger, for all of them
+        verdict=$(awk -v value="$value" -v baseline="$baseline" -v threshold="$threshold" 'BEGIN {
+            change = baseline > 0 ? 100 * (value - baseline) / baseline : (value > 0 ? 100 : 0)
+            printf "%+.2f%% %s", change, (change > threshold ? "REGRESSED" : "ok")
+        }')
+        printf "%-12s %-14s %16s %16s  %s\n" "$name" "$metric" "$value" "$baseline" "$verdict"
+        case "$verdict" in
+            *REGRESSED) failed=1 ;;
+        esac
+    done < "$scratch/$name"
+done
+exit $failed
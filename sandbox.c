@@ -0,0 +1,201 @@
+// sandbox.c
+// Fuel, memory and recursion depth limits for running untrusted code.
+// part of the Racket Interpreter Project
+#include "sandbox.h"
+#include <stdlib.h>
+#include "error.h"
+
+// Room left for making the error once memory runs out, so that raising it
+// doesn't run out too
+#define MEMORY_RESERVE (64 * 1024)
+// How much a thread takes from its run's pool at a time
+#define FUEL_BATCH 1024
+#define MEMORY_BATCH (16 * 1024)
+// A pool amount that never runs down
+#define UNLIMITED LONG_MAX
+
+struct Pool {
+    long fuel;
+    long memory;
+    // The run and every share of it still in use
+    int references;
+};
+
+// The pool of threads that aren't working for any run
+static Pool unlimited = {UNLIMITED, UNLIMITED, 1};
+
+__thread long fuelLeft = LONG_MAX;
+__thread long memoryLeft = LONG_MAX;
+__thread int evalDepth = 0;
+__thread int depthLimit = INT_MAX;
+
+// The pool this thread draws on, and the run it last started itself
+static __thread Pool *pool = &unlimited;
+static __thread Pool *ownRun = NULL;
+// Whether memoryLeft includes the reserve, which didn't come from the pool
+static __thread bool inReserve = false;
+
+// The messages of the limit errors. Limit errors are recognized by pointing
+// at one of these, so they stay recognizable when a future's error is raised
+// again on the thread that joins it.
+static char *fuelMessage = "Error: out of fuel";
+static char *memoryMessage = "Error: memory limit exceeded";
+static char *depthMessage = "Error: maximum recursion depth exceeded";
+
+void givePoolBack();
+long takeFromPool(long *, long, long);
+
+/*
+ * Start a run on this thread with the given limits.
+ */
+void startRun(Limits *limits) {
+    Pool *run = malloc(sizeof(Pool));
+    run->fuel = limits->fuel > 0 ? limits->fuel : UNLIMITED;
+    run->memory = limits->memory > 0 ? limits->memory : UNLIMITED;
+    run->references = 1;
+    // The last run is over, apart from anything it started that still has a
+    // share of it
+    if (ownRun != NULL) {
+        releaseBudget((Budget){ownRun, 0});
+    }
+    ownRun = run;
+    pool = run;
+    fuelLeft = 0;
+    memoryLeft = 0;
+    inReserve = false;
+    // Depth counts from wherever eval is now, which matters when embedded
+    depthLimit = limits->depth > 0 ? evalDepth + limits->depth : INT_MAX;
+}
+
+/*
+ * End the run this thread started, so the thread is back to having no limits.
+ */
+void endRun() {
+    givePoolBack();
+    if (ownRun != NULL) {
+        releaseBudget((Budget){ownRun, 0});
+    }
+    ownRun = NULL;
+    pool = &unlimited;
+    depthLimit = INT_MAX;
+}
+
+/*
+ * A share of this thread's run, to hand on to work it starts on another
+ * thread.
+ */
+Budget shareBudget() {
+    Budget budget;
+    budget.pool = pool;
+    __atomic_add_fetch(&pool->references, 1, __ATOMIC_RELAXED);
+    budget.depth = depthLimit == INT_MAX ? INT_MAX : depthLimit - evalDepth;
+    return budget;
+}
+
+/*
+ * Let go of a share of a run, freeing its pool if nothing else uses it.
+ */
+void releaseBudget(Budget budget) {
+    if (budget.pool != &unlimited &&
+        __atomic_sub_fetch(&budget.pool->references, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(budget.pool);
+    }
+}
+
+/*
+ * Switch this thread to budget, returning the budget it had before.
+ */
+Budget useBudget(Budget budget) {
+    Budget previous;
+    previous.pool = pool;
+    previous.depth = depthLimit == INT_MAX ? INT_MAX : depthLimit - evalDepth;
+    givePoolBack();
+    pool = budget.pool;
+    depthLimit = budget.depth == INT_MAX ? INT_MAX : evalDepth + budget.depth;
+    return previous;
+}
+
+/*
+ * Give what is left of this thread's batches back to its pool. The thread
+ * takes new batches when it next needs them.
+ */
+void givePoolBack() {
+    if (__atomic_load_n(&pool->fuel, __ATOMIC_RELAXED) != UNLIMITED && fuelLeft > 0) {
+        __atomic_add_fetch(&pool->fuel, fuelLeft, __ATOMIC_RELAXED);
+    }
+    long memory = memoryLeft - (inReserve ? MEMORY_RESERVE : 0);
+    if (__atomic_load_n(&pool->memory, __ATOMIC_RELAXED) != UNLIMITED && memory > 0) {
+        __atomic_add_fetch(&pool->memory, memory, __ATOMIC_RELAXED);
+    }
+    fuelLeft = 0;
+    memoryLeft = 0;
+    inReserve = false;
+}
+
+/*
+ * Take from a pool amount, up to want but at least need. Returns how much was
+ * taken, or 0 if there isn't need left.
+ */
+long takeFromPool(long *amount, long want, long need) {
+    long have = __atomic_load_n(amount, __ATOMIC_RELAXED);
+    while (1) {
+        if (have == UNLIMITED) {
+            return UNLIMITED;
+        }
+        if (have < need) {
+            return 0;
+        }
+        long taken = have < want ? have : want;
+        if (__atomic_compare_exchange_n(amount, &have, have - taken, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return taken;
+        }
+    }
+}
+
+/*
+ * Whether raised is the error for going over a limit.
+ */
+bool isLimitError(Value *raised) {
+    return raised->type == ERROR_TYPE &&
+        (raised->s == fuelMessage || raised->s == memoryMessage ||
+         raised->s == depthMessage);
+}
+
+/*
+ * This thread's fuel has run out while using one unit: take another batch,
+ * or raise the error if the run has none left. The error ends the run, so
+ * what other threads give back afterwards goes unused.
+ */
+void refuel() {
+    long taken = takeFromPool(&pool->fuel, FUEL_BATCH, 1);
+    if (taken == 0) {
+        fuelLeft = 0;
+        raiseValue(makeError(fuelMessage));
+    }
+    fuelLeft = taken == UNLIMITED ? LONG_MAX : taken - 1;
+}
+
+/*
+ * This thread's memory has run out, by -memoryLeft bytes: take another
+ * batch, at least that big, or raise the error if the run hasn't got that
+ * much left.
+ */
+void refillMemory() {
+    long need = -memoryLeft;
+    long taken = takeFromPool(&pool->memory, need > MEMORY_BATCH ? need : MEMORY_BATCH, need);
+    if (taken == 0) {
+        memoryLeft = MEMORY_RESERVE;
+        inReserve = true;
+        raiseValue(makeError(memoryMessage));
+    }
+    memoryLeft = taken == UNLIMITED ? LONG_MAX : memoryLeft + taken;
+}
+
+/*
+ * eval has recursed too deeply. The trap that catches this puts evalDepth
+ * back.
+ */
+void tooDeep() {
+    raiseValue(makeError(depthMessage));
+}
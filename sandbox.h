@@ -0,0 +1,103 @@
+#include <limits.h>
+#include <stdbool.h>
+#include "value.h"
+
+#ifndef _SANDBOX
+#define _SANDBOX
+
+// Limits on what one run of a program may use, for running untrusted code.
+// A run is a whole program from the command line, one request in server mode,
+// or one interp_eval_string call when embedded.
+//
+// Fuel is used up by every eval and every procedure call, memory by every
+// talloc, and depth is how deeply eval may recurse. Going over a limit raises
+// an error of its own ("out of fuel", "memory limit exceeded", "maximum
+// recursion depth exceeded"). Unlike other errors, with-handlers can't catch
+// these, and they end the run instead of just the top-level form.
+//
+// Fuel and memory are shared by everything a run starts: futures, parallel
+// chunks and places all draw on the same pool, so running code on other
+// threads can't get past a limit. To keep useFuel and useMemory cheap, each
+// thread takes a batch at a time from the pool and counts it down locally,
+// giving back what it didn't use when it switches to other work. So a thread
+// may run out while others still hold a batch each, a little before the pool
+// is quite empty; a single thread runs out exactly at the limit.
+//
+// Depth is per thread, since each has its own stack: a future, parallel chunk
+// or place gets the depth the thread starting it has left at that moment.
+
+// Limits for a run; 0 means no limit
+struct Limits {
+    long fuel;
+    long memory;
+    int depth;
+};
+typedef struct Limits Limits;
+
+// The fuel and memory a run has left, shared by all of its threads.
+typedef struct Pool Pool;
+
+// What a thread is working for: the pool of a run, and how much deeper eval
+// may go. Unlimited depth is just very large.
+struct Budget {
+    Pool *pool;
+    int depth;
+};
+typedef struct Budget Budget;
+
+// Start a run on this thread with the given limits.
+void startRun(Limits *limits);
+
+// End the run this thread started, taking the limits off. Work it started
+// that still holds a share carries on with what the run has left.
+void endRun();
+
+// A share of this thread's run, to hand on to work it starts on another
+// thread. The run's pool is kept until the share is released.
+Budget shareBudget();
+
+// Let go of a share from shareBudget, once the work it was for is done.
+void releaseBudget(Budget budget);
+
+// Switch this thread to budget, returning the budget it had before. What is
+// left of the batches it took is given back to the pool it was using.
+Budget useBudget(Budget budget);
+
+// Whether raised is the error for going over a limit.
+bool isLimitError(Value *raised);
+
+// Called by the checks below when a thread's batch runs out, to take another
+// from the pool or raise an error if the pool is empty too; and when eval
+// goes too deep.
+void refuel();
+void refillMemory();
+void tooDeep();
+
+// What is left of this thread's batches, and how deep eval is
+extern __thread long fuelLeft;
+extern __thread long memoryLeft;
+extern __thread int evalDepth;
+extern __thread int depthLimit;
+
+// Use up one unit of fuel.
+static inline void useFuel() {
+    if (--fuelLeft < 0) {
+        refuel();
+    }
+}
+
+// Use up size bytes of memory.
+static inline void useMemory(long size) {
+    if ((memoryLeft -= size) < 0) {
+        refillMemory();
+    }
+}
+
+// Go one level deeper in eval; the caller comes back out with evalDepth--.
+static inline void enterEval() {
+    if (++evalDepth > depthLimit) {
+        tooDeep();
+    }
+}
+
+#endif
@@ -0,0 +1,359 @@
+// server.c
+// Server mode: a warm interpreter serving programs over a Unix domain socket.
+// part of the Racket Interpreter Project
+#define _GNU_SOURCE
+#include "server.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "error.h"
+#include "interpreter.h"
+#include "parser.h"
+
+#define MAX_EVENTS 64
+
+// A client connection, the part of its program read so far, and the child
+// running the program once it has all arrived
+struct Connection {
+    int fd;
+    char *text;
+    size_t size;
+    size_t capacity;
+    pid_t child;
+    struct Connection *next;
+};
+typedef struct Connection Connection;
+
+int runWorker(int, char *, Limits *);
+int serveLoop(int, int, Interp *);
+void acceptClients(int, int);
+int readRequest(Connection *);
+bool handleRequest(Interp *, Connection *);
+void reapChildren(int);
+void runRequest(Interp *, Connection *);
+void closeConnection(Connection *);
+
+// Every open connection in this worker, so a child can close the ones that
+// aren't its own and a dead child's connection can be found by its pid
+Connection *connections = NULL;
+
+// Set by SIGTERM or SIGINT to stop the supervisor
+volatile sig_atomic_t stopServer = 0;
+
+/*
+ * Signal handler for the supervisor: stop, and take the workers with it.
+ */
+void onStop(int signal) {
+    stopServer = 1;
+}
+
+/*
+ * Serve requests on the socket at path until killed.
+ */
+int serve(char *path, char *prelude, int workers, Limits *limits) {
+    // A client hanging up early must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (listener < 0 || strlen(path) >= sizeof(address.sun_path)) {
+        printf("Error: can't create socket %s\n", path);
+        return 1;
+    }
+    strcpy(address.sun_path, path);
+    unlink(path);
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        listen(listener, SOMAXCONN) < 0) {
+        printf("Error: can't listen on socket %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    if (workers <= 0) {
+        return runWorker(listener, prelude, limits);
+    }
+
+    // Supervise the workers, replacing any that die
+    pid_t *pids = malloc(sizeof(pid_t) * workers);
+    for (int i = 0; i < workers; i++) {
+        pids[i] = -1;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onStop;
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+    while (!stopServer) {
+        for (int i = 0; i < workers; i++) {
+            if (pids[i] != -1) {
+                continue;
+            }
+            fflush(stdout);
+            pids[i] = fork();
+            if (pids[i] == 0) {
+                signal(SIGTERM, SIG_DFL);
+                signal(SIGINT, SIG_DFL);
+                exit(runWorker(listener, prelude, limits));
+            }
+        }
+        pid_t dead = wait(NULL);
+        for (int i = 0; i < workers; i++) {
+            if (pids[i] == dead) {
+                pids[i] = -1;
+            }
+        }
+    }
+    for (int i = 0; i < workers; i++) {
+        if (pids[i] != -1) {
+            kill(pids[i], SIGTERM);
+        }
+    }
+    while (wait(NULL) > 0) {
+    }
+    unlink(path);
+    free(pids);
+    return 0;
+}
+
+/*
+ * Set up an interpreter, load the prelude into it, and serve requests.
+ */
+int runWorker(int listener, char *prelude, Limits *limits) {
+    // Finished children are found through a signalfd. SIGCHLD is blocked
+    // before the prelude can start any threads, as a thread that didn't
+    // block it could take the signal and drop it.
+    sigset_t childSignals;
+    sigemptyset(&childSignals);
+    sigaddset(&childSignals, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &childSignals, NULL);
+    int children = signalfd(-1, &childSignals, SFD_NONBLOCK);
+    Interp *interp = newInterp();
+    if (prelude != NULL) {
+        FILE *in = fopen(prelude, "r");
+        if (in == NULL) {
+            printf("Error: can't open prelude %s\n", prelude);
+            return 1;
+        }
+        Value *tree = parseFile(in);
+        fclose(in);
+        interpretIn(interp, tree);
+        fflush(stdout);
+    }
+    // The prelude is trusted; only requests are limited
+    interp->limits = *limits;
+    return serveLoop(listener, children, interp);
+}
+
+/*
+ * Wait for connections, requests and finished children (reported by the
+ * signalfd children) with epoll, starting each program as soon as all of it
+ * has arrived, and closing its connection once the child running it has
+ * exited. Children run alongside each other and the loop, so a slow program
+ * doesn't hold up the requests after it.
+ */
+int serveLoop(int listener, int children, Interp *interp) {
+    int poll = epoll_create1(0);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+#ifdef EPOLLEXCLUSIVE
+    // Wake only one worker per new connection
+    event.events |= EPOLLEXCLUSIVE;
+#endif
+    event.data.ptr = NULL;
+    struct epoll_event childEvent;
+    childEvent.events = EPOLLIN;
+    childEvent.data.ptr = &children;
+    if (children < 0 || poll < 0 || epoll_ctl(poll, EPOLL_CTL_ADD, listener, &event) < 0 ||
+        epoll_ctl(poll, EPOLL_CTL_ADD, children, &childEvent) < 0) {
+        printf("Error: can't wait for connections: %s\n", strerror(errno));
+        return 1;
+    }
+    struct epoll_event events[MAX_EVENTS];
+    while (1) {
+        int count = epoll_wait(poll, events, MAX_EVENTS, -1);
+        if (count < 0 && errno != EINTR) {
+            return 1;
+        }
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == &children) {
+                reapChildren(children);
+                continue;
+            }
+            Connection *connection = events[i].data.ptr;
+            if (connection == NULL) {
+                acceptClients(listener, poll);
+                continue;
+            }
+            int status = readRequest(connection);
+            if (status == 0) {
+                continue;
+            }
+            epoll_ctl(poll, EPOLL_CTL_DEL, connection->fd, NULL);
+            // A started request is closed when its child is reaped
+            if (status < 0 || !handleRequest(interp, connection)) {
+                closeConnection(connection);
+            }
+        }
+    }
+}
+
+/*
+ * Accept every waiting connection and start watching it for input.
+ */
+void acceptClients(int listener, int poll) {
+    while (1) {
+        int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK);
+        if (fd < 0) {
+            // Nothing left to accept (or another worker got it)
+            return;
+        }
+        Connection *connection = malloc(sizeof(Connection));
+        connection->fd = fd;
+        connection->capacity = 4096;
+        connection->size = 0;
+        connection->text = malloc(connection->capacity);
+        connection->child = -1;
+        connection->next = connections;
+        connections = connection;
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = connection;
+        if (epoll_ctl(poll, EPOLL_CTL_ADD, fd, &event) < 0) {
+            closeConnection(connection);
+        }
+    }
+}
+
+/*
+ * Read whatever has arrived on a connection. Returns 1 once the client has
+ * sent the whole program, 0 if more is to come, and -1 on an error.
+ */
+int readRequest(Connection *connection) {
+    while (1) {
+        if (connection->size == connection->capacity) {
+            connection->capacity *= 2;
+            connection->text = realloc(connection->text, connection->capacity);
+        }
+        ssize_t got = read(connection->fd, connection->text + connection->size,
+                           connection->capacity - connection->size);
+        if (got > 0) {
+            connection->size += got;
+        } else if (got == 0) {
+            return 1;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+/*
+ * Start running the program a client sent in a child process of its own, with
+ * everything it prints going back to the client. Whatever the program
+ * allocates, defines or mutates goes away with the child. Returns whether the
+ * child started; if so, the connection stays open until it is reaped.
+ */
+bool handleRequest(Interp *interp, Connection *connection) {
+    int flags = fcntl(connection->fd, F_GETFL);
+    fcntl(connection->fd, F_SETFL, flags & ~O_NONBLOCK);
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        // Other clients must see their connections close when the worker
+        // closes them, not when this child exits
+        for (Connection *other = connections; other != NULL; other = other->next) {
+            if (other != connection) {
+                close(other->fd);
+            }
+        }
+        sigset_t childSignals;
+        sigemptyset(&childSignals);
+        sigaddset(&childSignals, SIGCHLD);
+        sigprocmask(SIG_UNBLOCK, &childSignals, NULL);
+        // Send what the program prints to the client
+        dup2(connection->fd, STDOUT_FILENO);
+        runRequest(interp, connection);
+        fflush(stdout);
+        _exit(0);
+    }
+    if (child < 0) {
+        dprintf(connection->fd, "Error: can't run the program: %s\n", strerror(errno));
+        return false;
+    }
+    connection->child = child;
+    return true;
+}
+
+/*
+ * Reap every child that has exited, telling its client if it was killed, and
+ * close its connection.
+ */
+void reapChildren(int children) {
+    struct signalfd_siginfo info;
+    while (read(children, &info, sizeof(info)) > 0) {
+    }
+    int status;
+    pid_t child;
+    while ((child = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (Connection *connection = connections; connection != NULL;
+             connection = connection->next) {
+            if (connection->child != child) {
+                continue;
+            }
+            if (WIFSIGNALED(status)) {
+                dprintf(connection->fd, "Error: the program was killed by %s.\n",
+                        strsignal(WTERMSIG(status)));
+            }
+            closeConnection(connection);
+            break;
+        }
+    }
+}
+
+/*
+ * Parse and run the program a client sent, at the top level of interp.
+ */
+void runRequest(Interp *interp, Connection *connection) {
+    if (connection->size == 0) {
+        return;
+    }
+    // The limits cover parsing the request too
+    startRun(&interp->limits);
+    FILE *in = fmemopen(connection->text, connection->size, "r");
+    ErrorTrap trap;
+    pushErrorTrap(&trap);
+    if (setjmp(trap.jump) == 0) {
+        Value *tree = parseFile(in);
+        popErrorTrap(&trap);
+        interpretIn(interp, tree);
+    } else {
+        printf("%s\n", errorMessage(trap.raised));
+    }
+    fclose(in);
+}
+
+/*
+ * Close a connection and free its buffer.
+ */
+void closeConnection(Connection *connection) {
+    for (Connection **link = &connections; *link != NULL; link = &(*link)->next) {
+        if (*link == connection) {
+            *link = connection->next;
+            break;
+        }
+    }
+    close(connection->fd);
+    free(connection->text);
+    free(connection);
+}
@@ -0,0 +1,35 @@
+#include "sandbox.h"
+
+#ifndef _SERVER
+#define _SERVER
+
+// Server mode: keep a warm interpreter, with the primitives and an optional
+// prelude already loaded, and run programs sent to it over a Unix domain
+// socket.
+//
+// A client connects, sends a program, and shuts down its side of the
+// connection for writing. The server evaluates the program and sends back
+// exactly what the interpreter would have printed for it, including error
+// messages, then closes the connection.
+//
+// Each request runs in a child process forked from the warm interpreter, so
+// nothing it does can be seen by later requests: its defines, set!s, changes
+// to the prelude's vectors and hash tables, and everything it allocated go
+// away with the child. The fork is cheap, since the child shares the
+// parent's memory until it writes to it. If a request crashes the child, the
+// client is told, and the server carries on. The server keeps taking
+// requests while children run, so a slow program doesn't hold up the ones
+// after it.
+//
+// With workers > 0, that many worker processes are forked, each loading the
+// prelude and serving requests from the same socket, and any that dies is
+// replaced. With workers == 0 the server runs in this process.
+//
+// Each request is a run of its own for limits (see sandbox.h): it gets all of
+// the fuel, memory and depth that limits allow. The prelude is not limited.
+
+// Serve requests on the socket at path until killed. Returns nonzero if the
+// socket could not be set up.
+int serve(char *path, char *prelude, int workers, Limits *limits);
+
+#endif
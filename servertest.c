@@ -0,0 +1,302 @@
+// servertest.c
+// Tests server mode: starts the interpreter serving on a temporary socket
+// with a prelude, sends it programs one after another as a client would, and
+// compares what comes back with what is expected. Most of the programs check
+// that nothing a request does can be seen by the requests after it. A last
+// check sends a slow program and a fast one together, and expects the fast
+// one back first.
+// part of the Racket Interpreter Project
+//
+// Usage: servertest [-i interpreter]
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// How long to wait for the server to start listening, in milliseconds
+#define START_TIMEOUT 5000
+
+// Loaded by the server before it takes requests. The future starts the
+// thread pool, so requests have to get one of their own.
+static char *prelude =
+    "(define counter (let ((n 0)) (lambda (x) (set! n x) n)))\n"
+    "(define shared (vector 1 2 3))\n"
+    "(define table (make-hash))\n"
+    "(hash-set! table (quote a) 1)\n"
+    "(touch (future (lambda () 0)))\n";
+
+// A program to send, and what the server should send back for it
+struct Check {
+    char *program;
+    char *expected;
+};
+typedef struct Check Check;
+
+// Run in order, on the same server
+static Check checks[] = {
+    // Storing a request's value in the prelude's closure
+    {"(counter (list \"hello\" 7))", "'( \"hello\" 7 ) \n"},
+    {"(define x (list 1 2)) x", "'( 1 2 ) \n"},
+    {"(counter 5)", "5 \n"},
+    {"x", "Error 404: variable not found: 'x \n"},
+    // Mutating the prelude's vector and hash table
+    {"(vector-set! shared 0 (list 9 9)) shared", "'#( ( 9 9 ) 2 3 ) \n"},
+    {"shared", "'#( 1 2 3 ) \n"},
+    {"(hash-set! table (quote b) (list 2)) (hash-ref table (quote b))", "'( 2 ) \n"},
+    {"(hash-count table)", "1 \n"},
+    // Errors and crashes go back to the client, and the server carries on
+    {"(car 5)", "Error: Can't get car.\n"},
+    {"(define f (lambda (n) (+ 1 (f n)))) (f 1)",
+     "Error: the program was killed by Segmentation fault.\n"},
+    {"(touch (future (lambda () (+ 1 2))))", "3.000000 \n"},
+};
+
+// Sent together for the overlap check: the slow program takes around a
+// second, the fast one hardly any time
+static Check slow = {
+    "(define spin (lambda (k) (if (= k 0) 0 (spin (- k 1))))) "
+    "(define slow (lambda (n) (if (= n 0) (quote done) (begin (spin 5000) (slow (- n 1)))))) "
+    "(slow 20)",
+    "'done \n"};
+static Check fast = {"(+ 1 2)", "3.000000 \n"};
+
+pid_t startServer(char *, char *, char *);
+bool checkOverlap(char *);
+bool answered(Check *, char *);
+void showAnswer(char *, char *);
+int connectTo(char *);
+int sendProgram(char *, char *);
+char *request(char *, char *);
+char *readAll(int);
+
+int main(int argc, char *argv[]) {
+    char *interpreter = "./interpreter";
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+            interpreter = argv[++i];
+        } else {
+            printf("Usage: %s [-i interpreter]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    char directory[] = "/tmp/servertest-XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        printf("Error: can't make a temporary directory: %s\n", strerror(errno));
+        return 1;
+    }
+    char socketPath[64];
+    char preludePath[64];
+    snprintf(socketPath, sizeof(socketPath), "%s/socket", directory);
+    snprintf(preludePath, sizeof(preludePath), "%s/prelude.txt", directory);
+    FILE *out = fopen(preludePath, "w");
+    if (out == NULL) {
+        printf("Error: can't write %s\n", preludePath);
+        return 1;
+    }
+    fputs(prelude, out);
+    fclose(out);
+
+    // A client hanging up early must not kill the test
+    signal(SIGPIPE, SIG_IGN);
+    pid_t server = startServer(interpreter, socketPath, preludePath);
+    int count = sizeof(checks) / sizeof(checks[0]);
+    int passed = 0;
+    for (int i = 0; i < count; i++) {
+        char *got = server > 0 ? request(socketPath, checks[i].program) : NULL;
+        if (got != NULL && !strcmp(got, checks[i].expected)) {
+            printf("PASS    server %d\n", i + 1);
+            passed++;
+        } else {
+            printf("FAIL    server %d: %s\n", i + 1, checks[i].program);
+            showAnswer(checks[i].expected, got);
+        }
+        free(got);
+    }
+    if (server > 0 && checkOverlap(socketPath)) {
+        printf("PASS    server %d\n", count + 1);
+        passed++;
+    } else {
+        printf("FAIL    server %d: a slow and a fast request at the same time\n", count + 1);
+    }
+    count++;
+
+    if (server > 0) {
+        kill(server, SIGTERM);
+        waitpid(server, NULL, 0);
+    }
+    unlink(socketPath);
+    unlink(preludePath);
+    rmdir(directory);
+    printf("%d of %d server checks passed\n", passed, count);
+    return passed == count ? 0 : 1;
+}
+
+/*
+ * Start the interpreter serving in this process (no workers), and wait until
+ * it is listening. Returns its pid, or -1 if it didn't start.
+ */
+pid_t startServer(char *interpreter, char *socketPath, char *preludePath) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        // What the prelude prints doesn't matter
+        freopen("/dev/null", "w", stdout);
+        execl(interpreter, interpreter, "--serve", socketPath, "--prelude", preludePath,
+              "--workers", "0", (char *)NULL);
+        _exit(127);
+    }
+    if (pid < 0) {
+        printf("Error: can't start %s\n", interpreter);
+        return -1;
+    }
+    for (int waited = 0; waited < START_TIMEOUT; waited += 10) {
+        int fd = connectTo(socketPath);
+        if (fd >= 0) {
+            close(fd);
+            return pid;
+        }
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            break;
+        }
+        usleep(10000);
+    }
+    printf("Error: the server didn't start listening on %s\n", socketPath);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+/*
+ * Send the slow program, then the fast one while the slow one is still
+ * running. The fast one's answer should come back before the slow one's.
+ */
+bool checkOverlap(char *path) {
+    int fd = sendProgram(path, slow.program);
+    if (fd < 0) {
+        return false;
+    }
+    char *got = request(path, fast.program);
+    bool ok = answered(&fast, got);
+    free(got);
+    // The slow one is still running, so nothing can be read yet
+    struct pollfd waiting = {fd, POLLIN, 0};
+    if (ok && poll(&waiting, 1, 0) != 0) {
+        printf("        the fast request was held up by the slow one\n");
+        ok = false;
+    }
+    got = readAll(fd);
+    close(fd);
+    ok = answered(&slow, got) && ok;
+    free(got);
+    return ok;
+}
+
+/*
+ * Whether got is what the server should send back for check, reporting it if
+ * not.
+ */
+bool answered(Check *check, char *got) {
+    if (got != NULL && !strcmp(got, check->expected)) {
+        return true;
+    }
+    printf("        %s\n", check->program);
+    showAnswer(check->expected, got);
+    return false;
+}
+
+/*
+ * Show what the server should have sent back, and what it did.
+ */
+void showAnswer(char *expected, char *got) {
+    printf("        expected: %s", expected);
+    char *shown = got == NULL ? "(no answer)" : got[0] == '\0' ? "(nothing)" : got;
+    printf("        got:      %s%s", shown, shown[strlen(shown) - 1] == '\n' ? "" : "\n");
+}
+
+/*
+ * Connect to the socket at path. Returns the connection, or -1.
+ */
+int connectTo(char *path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Send a program to the server without waiting for the answer. Returns the
+ * connection to read it from, or -1 if the server can't be reached.
+ */
+int sendProgram(char *path, char *program) {
+    int fd = connectTo(path);
+    if (fd < 0) {
+        return -1;
+    }
+    size_t length = strlen(program);
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t wrote = write(fd, program + sent, length - sent);
+        if (wrote < 0) {
+            close(fd);
+            return -1;
+        }
+        sent += wrote;
+    }
+    // The server runs the program once it sees the end of it
+    shutdown(fd, SHUT_WR);
+    return fd;
+}
+
+/*
+ * Send a program to the server and return everything it sends back, or NULL
+ * if it can't be reached.
+ */
+char *request(char *path, char *program) {
+    int fd = sendProgram(path, program);
+    if (fd < 0) {
+        return NULL;
+    }
+    char *answer = readAll(fd);
+    close(fd);
+    return answer;
+}
+
+/*
+ * Read from fd until the other end closes it, returning what came as a
+ * string.
+ */
+char *readAll(int fd) {
+    size_t size = 0;
+    size_t capacity = 4096;
+    char *text = malloc(capacity);
+    ssize_t got;
+    while ((got = read(fd, text + size, capacity - size - 1)) != 0) {
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        size += got;
+        if (size == capacity - 1) {
+            capacity *= 2;
+            text = realloc(text, capacity);
+        }
+    }
+    text[size] = '\0';
+    return text;
+}
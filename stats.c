@@ -0,0 +1,158 @@
+// stats.c
+// Counters of what the interpreter does, written as JSON.
+// part of the Racket Interpreter Project
+#include "stats.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "talloc.h"
+
+__thread Stats stats;
+volatile sig_atomic_t statsRequested = 0;
+
+// The counters of every running thread that has counted, guarded by
+// statsLock. When a thread exits, its counters are added into finished.
+struct Counters {
+    Stats *stats;
+    struct Counters *next;
+};
+typedef struct Counters Counters;
+
+Counters *counting = NULL;
+Stats finished;
+pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t statsKey;
+pthread_once_t statsOnce = PTHREAD_ONCE_INIT;
+
+// Names of the value types and special forms, in enum order
+static char *typeNames[VALUE_TYPES] = {"int", "double", "string", "cons", "null",
+    "ptr", "open", "close", "bool", "symbol", "void", "closure", "primitive",
+    "vector", "flvector", "hash", "hamt", "future", "place", "channel", "error"};
+static char *formNames[SPECIAL_FORMS] = {"if", "let", "let*", "letrec", "quote",
+    "define", "lambda", "begin", "set!", "and", "or", "cond", "place",
+    "with-handlers", "time"};
+
+void makeStatsKey();
+void finishStats(void *);
+void addStats(Stats *, Stats *);
+void onStatsSignal(int);
+
+/*
+ * Make sure dumpStats sees this thread's counters, even after it exits.
+ */
+void countStats() {
+    pthread_once(&statsOnce, makeStatsKey);
+    Counters *counters = malloc(sizeof(Counters));
+    counters->stats = &stats;
+    pthread_mutex_lock(&statsLock);
+    counters->next = counting;
+    counting = counters;
+    pthread_mutex_unlock(&statsLock);
+    // The key's destructor runs when the thread exits
+    pthread_setspecific(statsKey, counters);
+}
+
+/*
+ * Make the key whose destructor keeps the counters of exiting threads.
+ */
+void makeStatsKey() {
+    pthread_key_create(&statsKey, finishStats);
+}
+
+/*
+ * A thread is exiting: keep its counts, and stop reading its counters.
+ */
+void finishStats(void *data) {
+    Counters *counters = data;
+    pthread_mutex_lock(&statsLock);
+    addStats(&finished, counters->stats);
+    Counters **link = &counting;
+    while (*link != counters) {
+        link = &(*link)->next;
+    }
+    *link = counters->next;
+    pthread_mutex_unlock(&statsLock);
+    free(counters);
+}
+
+/*
+ * Add the counts of from into total.
+ */
+void addStats(Stats *total, Stats *from) {
+    for (int i = 0; i < VALUE_TYPES; i++) {
+        total->evals[i] += __atomic_load_n(&from->evals[i], __ATOMIC_RELAXED);
+    }
+    for (int i = 0; i < SPECIAL_FORMS; i++) {
+        total->forms[i] += __atomic_load_n(&from->forms[i], __ATOMIC_RELAXED);
+    }
+    total->lookups += __atomic_load_n(&from->lookups, __ATOMIC_RELAXED);
+    total->framesScanned += __atomic_load_n(&from->framesScanned, __ATOMIC_RELAXED);
+    total->bindingsScanned += __atomic_load_n(&from->bindingsScanned, __ATOMIC_RELAXED);
+    total->applies += __atomic_load_n(&from->applies, __ATOMIC_RELAXED);
+    long depth = __atomic_load_n(&from->maxDepth, __ATOMIC_RELAXED);
+    if (depth > total->maxDepth) {
+        total->maxDepth = depth;
+    }
+}
+
+/*
+ * Dump the statistics when the program gets SIGUSR1.
+ */
+void dumpStatsOnSignal() {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onStatsSignal;
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+}
+
+/*
+ * Signal handler for SIGUSR1. Writing JSON isn't safe in a signal handler, so
+ * the dump waits for the next procedure call.
+ */
+void onStatsSignal(int signal) {
+    statsRequested = 1;
+}
+
+/*
+ * Write the statistics of every thread so far to out as JSON.
+ */
+void dumpStats(FILE *out) {
+    statsRequested = 0;
+    Stats total;
+    pthread_mutex_lock(&statsLock);
+    total = finished;
+    for (Counters *counters = counting; counters != NULL; counters = counters->next) {
+        addStats(&total, counters->stats);
+    }
+    pthread_mutex_unlock(&statsLock);
+
+    fprintf(out, "{\n  \"eval\": {");
+    long evals = 0;
+    for (int i = 0; i < VALUE_TYPES; i++) {
+        fprintf(out, "%s\"%s\": %ld", i > 0 ? ", " : "", typeNames[i], total.evals[i]);
+        evals += total.evals[i];
+    }
+    fprintf(out, ", \"total\": %ld},\n  \"special_forms\": {", evals);
+    for (int i = 0; i < SPECIAL_FORMS; i++) {
+        fprintf(out, "%s\"%s\": %ld", i > 0 ? ", " : "", formNames[i], total.forms[i]);
+    }
+    double lookups = total.lookups > 0 ? total.lookups : 1;
+    fprintf(out, "},\n  \"lookups\": {\"calls\": %ld, \"frames_scanned\": %ld, "
+            "\"bindings_scanned\": %ld, \"avg_frames\": %.2f, \"avg_bindings\": %.2f},\n",
+            total.lookups, total.framesScanned, total.bindingsScanned,
+            total.framesScanned / lookups, total.bindingsScanned / lookups);
+    fprintf(out, "  \"talloc\": {");
+    for (int i = 0; i < ALLOC_KINDS; i++) {
+        long allocations, bytes;
+        tallocKindStats(i, &allocations, &bytes);
+        fprintf(out, "%s\"%s\": {\"calls\": %ld, \"bytes\": %ld}", i > 0 ? ", " : "",
+                allocKindName(i), allocations, bytes);
+    }
+    long allocations, bytes;
+    tallocStats(&allocations, &bytes);
+    fprintf(out, ", \"total\": {\"calls\": %ld, \"bytes\": %ld}},\n", allocations, bytes);
+    fprintf(out, "  \"apply\": {\"calls\": %ld, \"max_depth\": %ld}\n}\n",
+            total.applies, total.maxDepth);
+    fflush(out);
+}
@@ -0,0 +1,55 @@
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "value.h"
+
+#ifndef _STATS
+#define _STATS
+
+// Counters of what the interpreter does: how many expressions of each type
+// eval sees, how often each special form runs, how much looking up variables
+// scans, and how many procedure calls there are. With the counts of talloc
+// (see talloc.h) they are written as JSON by dumpStats, which main does at
+// exit for --stats, and whenever the program gets SIGUSR1.
+//
+// The counters are always compiled in. Each thread counts into its own, so
+// counting is just an increment; dumpStats adds up every thread's.
+
+#define VALUE_TYPES (ERROR_TYPE + 1)
+
+enum {FORM_IF, FORM_LET, FORM_LET_STAR, FORM_LETREC, FORM_QUOTE, FORM_DEFINE,
+      FORM_LAMBDA, FORM_BEGIN, FORM_SET, FORM_AND, FORM_OR, FORM_COND,
+      FORM_PLACE, FORM_WITH_HANDLERS, FORM_TIME, SPECIAL_FORMS};
+
+struct Stats {
+    long evals[VALUE_TYPES];
+    long forms[SPECIAL_FORMS];
+    long lookups;
+    long framesScanned;
+    long bindingsScanned;
+    long applies;
+    long maxDepth;
+};
+typedef struct Stats Stats;
+
+// This thread's counters
+extern __thread Stats stats;
+
+// Set by SIGUSR1; the next procedure call dumps the statistics
+extern volatile sig_atomic_t statsRequested;
+
+// Add one to a counter of this thread. Only this thread writes its counters,
+// but dumpStats may read them at any time.
+#define COUNT(counter) \
+    __atomic_store_n(&stats.counter, stats.counter + 1, __ATOMIC_RELAXED)
+
+// Make sure dumpStats sees this thread's counters, even after it exits.
+void countStats();
+
+// Dump the statistics when the program gets SIGUSR1.
+void dumpStatsOnSignal();
+
+// Write the statistics of every thread so far to out as JSON.
+void dumpStats(FILE *out);
+
+#endif
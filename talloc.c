@@ -4,16 +4,63 @@
 // part of the Racket Interpreter Project
 // for CS 251: Programming Language Design and Implementation
 #include "talloc.h"
+#include "sandbox.h"
+#include "stats.h"
+#include "heapprofile.h"
+#include <execinfo.h>
 #include <stdio.h>
+#include <pthread.h>
 // Simple linked list struct
 struct Tlist {
     Value *v;
     struct Tlist *next;
 };
 typedef struct Tlist Tlist;
-    
-// Create head of active list
-Tlist *head = NULL;
+
+// Each thread allocates into its own arena, so talloc never takes a lock.
+// Default arenas are kept in a list of their own so that tfree can find them.
+struct Arena {
+    Tlist *head;
+    // Bytes allocated from it, for the heap profiler
+    long bytes;
+    // Arenas handed over to it by adoptArena, freed along with it. Guarded
+    // by arenaLock, as they may be handed over while it is in use.
+    struct Arena *adopted;
+    struct Arena *next;
+};
+
+// Arena the current thread allocates from; its default arena is created on
+// its first talloc
+static __thread Arena *localArena = NULL;
+
+void freeList(Tlist *);
+void freeContents(Arena *);
+
+// Every default arena created so far, guarded by arenaLock
+Arena *arenas = NULL;
+pthread_mutex_t arenaLock = PTHREAD_MUTEX_INITIALIZER;
+
+// How much one thread has allocated. Each thread counts its own, so counting
+// takes no lock; tallocStats adds them up.
+struct Counts {
+    long allocations[ALLOC_KINDS];
+    long bytes[ALLOC_KINDS];
+    struct Counts *next;
+};
+typedef struct Counts Counts;
+
+// The current thread's counts, made on its first talloc
+static __thread Counts *localCounts = NULL;
+
+// Counts of every thread so far, guarded by arenaLock. They outlive their
+// threads and tfree, so the totals cover the whole program.
+Counts *allCounts = NULL;
+
+void countThread();
+static inline void *allocate(size_t, allocKind) __attribute__((always_inline));
+
+static char *kindNames[ALLOC_KINDS] = {"other", "cons", "number", "frame", "string",
+    "closure", "token"};
 
 // Replacement for malloc that stores the pointers allocated. It should store
 // the pointers in some kind of list; a linked list would do fine, but insert
@@ -21,14 +68,46 @@ Tlist *head = NULL;
 // pre-existing linkedlist.h. Otherwise you'll end up with circular
 // dependencies, since you're going to modify the linked list to use talloc.
 void *talloc(size_t size){
+    return allocate(size, ALLOC_OTHER);
+}
+
+// talloc, for an allocation of the given kind.
+void *tallocKind(size_t size, allocKind kind){
+    return allocate(size, kind);
+}
+
+// What talloc and tallocKind do. It is always inlined into them, so that the
+// heap profiler sees their callers as the first frames of the backtrace.
+static inline void *allocate(size_t size, allocKind kind){
+    // Register an arena for this thread the first time it allocates
+    if (localArena == NULL) {
+        currentArena();
+    }
+    if (localCounts == NULL) {
+        countThread();
+    }
+    useMemory(size + sizeof(Tlist));
+    // Only this thread writes its counts, but tallocStats may read them
+    __atomic_store_n(&localCounts->allocations[kind], localCounts->allocations[kind] + 1,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&localCounts->bytes[kind], localCounts->bytes[kind] + size,
+                     __ATOMIC_RELAXED);
+    if (heapProfiling) {
+        // Frame 0 is talloc itself
+        void *frames[3];
+        int depth = backtrace(frames, 3);
+        recordAllocation(size, kind, depth > 1 ? frames[1] : NULL,
+                         depth > 2 ? frames[2] : NULL);
+    }
     // Create new Tlist node
     Tlist *new = malloc(sizeof(Tlist));
     // Allocate desired memory
     void *new_ptr = malloc(size);
     // Put pointer to allocated memory in active list
     new->v = new_ptr;
-    new->next = head;
-    head = new;
+    new->next = localArena->head;
+    localArena->head = new;
+    localArena->bytes += size;
     // return the pointer
     return new_ptr;
 }
@@ -36,16 +115,143 @@ void *talloc(size_t size){
 // Free all pointers allocated by talloc, as well as whatever memory you
 // allocated in lists to hold those pointers.
 void tfree(){
-// Iterate through active list, free Tlist nodes and associated values
-    Tlist *cur = head;
+    pthread_mutex_lock(&arenaLock);
+    Arena *arena = arenas;
+    while (arena != NULL) {
+        freeContents(arena);
+        Arena *next = arena->next;
+        free(arena);
+        arena = next;
+    }
+    // Reset the arena list
+    arenas = NULL;
+    localArena = NULL;
+    pthread_mutex_unlock(&arenaLock);
+}
+
+// Create a new, empty arena. Unlike the default arenas it is not freed by
+// tfree; whoever made it frees it with freeArena.
+Arena *newArena(){
+    Arena *arena = malloc(sizeof(Arena));
+    arena->head = NULL;
+    arena->bytes = 0;
+    arena->adopted = NULL;
+    arena->next = NULL;
+    return arena;
+}
+
+// Make the current thread allocate from arena, returning the arena it used
+// before (which may be NULL if it had not allocated yet).
+Arena *useArena(Arena *arena){
+    Arena *previous = localArena;
+    localArena = arena;
+    return previous;
+}
+
+// The arena the current thread is allocating from.
+Arena *currentArena(){
+    if (localArena == NULL) {
+        // Make and register this thread's default arena
+        Arena *arena = newArena();
+        pthread_mutex_lock(&arenaLock);
+        arena->next = arenas;
+        arenas = arena;
+        pthread_mutex_unlock(&arenaLock);
+        localArena = arena;
+    }
+    return localArena;
+}
+
+// Free everything allocated from an arena made by newArena, and the arena.
+void freeArena(Arena *arena){
+    pthread_mutex_lock(&arenaLock);
+    freeContents(arena);
+    pthread_mutex_unlock(&arenaLock);
+    if (localArena == arena) {
+        localArena = NULL;
+    }
+    free(arena);
+}
+
+// Hand child, an arena made by newArena that no thread is using any more,
+// over to arena: what was allocated from it is freed when arena is. Unlike
+// talloc, it may be called from any thread while arena is in use.
+void adoptArena(Arena *arena, Arena *child){
+    pthread_mutex_lock(&arenaLock);
+    child->next = arena->adopted;
+    arena->adopted = child;
+    pthread_mutex_unlock(&arenaLock);
+}
+
+// Start counting the current thread's allocations, and its other statistics.
+void countThread(){
+    Counts *counts = calloc(1, sizeof(Counts));
+    countStats();
+    pthread_mutex_lock(&arenaLock);
+    counts->next = allCounts;
+    allCounts = counts;
+    pthread_mutex_unlock(&arenaLock);
+    localCounts = counts;
+}
+
+// How many allocations talloc has made over all threads, and how many bytes
+// they asked for.
+void tallocStats(long *allocations, long *bytes){
+    *allocations = 0;
+    *bytes = 0;
+    for (int kind = 0; kind < ALLOC_KINDS; kind++) {
+        long kindAllocations, kindBytes;
+        tallocKindStats(kind, &kindAllocations, &kindBytes);
+        *allocations += kindAllocations;
+        *bytes += kindBytes;
+    }
+}
+
+// The same, for allocations of one kind.
+void tallocKindStats(allocKind kind, long *allocations, long *bytes){
+    *allocations = 0;
+    *bytes = 0;
+    pthread_mutex_lock(&arenaLock);
+    for (Counts *counts = allCounts; counts != NULL; counts = counts->next) {
+        *allocations += __atomic_load_n(&counts->allocations[kind], __ATOMIC_RELAXED);
+        *bytes += __atomic_load_n(&counts->bytes[kind], __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&arenaLock);
+}
+
+// The name of a kind of allocation, as reported.
+char *allocKindName(allocKind kind){
+    return kindNames[kind];
+}
+
+/*
+ * Free everything allocated from an arena, including the arenas it adopted,
+ * but not the arena itself. The caller holds arenaLock.
+ */
+void freeContents(Arena *arena){
+    freeList(arena->head);
+    if (heapProfiling) {
+        releaseAllocations(arena->bytes);
+    }
+    Arena *child = arena->adopted;
+    while (child != NULL) {
+        Arena *next = child->next;
+        freeContents(child);
+        free(child);
+        child = next;
+    }
+}
+
+/*
+ * Iterate through an active list, freeing Tlist nodes and associated values.
+ */
+void freeList(Tlist *cur){
     while (cur != NULL){
         Tlist *temp = cur->next;
         free(cur->v);
         free(cur);
         cur = temp;
     }
-    // Reset head
-    head = cur;
 }
 
 // Replacement for the C function "exit", that consists of two lines: it calls
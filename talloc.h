@@ -5,6 +5,14 @@
 #define _TALLOC
 
 
+// What an allocation is for. Allocations are counted by kind (see
+// tallocKindStats); whatever isn't one of the common kinds is ALLOC_OTHER.
+typedef enum {ALLOC_OTHER, ALLOC_CONS, ALLOC_NUMBER, ALLOC_FRAME, ALLOC_STRING,
+              ALLOC_CLOSURE, ALLOC_TOKEN, ALLOC_KINDS} allocKind;
+
+// The name of a kind of allocation, as reported.
+char *allocKindName(allocKind kind);
+
 // Replacement for malloc that stores the pointers allocated. It should store
 // the pointers in some kind of list; a linked list would do fine, but insert
 // here whatever code you'll need to do so; don't call functions in the
@@ -12,10 +20,48 @@
 // dependencies, since you're going to modify the linked list to use talloc.
 void *talloc(size_t size);
 
+// talloc, for an allocation of the given kind.
+void *tallocKind(size_t size, allocKind kind);
+
 // Free all pointers allocated by talloc, as well as whatever memory you
 // allocated in lists to hold those pointers.
+//
+// Each thread allocates into its own arena, and tfree frees the arenas of
+// every thread, so it must only be called once no other thread is using
+// memory from talloc (for example after shutdownFutures).
 void tfree();
 
+// A region of memory that talloc allocates from. Each thread allocates into a
+// default arena of its own, made on its first talloc, unless it switches to
+// another arena with useArena.
+typedef struct Arena Arena;
+
+// Create a new, empty arena. Unlike the default arenas it is not freed by
+// tfree; whoever made it frees it with freeArena.
+Arena *newArena();
+
+// Make the current thread allocate from arena, returning the arena it used
+// before (which may be NULL if it had not allocated yet).
+Arena *useArena(Arena *arena);
+
+// The arena the current thread is allocating from.
+Arena *currentArena();
+
+// Free everything allocated from an arena made by newArena, and the arena.
+void freeArena(Arena *arena);
+
+// Hand child, an arena made by newArena that no thread is using any more,
+// over to arena: what was allocated from it is freed when arena is. Unlike
+// talloc, it may be called from any thread while arena is in use.
+void adoptArena(Arena *arena, Arena *child);
+
+// How many allocations talloc has made since the program started, over all
+// threads and arenas, and how many bytes they asked for.
+void tallocStats(long *allocations, long *bytes);
+
+// The same, for allocations of one kind.
+void tallocKindStats(allocKind kind, long *allocations, long *bytes);
+
 // Replacement for the C function "exit", that consists of two lines: it calls
 // tfree before calling exit. It's useful to have later on; if an error happens,
 // you can exit your program, and all memory is automatically cleaned up.
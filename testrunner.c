@@ -0,0 +1,339 @@
+// testrunner.c
+// Runs the golden tests: every interpreter-test-input-NN.txt in a directory
+// is fed to the interpreter, and what it prints is compared with
+// interpreter-test-output-NN.txt. Tests run at the same time, each in its own
+// process, and one that runs too long is killed. If there is an
+// interpreter-test-args-NN.txt, the flags in it (separated by spaces) are
+// passed to the interpreter for that test.
+// part of the Racket Interpreter Project
+//
+// Usage: testrunner [-j jobs] [-t seconds] [-i interpreter] [directory]
+#include <dirent.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define INPUT_PREFIX "interpreter-test-input-"
+#define OUTPUT_PREFIX "interpreter-test-output-"
+#define ARGS_PREFIX "interpreter-test-args-"
+// The most flags an args file may give
+#define MAX_ARGS 16
+
+enum {WAITING, RUNNING, PASSED, FAILED, TIMED_OUT, CRASHED};
+
+// One golden test, and how it went
+struct Test {
+    char *number;
+    char *input;
+    char *expected;
+    // Extra flags for the interpreter, or NULL
+    char *args;
+    // Where the interpreter's stdout and stderr go
+    char *output;
+    char *errors;
+    pid_t pid;
+    int state;
+    // Whether it was killed for running too long
+    bool killed;
+    double started;
+    double ms;
+    long allocations;
+};
+typedef struct Test Test;
+
+int findTests(char *, Test **);
+void startTest(Test *, char *);
+void finishTest(Test *, int);
+bool sameContents(char *, char *, char **, char **);
+char *readFile(char *);
+char *lineAt(char *, int);
+double now();
+int compareTests(const void *, const void *);
+
+int main(int argc, char *argv[]) {
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    double timeout = 10;
+    char *interpreter = "./interpreter";
+    char *directory = ".";
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            timeout = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+            interpreter = argv[++i];
+        } else if (argv[i][0] != '-') {
+            directory = argv[i];
+        } else {
+            printf("Usage: %s [-j jobs] [-t seconds] [-i interpreter] [directory]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (jobs < 1) {
+        jobs = 1;
+    }
+
+    Test *tests;
+    int count = findTests(directory, &tests);
+    if (count == 0) {
+        printf("No tests found in %s\n", directory);
+        return 1;
+    }
+
+    // Keep up to jobs tests running until all have finished
+    double begin = now();
+    int next = 0;
+    int running = 0;
+    int finished = 0;
+    while (finished < count) {
+        while (running < jobs && next < count) {
+            startTest(&tests[next], interpreter);
+            if (tests[next++].state == RUNNING) {
+                running++;
+            } else {
+                finished++;
+            }
+        }
+        int status;
+        struct rusage usage;
+        pid_t pid = wait4(-1, &status, WNOHANG, &usage);
+        if (pid > 0) {
+            for (int i = 0; i < next; i++) {
+                if (tests[i].state == RUNNING && tests[i].pid == pid) {
+                    finishTest(&tests[i], status);
+                    running--;
+                    finished++;
+                }
+            }
+            continue;
+        }
+        // Nothing has finished; kill whatever has run too long
+        double time = now();
+        for (int i = 0; i < next; i++) {
+            if (tests[i].state == RUNNING && time - tests[i].started > timeout * 1000) {
+                kill(tests[i].pid, SIGKILL);
+                tests[i].killed = true;
+            }
+        }
+        usleep(1000);
+    }
+
+    int passed = 0;
+    for (int i = 0; i < count; i++) {
+        Test *test = &tests[i];
+        char *states[] = {"", "", "PASS", "FAIL", "TIMEOUT", "CRASH"};
+        printf("%-7s %s %9.1f ms %11ld allocations\n", states[test->state],
+               test->number, test->ms, test->allocations);
+        if (test->state == PASSED) {
+            passed++;
+        } else if (test->state == FAILED) {
+            char *expected, *got;
+            sameContents(test->expected, test->output, &expected, &got);
+            printf("        expected: %s\n        got:      %s\n", expected, got);
+        }
+        unlink(test->output);
+        unlink(test->errors);
+    }
+    printf("%d of %d tests passed in %.1f ms\n", passed, count, now() - begin);
+    return passed == count ? 0 : 1;
+}
+
+/*
+ * Find every test with both an input and an output file in directory, in
+ * order of number. Returns how many there are.
+ */
+int findTests(char *directory, Test **tests) {
+    DIR *dir = opendir(directory);
+    if (dir == NULL) {
+        return 0;
+    }
+    int count = 0;
+    int capacity = 16;
+    *tests = malloc(sizeof(Test) * capacity);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char *name = entry->d_name;
+        size_t length = strlen(name);
+        if (strncmp(name, INPUT_PREFIX, strlen(INPUT_PREFIX)) ||
+            length < 4 || strcmp(name + length - 4, ".txt")) {
+            continue;
+        }
+        Test test;
+        test.number = strndup(name + strlen(INPUT_PREFIX),
+                              length - strlen(INPUT_PREFIX) - 4);
+        test.input = malloc(strlen(directory) + length + 2);
+        sprintf(test.input, "%s/%s", directory, name);
+        test.expected = malloc(strlen(directory) + strlen(OUTPUT_PREFIX) + strlen(test.number) + 6);
+        sprintf(test.expected, "%s/%s%s.txt", directory, OUTPUT_PREFIX, test.number);
+        if (access(test.expected, R_OK) != 0) {
+            continue;
+        }
+        char *argsPath = malloc(strlen(directory) + strlen(ARGS_PREFIX) + strlen(test.number) + 6);
+        sprintf(argsPath, "%s/%s%s.txt", directory, ARGS_PREFIX, test.number);
+        test.args = readFile(argsPath);
+        free(argsPath);
+        test.state = WAITING;
+        test.ms = 0;
+        test.allocations = 0;
+        if (count == capacity) {
+            capacity *= 2;
+            *tests = realloc(*tests, sizeof(Test) * capacity);
+        }
+        (*tests)[count++] = test;
+    }
+    closedir(dir);
+    qsort(*tests, count, sizeof(Test), compareTests);
+    return count;
+}
+
+/*
+ * Start the interpreter on a test, with its output going to temporary files.
+ */
+void startTest(Test *test, char *interpreter) {
+    char outputName[] = "/tmp/testrunner-out-XXXXXX";
+    char errorsName[] = "/tmp/testrunner-err-XXXXXX";
+    int output = mkstemp(outputName);
+    int errors = mkstemp(errorsName);
+    test->output = strdup(outputName);
+    test->errors = strdup(errorsName);
+    fflush(stdout);
+    test->started = now();
+    test->state = RUNNING;
+    test->killed = false;
+    test->pid = fork();
+    if (test->pid == 0) {
+        if (freopen(test->input, "r", stdin) == NULL) {
+            _exit(127);
+        }
+        dup2(output, STDOUT_FILENO);
+        dup2(errors, STDERR_FILENO);
+        char *argv[MAX_ARGS + 3] = {interpreter, "--alloc-stats"};
+        int argc = 2;
+        char *arg = test->args != NULL ? strtok(test->args, " \t\n") : NULL;
+        while (arg != NULL && argc < MAX_ARGS + 2) {
+            argv[argc++] = arg;
+            arg = strtok(NULL, " \t\n");
+        }
+        argv[argc] = NULL;
+        execv(interpreter, argv);
+        _exit(127);
+    }
+    close(output);
+    close(errors);
+    if (test->pid < 0) {
+        test->state = CRASHED;
+    }
+}
+
+/*
+ * Record how a test that has exited went.
+ */
+void finishTest(Test *test, int status) {
+    test->ms = now() - test->started;
+    char *errors = readFile(test->errors);
+    char *report = errors != NULL ? strstr(errors, "allocations: ") : NULL;
+    if (report != NULL) {
+        sscanf(report, "allocations: %ld", &test->allocations);
+    }
+    free(errors);
+
+    // Tests may expect errors, so only a signal counts as a crash
+    if (WIFSIGNALED(status)) {
+        test->state = test->killed ? TIMED_OUT : CRASHED;
+    } else if (WEXITSTATUS(status) == 127) {
+        test->state = CRASHED;
+    } else {
+        char *expected, *got;
+        test->state = sameContents(test->expected, test->output, &expected, &got) ?
+            PASSED : FAILED;
+    }
+}
+
+/*
+ * Whether two files hold the same text. If not, expected and got are set to
+ * the first line where they differ.
+ */
+bool sameContents(char *expectedPath, char *gotPath, char **expected, char **got) {
+    char *a = readFile(expectedPath);
+    char *b = readFile(gotPath);
+    if (a == NULL || b == NULL) {
+        *expected = a != NULL ? a : "(can't read)";
+        *got = b != NULL ? b : "(can't read)";
+        return false;
+    }
+    if (!strcmp(a, b)) {
+        return true;
+    }
+    int line = 0;
+    for (size_t i = 0; a[i] == b[i]; i++) {
+        if (a[i] == '\n') {
+            line++;
+        }
+    }
+    *expected = lineAt(a, line);
+    *got = lineAt(b, line);
+    return false;
+}
+
+/*
+ * The whole of a file as a string, or NULL if it can't be read.
+ */
+char *readFile(char *path) {
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        return NULL;
+    }
+    size_t size = 0;
+    size_t capacity = 4096;
+    char *text = malloc(capacity);
+    size_t got;
+    while ((got = fread(text + size, 1, capacity - size - 1, in)) > 0) {
+        size += got;
+        if (size == capacity - 1) {
+            capacity *= 2;
+            text = realloc(text, capacity);
+        }
+    }
+    text[size] = '\0';
+    fclose(in);
+    return text;
+}
+
+/*
+ * A copy of line number line (counting from 0) of text, or "(end of output)".
+ */
+char *lineAt(char *text, int line) {
+    for (int i = 0; i < line && text != NULL; i++) {
+        text = strchr(text, '\n');
+        if (text != NULL) {
+            text++;
+        }
+    }
+    if (text == NULL || *text == '\0') {
+        return "(end of output)";
+    }
+    return strndup(text, strcspn(text, "\n"));
+}
+
+/*
+ * The time in milliseconds from a monotonic clock.
+ */
+double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000.0 + time.tv_nsec / 1e6;
+}
+
+/*
+ * Order tests by number, for qsort.
+ */
+int compareTests(const void *a, const void *b) {
+    return strcmp(((const Test *)a)->number, ((const Test *)b)->number);
+}
@@ -4,9 +4,19 @@
 #include "linkedlist.h"
 #include "value.h"
 #include "talloc.h"
+#include "error.h"
+#include "output.h"
+#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 
+// Where the tokenizer is reading from, and which line of the source it is on
+struct Lexer {
+    FILE *in;
+    int line;
+};
+typedef struct Lexer Lexer;
+
 //declare functions here since we are not allowed
 //to edit the header files
 int isDigit(char);
@@ -14,18 +24,34 @@ int isInitial(char);
 int isLetter(char);
 int isSubsequent(char);
 int isWhitespace(char);
+char readChar(Lexer *);
+void unreadChar(char, Lexer *);
+char *syntaxError(Lexer *, char *, ...);
 
 
 // Read all of the input from stdin, and return a linked list consisting of the
 // tokens.
 Value *tokenize(){
+    char *error;
+    Value *list = tokenizeFile(stdin, 1, &error);
+    if (list == NULL) {
+        raiseError("%s", error);
+    }
+    return list;
+}
+
+// Read all of the input from in, which starts at line firstLine of the
+// source, and return a linked list consisting of the tokens. On a syntax
+// error, return NULL and point *error at the message.
+Value *tokenizeFile(FILE *in, int firstLine, char **error){
+    Lexer lexer = {in, firstLine};
     char charRead;
     Value *list = makeNull();
-    charRead = fgetc(stdin);
+    charRead = readChar(&lexer);
     
     //create buffer for temporarily storing strings
     int bufferSize = 50;
-    char *bufferArray = talloc(sizeof(char)*bufferSize);
+    char *bufferArray = tallocKind(sizeof(char)*bufferSize, ALLOC_TOKEN);
 
     while (charRead != EOF) {
         //open paren
@@ -47,22 +73,22 @@ Value *tokenize(){
         // string
         else if (charRead == '\"') {
             int count = 0;
-            charRead = fgetc(stdin);
+            charRead = readChar(&lexer);
             // While we have not reached the end of the string, add chars to the buffer
             while (charRead != '\"'){
                 // If the file ends before the end of the string, error
                 if(charRead == EOF){
-                    printf("Syntax error: encountered EOF in middle of string\n");
-                    texit(EXIT_FAILURE);
+                    *error = syntaxError(&lexer, "encountered EOF in middle of string");
+                    return NULL;
                 }
                 // if string is too long for storage buffer, make the buffer bigger
                 if (count + 2 >= bufferSize){
                     bufferSize += 50;
-                    char *temp = talloc(sizeof(char)*bufferSize);
+                    char *temp = tallocKind(sizeof(char)*bufferSize, ALLOC_TOKEN);
                     strcpy(temp,bufferArray);
                     bufferArray = temp;
                 }
-                char nextChar = fgetc(stdin);
+                char nextChar = readChar(&lexer);
                 // If the next character is a quote and cur char is a backslash, 
                 // it's an escaped quote, not the end of the string
                 if(nextChar == '\"' && charRead == '\\'){
@@ -70,7 +96,7 @@ Value *tokenize(){
                         bufferArray[count + 1] = nextChar;
                         count++;
                         
-                        charRead = fgetc(stdin);
+                        charRead = readChar(&lexer);
                 } else {
                     bufferArray[count] = charRead;
                     charRead = nextChar;
@@ -81,7 +107,7 @@ Value *tokenize(){
             // and copy into a new char array
             bufferArray[count] = '\0';
             count++;
-            char *finalStr = talloc(sizeof(char)*count);
+            char *finalStr = tallocKind(sizeof(char)*count, ALLOC_STRING);
             strcpy(finalStr,bufferArray);
             
             // Create a new node, put the string in it, add to the linked list
@@ -93,10 +119,10 @@ Value *tokenize(){
         } 
         // boolean
         else if (charRead == '#'){
-            charRead = fgetc(stdin);
+            charRead = readChar(&lexer);
             //check to make sure t or f follows # sign
             if (charRead == 't' || charRead == 'f'){
-                char nextChar = fgetc(stdin);
+                char nextChar = readChar(&lexer);
                 //check to make sure there's nothing else besides t or f
                 if (isWhitespace(nextChar) || nextChar == ')' || nextChar == '('){
                     //create node and add to list of tokens
@@ -112,13 +138,13 @@ Value *tokenize(){
                     
                 }
                 else{
-                    printf("Syntax error: not a boolean\n");
-                    texit(EXIT_FAILURE);
+                    *error = syntaxError(&lexer, "not a boolean");
+                    return NULL;
                 }
-                ungetc(nextChar, stdin);
+                unreadChar(nextChar, &lexer);
             } else {
-                printf("Syntax error: not a boolean\n");
-                texit(EXIT_FAILURE);
+                *error = syntaxError(&lexer, "not a boolean");
+                return NULL;
             }
             
         } 
@@ -130,7 +156,7 @@ Value *tokenize(){
             int count = 1;
             //add first thing to buffer (to check if it's + or - later)
             bufferArray[0] = charRead;
-            charRead = fgetc(stdin);
+            charRead = readChar(&lexer);
             //while we haven't yet reached the end of the number
             while (!isWhitespace(charRead) && charRead != ')' && charRead != '(' && charRead != EOF){
                 //check if next thing is digit or period
@@ -138,8 +164,8 @@ Value *tokenize(){
                     // if it's a period, make sure it's the only period
                     if (charRead == '.'){
                         if (seenPeriod){
-                            printf("Syntax error: too many decimal points in the number\n");
-                            texit(EXIT_FAILURE);
+                            *error = syntaxError(&lexer, "too many decimal points in the number");
+                            return NULL;
                         }
                         else {
                             seenPeriod = 1;
@@ -148,7 +174,7 @@ Value *tokenize(){
                     // if string too long for storage buffer, increase size
                     if (count >= bufferSize){
                         bufferSize += 50;
-                        char *temp = talloc(sizeof(char)*bufferSize);
+                        char *temp = tallocKind(sizeof(char)*bufferSize, ALLOC_TOKEN);
                         strcpy(temp,bufferArray);
                         bufferArray = temp;
                     }
@@ -156,13 +182,13 @@ Value *tokenize(){
                     count++;  
                 }
                 else {
-                    printf("Syntax error: Not a Number\n");
-                    texit(EXIT_FAILURE);
+                    *error = syntaxError(&lexer, "Not a Number");
+                    return NULL;
                 }
-                charRead = fgetc(stdin);
+                charRead = readChar(&lexer);
             }
             //we got one too many things, so put one back
-            ungetc(charRead, stdin);
+            unreadChar(charRead, &lexer);
             bufferArray[count] = '\0';
             count++;
             //check if current string is only a + or - sign
@@ -170,7 +196,7 @@ Value *tokenize(){
                 //if so, treat it like a symbol
                 Value *node = talloc(sizeof(Value));
                 node->type = SYMBOL_TYPE;
-                char *symbol = talloc(sizeof(char) * 2);
+                char *symbol = tallocKind(sizeof(char) * 2, ALLOC_STRING);
                 strcpy(symbol,bufferArray);
                 node->s = symbol;
                 list = cons(node, list);
@@ -178,9 +204,9 @@ Value *tokenize(){
             else{
                 //create a string of the correct size, and copy
                 //the bufferArray we have into that string
-                char *finalStr = talloc(sizeof(char)*count);
+                char *finalStr = tallocKind(sizeof(char)*count, ALLOC_STRING);
                 strcpy(finalStr,bufferArray);
-                Value *node = talloc(sizeof(Value));
+                Value *node = tallocKind(sizeof(Value), ALLOC_NUMBER);
                 //change that string into a float or int, based on type
                 if (seenPeriod){
                     float finalFloat;
@@ -213,7 +239,7 @@ Value *tokenize(){
                     // if string too long for storage buffer, increase size
                     if (count >= bufferSize){
                         bufferSize += 50;
-                        char *temp = talloc(sizeof(char)*bufferSize);
+                        char *temp = tallocKind(sizeof(char)*bufferSize, ALLOC_TOKEN);
                         strcpy(temp,bufferArray);
                         bufferArray = temp;
                     }
@@ -221,16 +247,16 @@ Value *tokenize(){
                     count++;
                 }
                 else {
-                    printf("Syntax error: Not a valid symbol %c\n", charRead);
-                    texit(EXIT_FAILURE);
+                    *error = syntaxError(&lexer, "Not a valid symbol %c", charRead);
+                    return NULL;
                 }
-                charRead = fgetc(stdin);
+                charRead = readChar(&lexer);
             }
-            ungetc(charRead, stdin);
+            unreadChar(charRead, &lexer);
             bufferArray[count] = '\0';
             count++;
             //put symbol in new array of proper size
-            char *finalStr = talloc(sizeof(char)*count);
+            char *finalStr = tallocKind(sizeof(char)*count, ALLOC_STRING);
             strcpy(finalStr,bufferArray);
             
             //store it in token list
@@ -244,16 +270,16 @@ Value *tokenize(){
         //comment
         else if (charRead == ';'){
             while (charRead != '\n' && charRead != EOF){
-                charRead = fgetc(stdin);
+                charRead = readChar(&lexer);
             }
         }
         // unrecognized character
         else {
-            printf("Syntax error: Character %c unknown\n", charRead);
-            texit(EXIT_FAILURE);  
+            *error = syntaxError(&lexer, "Character %c unknown", charRead);
+            return NULL;
         }
 
-        charRead = fgetc(stdin);
+        charRead = readChar(&lexer);
         
     }
     //TODO: maybe add makeNull to end of list here???????
@@ -261,6 +287,41 @@ Value *tokenize(){
     return revList;
 }
 
+/*
+read the next character, keeping track of the line number
+*/
+char readChar(Lexer *lexer){
+    char c = fgetc(lexer->in);
+    if (c == '\n'){
+        lexer->line++;
+    }
+    return c;
+}
+
+/*
+put back the character c, which was the last one read
+*/
+void unreadChar(char c, Lexer *lexer){
+    if (c == '\n'){
+        lexer->line--;
+    }
+    ungetc(c, lexer->in);
+}
+
+/*
+make the message for a syntax error found at the current line
+*/
+char *syntaxError(Lexer *lexer, char *format, ...){
+    char detail[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(detail, sizeof(detail), format, args);
+    va_end(args);
+    char *message = talloc(sizeof(char) * (strlen(detail) + 40));
+    sprintf(message, "Syntax error: %s at line %i", detail, lexer->line);
+    return message;
+}
+
 /*
 check if the given character c is a digit
 */
@@ -300,36 +361,49 @@ int isWhitespace(char c){
 }
 
 // Displays the contents of the linked list as tokens, with type information
+// Nested lists are walked with a stack (see output.h), not by recursing.
 void displayTokens(Value *list){
-    
-        switch(list->type){
+    Output *output = standardOutput();
+    int base = output->depth;
+    pushItem(output, list, NULL);
+    Item item;
+    while (popItem(output, base, &item)) {
+        Value *token = item.value;
+        switch(token->type){
             case NULL_TYPE:
-                printf("\n");
+                writeChar(output, '\n');
                 break;
             case CONS_TYPE:
-                displayTokens(car(list));
-                displayTokens(cdr(list));
+                //the car is displayed first, so it is pushed last
+                pushItem(output, cdr(token), NULL);
+                pushItem(output, car(token), NULL);
                 break;
             case INT_TYPE:
-                printf("%i : integer\n", list->i);
+                writeLong(output, token->i);
+                writeText(output, " : integer\n");
                 break;
             case DOUBLE_TYPE:
-                printf("%f : float\n", list->d);
+                writeDouble(output, token->d);
+                writeText(output, " : float\n");
                 break;
             case STR_TYPE:
-                printf("\"%s\" : string\n", list->s);
+                writeChar(output, '"');
+                writeText(output, token->s);
+                writeText(output, "\" : string\n");
                 break;
             case BOOL_TYPE:
-                printf("%s : boolean\n", list->s);
+                writeText(output, token->s);
+                writeText(output, " : boolean\n");
                 break;
             case OPEN_TYPE:
-                printf("( : open\n");
+                writeText(output, "( : open\n");
                 break;
             case CLOSE_TYPE:
-                printf(") : close\n");
+                writeText(output, ") : close\n");
                 break;
             case SYMBOL_TYPE:
-                printf("%s : symbol\n", list->s);
+                writeText(output, token->s);
+                writeText(output, " : symbol\n");
                 break;
             
             //added this to surpress warning
@@ -337,15 +411,7 @@ void displayTokens(Value *list){
                 break;
             default:
                 break;
+        }
     }
-
+    flushOutput(output);
 }
-    
-    
-    
-    
-    
-    
-    
-    
-    
\ No newline at end of file
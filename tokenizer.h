@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include "value.h"
 
 #ifndef _TOKENIZER
@@ -7,6 +8,11 @@
 // tokens.
 Value *tokenize();
 
+// Read all of the input from in, which starts at line firstLine of the
+// source, and return a linked list consisting of the tokens. On a syntax
+// error, return NULL and point *error at the message.
+Value *tokenizeFile(FILE *in, int firstLine, char **error);
+
 // Displays the contents of the linked list as tokens, with type information
 void displayTokens(Value *list);
 
@@ -0,0 +1,451 @@
+// toplevel.c
+// Evaluation of independent top-level forms in parallel.
+// part of the Racket Interpreter Project
+#include "toplevel.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "future.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "error.h"
+#include "sandbox.h"
+#include "output.h"
+
+// A set of variable names
+struct Names {
+    int count;
+    int capacity;
+    char **items;
+};
+typedef struct Names Names;
+
+// What is known about one top-level form
+struct TopForm {
+    Value *expr;
+    // For (define name value): the name and value expression, else NULL
+    char *name;
+    Value *valueExpr;
+    // Variables it reads itself, and through the defines it uses
+    Names reads;
+    Names allReads;
+    // Whether it mutates or does something else that must not overlap
+    bool unsafe;
+    // Whether it must run alone
+    bool barrier;
+    int level;
+    bool done;
+    // What it printed, and for a define the value to bind; or what it
+    // raised, if it failed
+    Value *result;
+    Value *value;
+    Value *error;
+    Frame *frame;
+};
+typedef struct TopForm TopForm;
+
+void analyzeForm(TopForm *, Frame *);
+void resolveReads(TopForm *, int, Frame *);
+void collectReads(Value *, Names *, Names *, bool *, bool);
+void collectEach(Value *, Names *, Names *, bool *, bool);
+void collectLet(Value *, bool, bool, Names *, Names *, bool *);
+bool isKeyword(char *);
+bool isUnsafeName(char *);
+bool isBound(char *, Frame *);
+void runForm(void *);
+Names copyNames(Names *);
+void addName(Names *, char *);
+bool hasName(Names *, char *);
+
+/*
+ * Evaluate each expression of a program at the top level of interp, running
+ * independent forms in parallel, and print each result in program order.
+ * Returns the number of forms that raised errors.
+ */
+int interpretParallel(Interp *interp, Value *tree) {
+    startRun(&interp->limits);
+    int count = length(tree);
+    TopForm *forms = talloc(sizeof(TopForm) * (count + 1));
+
+    // Work out what each form reads and where it has to wait
+    Value *cur = tree;
+    for (int i = 0; i < count; i++) {
+        forms[i].expr = car(cur);
+        forms[i].frame = interp->topFrame;
+        analyzeForm(&forms[i], interp->topFrame);
+        cur = cdr(cur);
+    }
+    int levels = 0;
+    int floor = 0;
+    for (int i = 0; i < count; i++) {
+        resolveReads(forms, i, interp->topFrame);
+        if (forms[i].barrier) {
+            // After everything before it, and before everything after it
+            forms[i].level = levels;
+            floor = levels + 1;
+        } else if (forms[i].level < floor) {
+            forms[i].level = floor;
+        }
+        if (forms[i].level + 1 > levels) {
+            levels = forms[i].level + 1;
+        }
+    }
+
+    // Run one level at a time, printing whatever is finished in order
+    Task **tasks = talloc(sizeof(Task *) * (count + 1));
+    int printed = 0;
+    int errors = 0;
+    for (int level = 0; level < levels; level++) {
+        int started = 0;
+        int last = -1;
+        for (int i = printed; i < count; i++) {
+            if (forms[i].level != level) {
+                continue;
+            }
+            // The last form of the level runs on this thread
+            if (last != -1) {
+                tasks[started++] = spawnTask(runForm, &forms[last]);
+            }
+            last = i;
+        }
+        if (last != -1) {
+            runForm(&forms[last]);
+        }
+        for (int i = 0; i < started; i++) {
+            joinTask(tasks[i]);
+        }
+
+        // Bind this level's defines, now that no form is running
+        for (int i = printed; i < count; i++) {
+            if (forms[i].level == level) {
+                if (forms[i].name != NULL && !forms[i].barrier && forms[i].error == NULL) {
+                    bindValue(forms[i].name, forms[i].value, interp->topFrame);
+                }
+                forms[i].done = true;
+            }
+        }
+        while (printed < count && forms[printed].done) {
+            if (forms[printed].error != NULL) {
+                printf("%s\n", errorMessage(forms[printed].error));
+                errors++;
+                // Going over a limit ends the run, as in interpretIn
+                if (isLimitError(forms[printed].error)) {
+                    return errors;
+                }
+            } else if (forms[printed].result->type != VOID_TYPE) {
+                display(forms[printed].result);
+                writeChar(standardOutput(), '\n');
+                flushOutput(standardOutput());
+            }
+            printed++;
+        }
+    }
+    return errors;
+}
+
+/*
+ * Find the variables a form reads, and whether it is a plain define and
+ * whether it does anything unsafe.
+ */
+void analyzeForm(TopForm *form, Frame *frame) {
+    Value *expr = form->expr;
+    form->name = NULL;
+    form->valueExpr = NULL;
+    form->reads.count = 0;
+    form->reads.capacity = 0;
+    form->reads.items = NULL;
+    form->unsafe = false;
+    form->barrier = false;
+    form->level = 0;
+    form->done = false;
+    form->result = NULL;
+    form->error = NULL;
+
+    Names bound = {0, 0, NULL};
+    if (expr->type == CONS_TYPE && car(expr)->type == SYMBOL_TYPE &&
+        !strcmp(car(expr)->s, "define")) {
+        Value *args = cdr(expr);
+        // Anything but (define name value) is left to evalDefine to report
+        if (args->type != CONS_TYPE || car(args)->type != SYMBOL_TYPE ||
+            cdr(args)->type != CONS_TYPE || cdr(cdr(args))->type != NULL_TYPE) {
+            form->barrier = true;
+            return;
+        }
+        form->name = car(args)->s;
+        form->valueExpr = car(cdr(args));
+        collectReads(form->valueExpr, &bound, &form->reads, &form->unsafe, false);
+    } else {
+        collectReads(expr, &bound, &form->reads, &form->unsafe, false);
+    }
+}
+
+/*
+ * Follow the variables form i reads through the defines before it, making it
+ * depend on the latest define of each. Decides whether the form must run
+ * alone, and its earliest level.
+ */
+void resolveReads(TopForm *forms, int i, Frame *frame) {
+    TopForm *form = &forms[i];
+    if (form->barrier) {
+        form->allReads = copyNames(&form->reads);
+        return;
+    }
+    Names reads = copyNames(&form->reads);
+    bool unsafe = form->unsafe;
+    bool undefined = false;
+    int level = 0;
+    // reads grows as calls are followed, so this visits every name reached
+    for (int k = 0; k < reads.count; k++) {
+        char *name = reads.items[k];
+        if (isUnsafeName(name)) {
+            unsafe = true;
+        }
+        int writer = -1;
+        for (int j = i - 1; j >= 0; j--) {
+            if (forms[j].name != NULL && !strcmp(forms[j].name, name)) {
+                writer = j;
+                break;
+            }
+        }
+        if (writer != -1) {
+            if (forms[writer].level + 1 > level) {
+                level = forms[writer].level + 1;
+            }
+            unsafe = unsafe || forms[writer].unsafe;
+            // Every earlier define of the name could be the one called
+            for (int j = writer; j >= 0; j--) {
+                if (forms[j].name != NULL && !strcmp(forms[j].name, name)) {
+                    for (int r = 0; r < forms[j].reads.count; r++) {
+                        addName(&reads, forms[j].reads.items[r]);
+                    }
+                }
+            }
+        } else if (!isBound(name, frame) &&
+                   (form->name == NULL || strcmp(name, form->name))) {
+            // Undefined here: let it fail in its proper place
+            undefined = true;
+        }
+    }
+
+    // A define must come after earlier forms that use or define its name
+    if (form->name != NULL) {
+        for (int j = 0; j < i; j++) {
+            if ((forms[j].name != NULL && !strcmp(forms[j].name, form->name)) ||
+                hasName(&forms[j].allReads, form->name)) {
+                if (forms[j].level + 1 > level) {
+                    level = forms[j].level + 1;
+                }
+            }
+        }
+    }
+    form->allReads = reads;
+    form->barrier = unsafe || undefined;
+    form->level = level;
+}
+
+/*
+ * Add the variables expr reads that are not in bound to reads. Sets *unsafe
+ * if it mutates anything. inBody says whether expr is directly in the body of
+ * a lambda or let, where a define only binds a local variable.
+ */
+void collectReads(Value *expr, Names *bound, Names *reads, bool *unsafe, bool inBody) {
+    if (expr->type == SYMBOL_TYPE) {
+        if (!hasName(bound, expr->s) && !isKeyword(expr->s)) {
+            addName(reads, expr->s);
+        }
+        return;
+    }
+    if (expr->type != CONS_TYPE) {
+        return;
+    }
+    Value *first = car(expr);
+    Value *args = cdr(expr);
+    if (first->type != SYMBOL_TYPE) {
+        collectEach(expr, bound, reads, unsafe, false);
+        return;
+    }
+    if (!strcmp(first->s, "quote")) {
+        return;
+    }
+    if (!strcmp(first->s, "lambda") && args->type == CONS_TYPE) {
+        Names inner = copyNames(bound);
+        Value *params = car(args);
+        if (params->type == SYMBOL_TYPE) {
+            addName(&inner, params->s);
+        }
+        for (; params->type == CONS_TYPE; params = cdr(params)) {
+            if (car(params)->type == SYMBOL_TYPE) {
+                addName(&inner, car(params)->s);
+            }
+        }
+        collectEach(cdr(args), &inner, reads, unsafe, true);
+    }
+    else if (!strcmp(first->s, "let") || !strcmp(first->s, "let*") ||
+             !strcmp(first->s, "letrec")) {
+        collectLet(args, !strcmp(first->s, "let*"), !strcmp(first->s, "letrec"),
+                   bound, reads, unsafe);
+    }
+    else if (!strcmp(first->s, "define")) {
+        if (!inBody || args->type != CONS_TYPE || car(args)->type != SYMBOL_TYPE) {
+            *unsafe = true;
+        } else {
+            // Visible to the rest of the body it is in
+            addName(bound, car(args)->s);
+        }
+        collectEach(args, bound, reads, unsafe, false);
+    }
+    else {
+        // time prints its report as it finishes, so it has to run in its turn
+        if (!strcmp(first->s, "set!") || !strcmp(first->s, "place") ||
+            !strcmp(first->s, "time")) {
+            *unsafe = true;
+        }
+        collectEach(expr, bound, reads, unsafe, false);
+    }
+}
+
+/*
+ * collectReads on each item of a list.
+ */
+void collectEach(Value *list, Names *bound, Names *reads, bool *unsafe, bool inBody) {
+    for (; list->type == CONS_TYPE; list = cdr(list)) {
+        collectReads(car(list), bound, reads, unsafe, inBody);
+    }
+}
+
+/*
+ * collectReads on the arguments of a let, let* (sequential) or letrec
+ * (recursive) expression.
+ */
+void collectLet(Value *args, bool sequential, bool recursive,
+                Names *bound, Names *reads, bool *unsafe) {
+    if (args->type != CONS_TYPE) {
+        *unsafe = true;
+        return;
+    }
+    Names inner = copyNames(bound);
+    Value *binding;
+    for (binding = car(args); binding->type == CONS_TYPE; binding = cdr(binding)) {
+        if (car(binding)->type == CONS_TYPE && car(car(binding))->type == SYMBOL_TYPE &&
+            recursive) {
+            addName(&inner, car(car(binding))->s);
+        }
+    }
+    for (binding = car(args); binding->type == CONS_TYPE; binding = cdr(binding)) {
+        Value *pair = car(binding);
+        if (pair->type != CONS_TYPE || car(pair)->type != SYMBOL_TYPE) {
+            // Malformed: evalLet will complain
+            *unsafe = true;
+            continue;
+        }
+        collectEach(cdr(pair), sequential || recursive ? &inner : bound, reads, unsafe, false);
+        addName(&inner, car(pair)->s);
+    }
+    collectEach(cdr(args), &inner, reads, unsafe, true);
+}
+
+/*
+ * Whether name is one of the special forms eval knows, or cond's else, which
+ * are never looked up as variables.
+ */
+bool isKeyword(char *name) {
+    char *keywords[] = {"if", "let", "let*", "letrec", "quote", "define", "lambda",
+                        "begin", "set!", "and", "or", "cond", "place", "with-handlers",
+                        "time", "else"};
+    for (int i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+        if (!strcmp(name, keywords[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Whether a primitive with this name has effects that other forms can see.
+ */
+bool isUnsafeName(char *name) {
+    int size = strlen(name);
+    return (size > 0 && name[size - 1] == '!') || !strncmp(name, "place", 5);
+}
+
+/*
+ * Whether name is bound in frame, which is the top-level frame before any
+ * form has run, so holds just the primitives.
+ */
+bool isBound(char *name, Frame *frame) {
+    for (Value *cur = frame->bindings; cur->type == CONS_TYPE; cur = cdr(cur)) {
+        if (!strcmp(car(car(cur))->s, name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Evaluate one top-level form. A define's value is computed here, but it is
+ * bound afterwards, once nothing is running. An error is kept to be printed
+ * in its turn.
+ */
+void runForm(void *data) {
+    TopForm *form = data;
+    ErrorTrap trap;
+    pushErrorTrap(&trap);
+    if (setjmp(trap.jump) != 0) {
+        form->error = trap.raised;
+        return;
+    }
+    if (form->name != NULL && !form->barrier) {
+        form->value = eval(form->valueExpr, form->frame);
+        // What evalDefine would have returned
+        form->result = makeNull();
+        form->result->type = VOID_TYPE;
+    } else {
+        form->result = eval(form->expr, form->frame);
+    }
+    popErrorTrap(&trap);
+}
+
+/*
+ * Make a copy of a set of names that can be added to separately.
+ */
+Names copyNames(Names *names) {
+    Names copy;
+    copy.count = names->count;
+    copy.capacity = names->count + 8;
+    copy.items = talloc(sizeof(char *) * copy.capacity);
+    for (int i = 0; i < names->count; i++) {
+        copy.items[i] = names->items[i];
+    }
+    return copy;
+}
+
+/*
+ * Add a name to a set, if it isn't already there.
+ */
+void addName(Names *names, char *name) {
+    if (hasName(names, name)) {
+        return;
+    }
+    if (names->count == names->capacity) {
+        names->capacity = names->capacity * 2 + 8;
+        char **items = talloc(sizeof(char *) * names->capacity);
+        for (int i = 0; i < names->count; i++) {
+            items[i] = names->items[i];
+        }
+        names->items = items;
+    }
+    names->items[names->count++] = name;
+}
+
+/*
+ * Whether a set contains a name.
+ */
+bool hasName(Names *names, char *name) {
+    for (int i = 0; i < names->count; i++) {
+        if (!strcmp(names->items[i], name)) {
+            return true;
+        }
+    }
+    return false;
+}
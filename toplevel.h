@@ -0,0 +1,29 @@
+#include "value.h"
+#include "interpreter.h"
+
+#ifndef _TOPLEVEL
+#define _TOPLEVEL
+
+// Parallel top-level evaluation (the --parallel-toplevel mode).
+//
+// Before running anything, each top-level form is checked for the variables
+// it reads, following calls through earlier defines, and made to depend on
+// the latest earlier define of each. A define also depends on earlier forms
+// that read or define the same name, so no form ever sees a binding made
+// later in the program. Forms whose dependencies are all done run at the same
+// time on the future thread pool, and results are printed in source order.
+//
+// Forms that mutate anything (set!, the ! primitives, defines that are not at
+// the top level or in a body), use places, or read a variable that is never
+// defined run alone: everything before them finishes first, and nothing after
+// them starts until they are done. So do forms using time, whose report is
+// printed as soon as it finishes, so that it comes out between the results
+// before and after it. A form that raises an error has its error printed in
+// its turn, as interpretIn would.
+
+// Evaluate each expression of a program at the top level of interp, running
+// independent forms in parallel, and print each result in program order.
+// Returns the number of forms that raised errors.
+int interpretParallel(Interp *interp, Value *tree);
+
+#endif
@@ -2,7 +2,9 @@
 #define _VALUE
 
 typedef enum {INT_TYPE,DOUBLE_TYPE,STR_TYPE,CONS_TYPE,NULL_TYPE,PTR_TYPE,
-              OPEN_TYPE,CLOSE_TYPE,BOOL_TYPE,SYMBOL_TYPE, VOID_TYPE, CLOSURE_TYPE, PRIMITIVE_TYPE} valueType;
+              OPEN_TYPE,CLOSE_TYPE,BOOL_TYPE,SYMBOL_TYPE, VOID_TYPE, CLOSURE_TYPE, PRIMITIVE_TYPE,
+              VECTOR_TYPE, FLVECTOR_TYPE, HASH_TYPE, HAMT_TYPE, FUTURE_TYPE,
+              PLACE_TYPE, CHANNEL_TYPE, ERROR_TYPE} valueType;
 
 struct Value {
     valueType type;
@@ -16,11 +18,26 @@ struct Value {
             struct Value *cdr;
         } c;
         struct Closure {
-            struct Value *paramNames;
-            struct Value *functionCode;
+            // The lambda's parameter names followed by its body
+            struct Value *code;
             struct Frame *frame;
+            // What it was defined as, or NULL if it never was
+            char *name;
         } cl;
         struct Value *(*pf)(struct Value *);
+        struct Vector {
+            int size;
+            struct Value **items;
+        } v;
+        struct FlVector {
+            int size;
+            double *items;
+        } fv;
+        struct HashTable *h;
+        struct Hamt {
+            struct HamtNode *root;
+            int count;
+        } hm;
     };
 };
 